@@ -12,27 +12,45 @@ MODULE_LICENSE("GPL");
 
 static unsigned int crc_chrdev_major = 0;
 static int crc_chrdev_init_success = 0;
+/* Pooled device, not bound to any crc_device */
+static struct cdev crc_chrdev_any;
 
 int __must_check crc_chrdev_init(void) {
 	int rv = 0;
 	dev_t dev = MKDEV(crc_chrdev_major, 0);
+	/* One more minor for pooled device */
 	if ((rv = alloc_chrdev_region(&dev, CRCDEV_BASE_MINOR,
-					CRCDEV_DEVS_COUNT, CRCDEV_PCI_NAME)))
+					CRCDEV_DEVS_COUNT + 1,
+					CRCDEV_PCI_NAME)))
 		return rv;
 	crc_chrdev_major = MAJOR(dev);
+	cdev_init(&crc_chrdev_any, &crc_fileops_fops);
+	crc_chrdev_any.owner = THIS_MODULE;
+	if ((rv = cdev_add(&crc_chrdev_any, crc_chrdev_getdev_any(), 1)))
+		goto fail_any;
 	crc_chrdev_init_success = 1;
 	printk(KERN_INFO "crcdev: chrdev major: %u", crc_chrdev_major);
 	return rv;
+fail_any:
+	unregister_chrdev_region(MKDEV(crc_chrdev_major, CRCDEV_BASE_MINOR),
+			CRCDEV_DEVS_COUNT + 1);
+	return rv;
 }
 
 void crc_chrdev_exit(void) {
 	if (crc_chrdev_init_success) {
+		cdev_del(&crc_chrdev_any);
 		unregister_chrdev_region(MKDEV(crc_chrdev_major,
-					CRCDEV_BASE_MINOR), CRCDEV_DEVS_COUNT);
+					CRCDEV_BASE_MINOR),
+				CRCDEV_DEVS_COUNT + 1);
 		crc_chrdev_init_success = 0;
 	}
 }
 
+dev_t crc_chrdev_getdev_any(void) {
+	return MKDEV(crc_chrdev_major, CRCDEV_ANY_MINOR);
+}
+
 dev_t crc_chrdev_getdev(struct crc_device *cdev) {
 	return MKDEV(crc_chrdev_major, cdev->minor);
 }
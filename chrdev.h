@@ -10,6 +10,8 @@ void crc_chrdev_exit(void);
 
 dev_t crc_chrdev_getdev(struct crc_device *);
 
+dev_t crc_chrdev_getdev_any(void);
+
 int __must_check crc_chrdev_add(struct pci_dev *, struct crc_device *);
 
 void crc_chrdev_del(struct pci_dev *, struct crc_device *);
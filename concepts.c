@@ -1,18 +1,233 @@
 #include <asm/atomic.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+#include <linux/vmalloc.h>
+#include <linux/eventfd.h>
+#include <linux/moduleparam.h>
 #include "concepts.h"
 #include "monitors.h"
 #include "chrdev.h"
+#include "pci.h"
 
 MODULE_LICENSE("GPL");
 
+/* Initial number of tasks, each one can be resized through sysfs */
+static unsigned int crc_buffers = CRCDEV_BUFFERS_COUNT;
+module_param_named(buffers, crc_buffers, uint, S_IRUGO);
+MODULE_PARM_DESC(buffers, "Initial number of DMA buffers of each device");
+
 /* GC statistics */
 static struct {
 	atomic_t devices;
 	atomic_t sessions;
 	atomic_t tasks;
 	atomic_t dma_blocks;
+	atomic_t ubufs;
+	atomic_t rings;
 } crc_gc;
 
+/* crc_ubuf */
+static void crc_ubuf_unpin(struct crc_device *cdev, struct crc_ubuf *ubuf,
+		int mapped, int pinned) {
+	int idx;
+	for (idx = 0; idx < mapped; idx++)
+		pci_unmap_page(cdev->pdev, ubuf->pages_dma[idx], PAGE_SIZE,
+				PCI_DMA_TODEVICE);
+	for (idx = 0; idx < pinned; idx++)
+		page_cache_release(ubuf->pages[idx]);
+}
+
+/* sleeps, pinned pages were charged to locked_vm of the owner */
+static void crc_ubuf_uncharge(struct crc_ubuf *ubuf) {
+	down_write(&ubuf->mm->mmap_sem);
+	ubuf->mm->locked_vm -= ubuf->nr_pages;
+	up_write(&ubuf->mm->mmap_sem);
+	mmdrop(ubuf->mm); ubuf->mm = NULL;
+}
+
+/* sleeps */
+struct crc_ubuf * __must_check crc_ubuf_alloc(struct crc_device *cdev,
+		unsigned long uaddr, size_t len) {
+	int rv = -ENOMEM, pinned = 0, mapped;
+	unsigned long first = uaddr >> PAGE_SHIFT,
+		      last = (uaddr + len - 1) >> PAGE_SHIFT, lock_limit;
+	struct mm_struct *mm = current->mm;
+	struct crc_ubuf *ubuf;
+	if (len == 0 || uaddr + len < uaddr ||
+			last - first + 1 > CRCDEV_UBUF_MAX_PAGES)
+		return ERR_PTR(-EINVAL);
+	if (!(ubuf = kzalloc(sizeof(*ubuf), GFP_KERNEL)))
+		goto fail_alloc;
+	ubuf->first_offset = uaddr & ~PAGE_MASK;
+	ubuf->len = len;
+	ubuf->nr_pages = last - first + 1;
+	ubuf->pages = kcalloc(ubuf->nr_pages, sizeof(*ubuf->pages),
+			GFP_KERNEL);
+	ubuf->pages_dma = kcalloc(ubuf->nr_pages, sizeof(*ubuf->pages_dma),
+			GFP_KERNEL);
+	if (!ubuf->pages || !ubuf->pages_dma)
+		goto fail_arrays;
+	down_write(&mm->mmap_sem);
+	/* Pinned pages are locked memory, just as mlock() would be */
+	lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	if (mm->locked_vm + ubuf->nr_pages > lock_limit &&
+			!capable(CAP_IPC_LOCK)) {
+		up_write(&mm->mmap_sem);
+		goto fail_arrays;
+	}
+	/* Device only reads from these pages, but they are pinned for write so
+	 * that untouched and copy-on-write pages are broken now and user's
+	 * later stores land in pages we have pinned */
+	pinned = get_user_pages(current, mm, uaddr & PAGE_MASK,
+			ubuf->nr_pages, 1, 0, ubuf->pages, NULL);
+	if (pinned == ubuf->nr_pages)
+		mm->locked_vm += ubuf->nr_pages;
+	up_write(&mm->mmap_sem);
+	if (pinned != ubuf->nr_pages) {
+		rv = -EFAULT;
+		goto fail_pin;
+	}
+	ubuf->mm = mm;
+	atomic_inc(&mm->mm_count);
+	for (mapped = 0; mapped < ubuf->nr_pages; mapped++) {
+		ubuf->pages_dma[mapped] = pci_map_page(cdev->pdev,
+				ubuf->pages[mapped], 0, PAGE_SIZE,
+				PCI_DMA_TODEVICE);
+		if (pci_dma_mapping_error(cdev->pdev, ubuf->pages_dma[mapped]))
+			goto fail_map;
+	}
+	atomic_inc(&crc_gc.ubufs);
+	return ubuf;
+fail_map:
+	crc_ubuf_unpin(cdev, ubuf, mapped, pinned);
+	crc_ubuf_uncharge(ubuf);
+	goto fail_arrays;
+fail_pin:
+	/* get_user_pages() might have pinned some of them */
+	crc_ubuf_unpin(cdev, ubuf, 0, max(pinned, 0));
+fail_arrays:
+	kfree(ubuf->pages_dma);
+	kfree(ubuf->pages);
+	kfree(ubuf); ubuf = NULL;
+fail_alloc:
+	return ERR_PTR(rv);
+}
+
+/* sleeps, no task can refer to this buffer */
+void crc_ubuf_free(struct crc_device *cdev, struct crc_ubuf *ubuf) {
+	int idx;
+	if (!ubuf) return;
+	/* Pages go back to the CPU */
+	for (idx = 0; idx < ubuf->nr_pages; idx++)
+		pci_dma_sync_single_for_cpu(cdev->pdev, ubuf->pages_dma[idx],
+				PAGE_SIZE, PCI_DMA_TODEVICE);
+	crc_ubuf_unpin(cdev, ubuf, ubuf->nr_pages, ubuf->nr_pages);
+	crc_ubuf_uncharge(ubuf);
+	kfree(ubuf->pages_dma);
+	kfree(ubuf->pages);
+	kfree(ubuf); ubuf = NULL;
+	atomic_dec(&crc_gc.ubufs);
+}
+
+/* Finds the longest run of data starting at given offset in buffer, which is
+ * contiguous in device's address space, returns its length (at most len) */
+size_t crc_ubuf_run(struct crc_ubuf *ubuf, size_t offset, size_t len,
+		dma_addr_t *dma) {
+	size_t pos = ubuf->first_offset + offset, run;
+	int idx = pos >> PAGE_SHIFT;
+	BUG_ON(offset + len > ubuf->len);
+	*dma = ubuf->pages_dma[idx] + (pos & ~PAGE_MASK);
+	run = PAGE_SIZE - (pos & ~PAGE_MASK);
+	while (run < len && idx + 1 < ubuf->nr_pages && ubuf->pages_dma[idx]
+			+ PAGE_SIZE == ubuf->pages_dma[idx + 1]) {
+		run += PAGE_SIZE;
+		idx++;
+	}
+	return min(run, len);
+}
+
+/* crc_ring */
+#define CRCDEV_RING_SLOT_ORDER	get_order(CRCDEV_BUFFER_SIZE)
+
+static void crc_ring_free_slots(struct crc_device *cdev, struct crc_ring *ring)
+{
+	u32 slot;
+	int idx;
+	for (slot = 0; slot < ring->entries && ring->slots[slot]; slot++) {
+		pci_unmap_page(cdev->pdev, ring->slots_dma[slot],
+				CRCDEV_BUFFER_SIZE, PCI_DMA_TODEVICE);
+		/* Pages still mapped by userspace are referenced by vma */
+		for (idx = 0; idx < (1 << CRCDEV_RING_SLOT_ORDER); idx++)
+			__free_page(nth_page(ring->slots[slot], idx));
+		ring->slots[slot] = NULL;
+	}
+}
+
+/* sleeps */
+struct crc_ring * __must_check crc_ring_alloc(struct crc_device *cdev,
+		u32 entries) {
+	u32 slot;
+	int idx;
+	struct page *page;
+	struct crc_ring *ring;
+	if (!(ring = kzalloc(sizeof(*ring), GFP_KERNEL)))
+		goto fail_alloc;
+	ring->entries = entries;
+	init_waitqueue_head(&ring->cq_wait);
+	BUILD_BUG_ON(sizeof(*ring->head) > CRCDEV_RING_SQ_OFF);
+	ring->rings_size = PAGE_ALIGN(CRCDEV_RING_CQ_OFF(entries) + entries *
+			sizeof(*ring->cqes));
+	if (!(ring->rings = vmalloc_user(ring->rings_size)))
+		goto fail_rings;
+	ring->head = ring->rings;
+	ring->sqes = ring->rings + CRCDEV_RING_SQ_OFF;
+	ring->cqes = ring->rings + CRCDEV_RING_CQ_OFF(entries);
+	ring->slots = kcalloc(entries, sizeof(*ring->slots), GFP_KERNEL);
+	ring->slots_dma = kcalloc(entries, sizeof(*ring->slots_dma),
+			GFP_KERNEL);
+	if (!ring->slots || !ring->slots_dma)
+		goto fail_slots;
+	for (slot = 0; slot < entries; slot++) {
+		if (!(page = alloc_pages(GFP_KERNEL | __GFP_ZERO,
+						CRCDEV_RING_SLOT_ORDER)))
+			goto fail_slots;
+		/* Each page is inserted into userspace mapping separately */
+		split_page(page, CRCDEV_RING_SLOT_ORDER);
+		ring->slots_dma[slot] = pci_map_page(cdev->pdev, page, 0,
+				CRCDEV_BUFFER_SIZE, PCI_DMA_TODEVICE);
+		if (pci_dma_mapping_error(cdev->pdev, ring->slots_dma[slot]))
+			goto fail_map;
+		ring->slots[slot] = page;
+	}
+	atomic_inc(&crc_gc.rings);
+	return ring;
+fail_map:
+	for (idx = 0; idx < (1 << CRCDEV_RING_SLOT_ORDER); idx++)
+		__free_page(nth_page(page, idx));
+fail_slots:
+	if (ring->slots)
+		crc_ring_free_slots(cdev, ring);
+	kfree(ring->slots_dma);
+	kfree(ring->slots);
+	vfree(ring->rings);
+fail_rings:
+	kfree(ring); ring = NULL;
+fail_alloc:
+	return NULL;
+}
+
+/* sleeps, no task can refer to this ring */
+void crc_ring_free(struct crc_device *cdev, struct crc_ring *ring) {
+	if (!ring) return;
+	crc_ring_free_slots(cdev, ring);
+	kfree(ring->slots_dma);
+	kfree(ring->slots);
+	vfree(ring->rings);
+	kfree(ring); ring = NULL;
+	atomic_dec(&crc_gc.rings);
+}
+
 /* crc_session */
 struct crc_session * __must_check crc_session_alloc(struct crc_device *cdev) {
 	struct crc_session *sess;
@@ -22,13 +237,40 @@ struct crc_session * __must_check crc_session_alloc(struct crc_device *cdev) {
 		mutex_init(&sess->call_lock);
 		init_completion(&sess->ioctl_comp);
 		complete_all(&sess->ioctl_comp);
+		INIT_LIST_HEAD(&sess->ready_tasks);
+		INIT_LIST_HEAD(&sess->ready_list);
+		INIT_LIST_HEAD(&sess->wake_list);
+		INIT_LIST_HEAD(&sess->aio_list);
+		atomic_set(&sess->credits_used, 0);
+		init_waitqueue_head(&sess->credit_wait);
+		sess->credit_owner = sess;
 		sess->ctx = CRCDEV_SESSION_NOCTX;
 	}
 	return sess;
 }
 
+/* sleeps */
 void crc_session_free(struct crc_session *sess) {
+	int idx;
 	if (!sess) return;
+	for (idx = 0; idx < CRCDEV_UBUFS_COUNT; idx++) {
+		crc_ubuf_free(sess->crc_dev, sess->ubufs[idx]);
+		sess->ubufs[idx] = NULL;
+	}
+	crc_ring_free(sess->crc_dev, sess->ring); sess->ring = NULL;
+	kfree(sess->soft_table); sess->soft_table = NULL;
+	kfree(sess->checkpoints); sess->checkpoints = NULL;
+	if (sess->eventfd)
+		eventfd_ctx_put(sess->eventfd);
+	sess->eventfd = NULL;
+	for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++) {
+		crc_session_free(sess->stripes[idx]);
+		sess->stripes[idx] = NULL;
+	}
+	for (idx = 0; idx < CRCDEV_CTX_COUNT; idx++) {
+		crc_session_free(sess->compute[idx]);
+		sess->compute[idx] = NULL;
+	}
 	kfree(sess); sess = NULL;
 	atomic_dec(&crc_gc.sessions);
 }
@@ -38,13 +280,17 @@ static DECLARE_BITMAP(crc_device_minors, CRCDEV_DEVS_COUNT);
 static struct crc_device *crc_device_minors_mapping[CRCDEV_DEVS_COUNT];
 static DEFINE_MUTEX(crc_device_minors_lock);
 
-struct crc_device * __must_check crc_device_alloc(void) {
+struct crc_device * __must_check crc_device_alloc(struct pci_dev *pdev) {
 	int idx;
 	struct crc_device *cdev;
 	/* Create device structure */
 	if (!(cdev = kzalloc(sizeof(*cdev), GFP_KERNEL)))
 		goto fail_alloc;
 	atomic_inc(&crc_gc.devices);
+	if (!(cdev->latency = alloc_percpu(struct crc_latency)))
+		goto fail_latency;
+	if (init_srcu_struct(&cdev->remove_srcu))
+		goto fail_srcu;
 	/* Obtain minor */
 	mutex_lock(&crc_device_minors_lock);
 	idx = find_first_zero_bit(crc_device_minors, CRCDEV_DEVS_COUNT);
@@ -57,20 +303,37 @@ struct crc_device * __must_check crc_device_alloc(void) {
 		goto fail_minor;
 	/* Locks */
 	spin_lock_init(&cdev->dev_lock);
-	init_rwsem(&cdev->remove_lock);
+	mutex_init(&cdev->pool_lock);
 	sema_init(&cdev->free_tasks_wait, 0);
+	init_waitqueue_head(&cdev->free_tasks_poll);
 	/* Contexts */
 	bitmap_zero(cdev->contexts_map, CRCDEV_CTX_COUNT);
 	/* Task lists */
 	INIT_LIST_HEAD(&cdev->free_tasks);
-	INIT_LIST_HEAD(&cdev->waiting_tasks);
 	INIT_LIST_HEAD(&cdev->scheduled_tasks);
+	INIT_LIST_HEAD(&cdev->ready_sessions);
+	/* Tunables */
+	cdev->tun.cpu_max = CRCDEV_CPU_MAX;
+	cdev->tun.cpu_busy_max = CRCDEV_CPU_BUSY_MAX;
+	cdev->tun.stripe_min = CRCDEV_STRIPE_MIN;
+	cdev->tun.session_credits = CRCDEV_SESSION_CREDITS;
+	cdev->tun.latency_stats = 1;
+	cdev->tun.poll_threshold = CRCDEV_POLL_THRESHOLD;
+	cdev->tun.poll_interval = CRCDEV_POLL_INTERVAL;
+	cdev->tun.poll_budget = CRCDEV_POLL_BUDGET;
 	/* Minor */
 	cdev->minor = CRCDEV_BASE_MINOR + idx;
+	/* Sessions can outlive PCI device binding, we need it to unmap their
+	 * buffers */
+	cdev->pdev = pci_dev_get(pdev);
 	/* Reference counting */
 	kref_init(&cdev->refc);
 	return cdev;
 fail_minor:
+	cleanup_srcu_struct(&cdev->remove_srcu);
+fail_srcu:
+	free_percpu(cdev->latency); cdev->latency = NULL;
+fail_latency:
 	kfree(cdev); cdev = NULL;
 	atomic_dec(&crc_gc.devices);
 fail_alloc:
@@ -84,7 +347,10 @@ static void crc_device_free_kref(struct kref *ref) {
 	/* Relese minor */
 	clear_bit(idx, crc_device_minors);
 	crc_device_minors_mapping[idx] = NULL;
+	pci_dev_put(cdev->pdev); cdev->pdev = NULL;
 	/* Free mem */
+	cleanup_srcu_struct(&cdev->remove_srcu);
+	free_percpu(cdev->latency); cdev->latency = NULL;
 	kfree(cdev); cdev = NULL;
 	atomic_dec(&crc_gc.devices);
 }
@@ -102,6 +368,72 @@ struct crc_device * __must_check crc_device_get(unsigned int minor) {
 	return cdev;
 }
 
+/* Placement score of a device for pooled sessions, lower is better. Tasks
+ * already queued dominate, then contexts held by busy sessions and sessions
+ * bound to the device. Devices on other NUMA nodes are taken only if local
+ * ones are much busier. Recent throughput (MB/s, 0 once the device has been
+ * idle for a while) is returned aside and only breaks ties. */
+#define	CRCDEV_ANY_TASK_WEIGHT		4
+#define	CRCDEV_ANY_CTX_WEIGHT		2
+#define	CRCDEV_ANY_REMOTE_PENALTY	(CRCDEV_BUFFERS_COUNT * \
+		CRCDEV_ANY_TASK_WEIGHT)
+
+/* CRITICAL (crc_device_minors_lock) */
+static unsigned long crc_device_load(struct crc_device *cdev, int node,
+		unsigned long *rate) {
+	struct crc_task *task;
+	struct crc_session *owner;
+	unsigned long busy, busy_ctx = 0;
+	int ctx, dev_node;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	busy = cdev->tasks_count;
+	list_for_each_entry(task, &cdev->free_tasks, list)
+		busy--;
+	for (ctx = 0; ctx < CRCDEV_CTX_COUNT; ctx++) {
+		owner = cdev->ctx_owner[ctx];
+		if (owner && (owner->scheduled_count || owner->waiting_count))
+			busy_ctx++;
+	}
+	/* Completions have not refreshed the sample for a while */
+	*rate = cdev->load.rate;
+	if (jiffies - cdev->load.stamp >= 2 * CRCDEV_LOAD_PERIOD)
+		*rate = 0;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	busy = busy * CRCDEV_ANY_TASK_WEIGHT + busy_ctx * CRCDEV_ANY_CTX_WEIGHT
+		+ atomic_read(&cdev->sessions_count);
+	dev_node = dev_to_node(&cdev->pdev->dev);
+	if (NUMA_NO_NODE != dev_node && dev_node != node)
+		busy += CRCDEV_ANY_REMOTE_PENALTY;
+	return busy;
+}
+
+/* Returns reference to the least loaded ready device */
+struct crc_device * __must_check crc_device_get_any(void) {
+	int idx, node = numa_node_id();
+	struct crc_device *cdev, *best = NULL;
+	unsigned long load, rate, best_load = ULONG_MAX, best_rate = 0;
+	mutex_lock(&crc_device_minors_lock);
+	for (idx = 0; idx < CRCDEV_DEVS_COUNT; idx++) {
+		cdev = crc_device_minors_mapping[idx];
+		if (!cdev || !test_bit(CRCDEV_STATUS_READY, &cdev->status))
+			continue;
+		load = crc_device_load(cdev, node, &rate);
+		if (load < best_load || (load == best_load &&
+					rate < best_rate)) {
+			best = cdev;
+			best_load = load;
+			best_rate = rate;
+		}
+	}
+	if (best) {
+		kref_get(&best->refc);
+	}
+	mutex_unlock(&crc_device_minors_lock);
+	return best;
+}
+
 void crc_device_put(struct crc_device *cdev) {
 	if (!cdev) return;
 	mutex_lock(&crc_device_minors_lock);
@@ -109,11 +441,82 @@ void crc_device_put(struct crc_device *cdev) {
 	mutex_unlock(&crc_device_minors_lock);
 }
 
+/* sleeps */
+static struct crc_task * __must_check crc_task_alloc(struct crc_device *cdev) {
+	struct crc_task *task;
+	if (!(task = kzalloc(sizeof(*task), GFP_KERNEL)))
+		return NULL;
+	atomic_inc(&crc_gc.tasks);
+	task->data = dma_pool_alloc(cdev->task_pool, GFP_KERNEL,
+			&task->data_dma);
+	if (!task->data) {
+		/* Free partially created task */
+		kfree(task); task = NULL;
+		atomic_dec(&crc_gc.tasks);
+		return NULL;
+	}
+	atomic_inc(&crc_gc.dma_blocks);
+	return task;
+}
+
+static void crc_task_free(struct crc_device *cdev, struct crc_task *task) {
+	dma_pool_free(cdev->task_pool, task->data, task->data_dma);
+	atomic_dec(&crc_gc.dma_blocks);
+	kfree(task); task = NULL;
+	atomic_dec(&crc_gc.tasks);
+}
+
+/* sleeps, shrinking waits until enough tasks are returned to the pool */
+int __must_check crc_device_pool_resize(struct crc_device *cdev, size_t count)
+{
+	int rv = 0;
+	size_t added = 0;
+	struct crc_task *task;
+	LIST_HEAD(tmp_list);
+	if (count < 1 || CRCDEV_BUFFERS_MAX < count)
+		return -EINVAL;
+	/* BEGIN CRITICAL (cdev->pool_lock) */
+	if ((rv = mutex_lock_interruptible(&cdev->pool_lock)))
+		return rv;
+	while (cdev->tasks_count + added < count) {
+		if (!(task = crc_task_alloc(cdev))) {
+			rv = -ENOMEM;
+			break;
+		}
+		list_add(&task->list, &tmp_list);
+		added++;
+	}
+	if (added) {
+		/* BEGIN CRITICAL (cdev->dev_lock) */
+		mon_device_lock(cdev);
+		list_splice(&tmp_list, &cdev->free_tasks);
+		cdev->tasks_count += added;
+		mon_device_unlock(cdev);
+		/* END CRITICAL (cdev->dev_lock) */
+		mon_device_free_tasks(cdev, added);
+	}
+	while (cdev->tasks_count > count) {
+		/* Reserved task is ours, no one else will take it */
+		if ((rv = mon_device_reserve_task(cdev)))
+			break;
+		/* BEGIN CRITICAL (cdev->dev_lock) */
+		mon_device_lock(cdev);
+		task = list_first_entry(&cdev->free_tasks, struct crc_task,
+				list);
+		list_del(&task->list);
+		cdev->tasks_count--;
+		mon_device_unlock(cdev);
+		/* END CRITICAL (cdev->dev_lock) */
+		crc_task_free(cdev, task);
+	}
+	mutex_unlock(&cdev->pool_lock);
+	/* END CRITICAL (cdev->pool_lock) */
+	return rv;
+}
+
 /* init_only, sleeps */
 int __must_check crc_device_dma_alloc(struct pci_dev *pdev,
 		struct crc_device *cdev) {
-	int count;
-	struct crc_task *task;
 	BUILD_BUG_ON(sizeof(*(cdev->cmd_block)) != CRCDEV_CMD_SIZE);
 	cdev->cmd_block = dma_alloc_coherent(&pdev->dev,
 			sizeof(*(cdev->cmd_block)) * CRCDEV_COMMANDS_LENGTH,
@@ -121,32 +524,54 @@ int __must_check crc_device_dma_alloc(struct pci_dev *pdev,
 	if (!cdev->cmd_block)
 		goto fail;
 	atomic_inc(&crc_gc.dma_blocks);
-	for (count = 0; count < CRCDEV_BUFFERS_COUNT; count++) {
-		if (!(task = kzalloc(sizeof(*task), GFP_KERNEL)))
-			goto fail;
-		atomic_inc(&crc_gc.tasks);
-		task->data = dma_alloc_coherent(&pdev->dev, CRCDEV_BUFFER_SIZE,
-				&task->data_dma, GFP_KERNEL);
-		if (!task->data) {
-			/* Free partially created task */
-			kfree(task); task = NULL;
-			atomic_dec(&crc_gc.tasks);
-			goto fail;
-		}
-		atomic_inc(&crc_gc.dma_blocks);
-		list_add(&task->list, &cdev->free_tasks);
-	}
-	sema_init(&cdev->free_tasks_wait, count);
+	/* Buffers are page aligned, as they were with separate allocations */
+	cdev->task_pool = dma_pool_create(CRCDEV_PCI_NAME, &pdev->dev,
+			CRCDEV_BUFFER_SIZE, PAGE_SIZE, 0);
+	if (!cdev->task_pool)
+		goto fail;
+	if (crc_device_pool_resize(cdev, clamp_t(size_t, crc_buffers, 1,
+					CRCDEV_BUFFERS_MAX)))
+		goto fail;
 	return 0;
 fail:
 	crc_device_dma_free(pdev, cdev);
 	return -ENOMEM;
 }
 
+/* Snapshot of tasks by state, the rest is being filled by writers */
+void crc_device_occupancy(struct crc_device *cdev, size_t *free,
+		size_t *waiting, size_t *scheduled) {
+	struct crc_session *sess;
+	struct list_head *pos;
+	*free = *waiting = *scheduled = 0;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	list_for_each(pos, &cdev->free_tasks)
+		(*free)++;
+	list_for_each_entry(sess, &cdev->ready_sessions, ready_list)
+		*waiting += sess->waiting_count;
+	list_for_each(pos, &cdev->scheduled_tasks)
+		(*scheduled)++;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+}
+
+/* Sums up latency histogram of all CPUs into CRCDEV_LAT_BUCKETS counters,
+ * concurrent updates might be missed */
+void crc_device_latency(struct crc_device *cdev, u64 *buckets) {
+	int cpu, idx;
+	memset(buckets, 0, sizeof(*buckets) * CRCDEV_LAT_BUCKETS);
+	for_each_possible_cpu(cpu) {
+		struct crc_latency *lat = per_cpu_ptr(cdev->latency, cpu);
+		for (idx = 0; idx < CRCDEV_LAT_BUCKETS; idx++)
+			buckets[idx] += ACCESS_ONCE(lat->buckets[idx]);
+	}
+}
+
 /* deinit_only, sleeps */
 void crc_device_dma_free(struct pci_dev *pdev, struct crc_device *cdev) {
-	unsigned long flags;
 	struct crc_task *task, *tmp;
+	struct crc_session *sess, *stmp;
 	struct list_head tmp_list;
 	if (cdev->cmd_block) {
 		dma_free_coherent(&pdev->dev, sizeof(*cdev->cmd_block) *
@@ -157,18 +582,25 @@ void crc_device_dma_free(struct pci_dev *pdev, struct crc_device *cdev) {
 	}
 	INIT_LIST_HEAD(&tmp_list);
 	/* BEGIN CRITICAL (cdev->dev_lock) */
-	mon_device_lock(cdev, flags);
+	mon_device_lock(cdev);
 	list_splice_init(&cdev->free_tasks, &tmp_list);
-	list_splice_init(&cdev->waiting_tasks, &tmp_list);
 	list_splice_init(&cdev->scheduled_tasks, &tmp_list);
-	mon_device_unlock(cdev, flags);
+	/* Sessions still queued are alive, release() unlinks them under
+	 * dev_lock before freeing */
+	list_for_each_entry_safe(sess, stmp, &cdev->ready_sessions,
+			ready_list) {
+		list_splice_init(&sess->ready_tasks, &tmp_list);
+		list_del_init(&sess->ready_list);
+	}
+	cdev->ready_count = 0;
+	cdev->tasks_count = 0;
+	mon_device_unlock(cdev);
 	/* END CRITICAL (cdev->dev_lock) */
-	list_for_each_entry_safe(task, tmp, &tmp_list, list) {
-		dma_free_coherent(&pdev->dev, CRCDEV_BUFFER_SIZE, task->data,
-				task->data_dma);
-		atomic_dec(&crc_gc.dma_blocks);
-		kfree(task); task = NULL;
-		atomic_dec(&crc_gc.tasks);
+	list_for_each_entry_safe(task, tmp, &tmp_list, list)
+		crc_task_free(cdev, task);
+	if (cdev->task_pool) {
+		dma_pool_destroy(cdev->task_pool);
+		cdev->task_pool = NULL;
 	}
 }
 
@@ -181,6 +613,8 @@ int crc_concepts_init(void) {
 	atomic_set(&crc_gc.sessions, 0);
 	atomic_set(&crc_gc.tasks, 0);
 	atomic_set(&crc_gc.dma_blocks, 0);
+	atomic_set(&crc_gc.ubufs, 0);
+	atomic_set(&crc_gc.rings, 0);
 	return 0;
 }
 
@@ -188,11 +622,14 @@ void crc_concepts_exit(void) {
 	int devices = atomic_read(&crc_gc.devices),
 	    sessions = atomic_read(&crc_gc.sessions),
 	    tasks = atomic_read(&crc_gc.tasks),
-	    dma_blocks = atomic_read(&crc_gc.dma_blocks);
-	if (devices || sessions || tasks || dma_blocks) {
+	    dma_blocks = atomic_read(&crc_gc.dma_blocks),
+	    ubufs = atomic_read(&crc_gc.ubufs),
+	    rings = atomic_read(&crc_gc.rings);
+	if (devices || sessions || tasks || dma_blocks || ubufs || rings) {
 		printk(KERN_ERR "crcdev: concepts: not all objects collected: "
-			"devices %d, sessions %d, tasks %d, dma_blocks %d",
-			devices, sessions, tasks, dma_blocks);
+			"devices %d, sessions %d, tasks %d, dma_blocks %d, "
+			"ubufs %d, rings %d", devices, sessions, tasks,
+			dma_blocks, ubufs, rings);
 	} else {
 		printk(KERN_INFO "crcdev: concepts: gc successful");
 	}
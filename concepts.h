@@ -6,13 +6,19 @@
 #include <linux/list.h>
 #include <linux/kref.h>
 #include <linux/completion.h>
-#include <linux/rwsem.h>
+#include <linux/srcu.h>
 #include <linux/semaphore.h>
 #include <linux/spinlock.h>
 #include <linux/pci.h>
 #include <linux/cdev.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/dmapool.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 #include <asm/page.h>
 #include "crcdev.h"
+#include "crcdev_ioctl.h"
 
 #ifdef CRC_DEBUG
 #define my_debug(fmt, args...) printk(KERN_DEBUG "crcdev: " fmt, ## args)
@@ -20,18 +26,108 @@
 #define my_debug(fmt, args...)
 #endif  // CRC_DEBUG
 
+/* Default and maximal number of tasks of each device */
 #define	CRCDEV_BUFFERS_COUNT	24
-#define	CRCDEV_COMMANDS_LENGTH	(CRCDEV_BUFFERS_COUNT + 1)
+#define	CRCDEV_BUFFERS_MAX	256
+#define	CRCDEV_COMMANDS_LENGTH	(CRCDEV_BUFFERS_MAX + 1)
 #define	CRCDEV_BUFFER_SIZE	(PAGE_SIZE * 4)
+#define	CRCDEV_BATCH_COUNT	(CRCDEV_BUFFERS_COUNT / 4)
+#define	CRCDEV_DRR_QUANTUM	(CRCDEV_BUFFER_SIZE * 4)
+#define	CRCDEV_CPU_MAX		256
+#define	CRCDEV_CPU_BUSY_MAX	(CRCDEV_BUFFER_SIZE * 4)
+#define	CRCDEV_STRIPES_COUNT	(CRCDEV_CTX_COUNT - 1)
+#define	CRCDEV_STRIPE_MIN	(CRCDEV_BUFFER_SIZE * 16)
+#define	CRCDEV_SESSION_CREDITS	(CRCDEV_BUFFERS_COUNT / 2)
+/* Latency histogram, bucket n counts tasks completed in [2^n, 2^(n+1)) us */
+#define	CRCDEV_LAT_BUCKETS	24
+/* Hybrid polling: completions per second which switch device to polling,
+ * sleep between polling passes and time budget of one run (in us) */
+#define	CRCDEV_POLL_THRESHOLD	20000
+#define	CRCDEV_POLL_INTERVAL	50
+#define	CRCDEV_POLL_BUDGET	200
+#define	CRCDEV_POLL_WINDOW	(HZ / 100 ?: 1)
+/* Throughput of a device used by placement of pooled sessions is sampled
+ * once per period, samples after a longer gap are dropped */
+#define	CRCDEV_LOAD_PERIOD	(HZ / 10 ?: 1)
 #define	CRCDEV_DEVS_COUNT	255
 #define	CRCDEV_BASE_MINOR	0
+/* Pooled device, follows minors of all crc_devices */
+#define	CRCDEV_ANY_MINOR	(CRCDEV_BASE_MINOR + CRCDEV_DEVS_COUNT)
+#define	CRCDEV_UBUFS_COUNT	16
+#define	CRCDEV_UBUF_MAX_PAGES	16384
+#define	CRCDEV_RING_MAX_ENTRIES	256
+#define	CRCDEV_RING_SQ_OFF	64
+#define	CRCDEV_RING_CQ_OFF(entries) (CRCDEV_RING_SQ_OFF + \
+		(entries) * sizeof(struct crcdev_ring_sqe))
 
 struct crc_device;
+struct eventfd_ctx;
+struct kiocb;
 
 /* Common */
 int __must_check crc_concepts_init(void);
 void crc_concepts_exit(void);
 
+/* crc_ubuf */
+struct crc_ubuf {
+	/* Offset of the first byte in the first page */
+	size_t first_offset;
+	/* Length of registered area in bytes */
+	size_t len;
+	/* Pinned user pages and their addresses in device's address space */
+	int nr_pages;
+	struct page **pages;
+	dma_addr_t *pages_dma;
+	/* Address space whose locked_vm is charged for pinned pages */
+	struct mm_struct *mm;
+};
+
+struct crc_ubuf * __must_check crc_ubuf_alloc(struct crc_device *,
+		unsigned long, size_t);
+void crc_ubuf_free(struct crc_device *, struct crc_ubuf *);
+size_t crc_ubuf_run(struct crc_ubuf *, size_t, size_t, dma_addr_t *);
+
+/* crc_ring */
+struct crc_ring {
+	/* Shared with userspace: head, submission and completion queues */
+	void *rings;
+	size_t rings_size;
+	struct crcdev_ring_head *head;
+	struct crcdev_ring_sqe *sqes;
+	struct crcdev_ring_cqe *cqes;
+	u32 entries;
+	/* Data slots (split pages), one per entry, each CRCDEV_BUFFER_SIZE */
+	struct page **slots;
+	dma_addr_t *slots_dma;
+	/* Private copies of ring positions */
+	u32 sq_head;				// call_lock(rw)
+	u32 cq_tail;				// dev_lock(rw)
+	/* Number of submitted entries without completion */
+	u32 inflight;				// dev_lock(rw)
+	wait_queue_head_t cq_wait;
+};
+
+struct crc_ring * __must_check crc_ring_alloc(struct crc_device *, u32);
+void crc_ring_free(struct crc_device *, struct crc_ring *);
+
+/* crc_aio */
+/* Asynchronous write, its iocb is completed with res as soon as session's
+ * done_bytes reach target */
+struct crc_aio {
+	struct list_head list;
+	struct kiocb *iocb;
+	u64 target;
+	long res;
+};
+
+/* crc_checkpoint */
+struct crc_checkpoint {
+	int valid;
+	u32 poly;
+	u32 sum;
+	u64 bytes;
+};
+
 /* crc_session */
 #define CRCDEV_SESSION_NOCTX	(-1)
 
@@ -44,16 +140,71 @@ struct crc_session {
 	/* Task stats */
 	size_t waiting_count;			// dev_lock(rw)
 	size_t scheduled_count;			// dev_lock(rw)
-	/* Context */
+	/* Tasks waiting for the device, session is linked in device's
+	 * ready_sessions iff this list is not empty */
+	struct list_head ready_tasks;		// dev_lock(rw)
+	struct list_head ready_list;		// dev_lock(rw)
+	/* Deficit round robin credit in bytes, no task is ever larger than
+	 * CRCDEV_DRR_QUANTUM */
+	size_t deficit;				// dev_lock(rw)
+	/* Context, poly and sum are stale while the session holds a context,
+	 * the device copy is read back on eviction or crc_session_ctx_sync() */
 	int ctx;				// dev_lock(rw)
 	u32 poly;				// dev_lock(rw)
 	u32 sum;				// dev_lock(rw)
+	/* Lookup table for software checksum of non-standard poly */
+	u32 *soft_table;			// call_lock(rw)
+	u32 soft_poly;				// call_lock(rw)
+	/* Stripes of large writes, children are checksummed from zero state on
+	 * their own contexts and combined into this session when all are done,
+	 * the last combined one receives data written in the meantime; first
+	 * stripes_tail of stripes_count children are combined, the rest holds
+	 * data past a failed write and is only waited for */
+	struct crc_session *stripes[CRCDEV_STRIPES_COUNT];	// call_lock(rw)
+	size_t stripes_len[CRCDEV_STRIPES_COUNT];	// call_lock(rw)
+	int stripes_count;			// call_lock(rw)
+	int stripes_tail;			// call_lock(rw)
+	/* Children which checksum COMPUTE requests too long for CPU, one per
+	 * hardware context so that a batch can use all of them */
+	struct crc_session *compute[CRCDEV_CTX_COUNT];	// call_lock(rw)
+	/* Tasks held by session (filled, waiting or scheduled) are limited by
+	 * credits, 0 means device default, writers out of credit sleep on
+	 * credit_wait until completion of their own tasks; stripes and COMPUTE
+	 * children are charged to credit_owner (their parent), so that all of
+	 * them together hold no more than the parent is allowed to */
+	unsigned int credits;			// call_lock(rw)
+	atomic_t credits_used;			// atomic
+	wait_queue_head_t credit_wait;
+	struct crc_session *credit_owner;	// init
+	/* Registered user buffers */
+	struct crc_ubuf *ubufs[CRCDEV_UBUFS_COUNT];	// call_lock(rw)
+	/* Shared memory rings, set up at most once */
+	struct crc_ring *ring;			// call_lock(w)
+	/* Bytes queued to the device and not yet completed, bytes completed
+	 * since SET_PARAMS and how many of them sum covers, sum is brought up
+	 * to date on every drain of scheduled tasks once track_sum is set */
+	u64 pending_bytes;			// dev_lock(rw)
+	u64 done_bytes;				// dev_lock(rw)
+	u64 sum_bytes;				// dev_lock(rw)
+	int track_sum;				// dev_lock(rw)
+	/* SRCU index of remove_srcu read side held by this session's call */
+	int remove_idx;				// call_lock(rw)
+	/* Signalled whenever session's data drains */
+	struct eventfd_ctx *eventfd;		// call_lock(w), dev_lock(w)
+	/* Asynchronous writes in order of their targets */
+	struct list_head aio_list;		// dev_lock(rw)
+	/* Saved states, CRCDEV_CHECKPOINTS of them allocated on first save */
+	struct crc_checkpoint *checkpoints;	// call_lock(rw)
+	/* Sessions with completions posted in current interrupt pass */
+	struct list_head wake_list;		// dev_lock(rw)
 };
 
 struct crc_session * __must_check crc_session_alloc(struct crc_device *);
 void crc_session_free(struct crc_session *);
 
 /* crc_task */
+#define CRCDEV_TASK_NORING	(-1)
+
 struct crc_task {
 	/* One task can be in one of the following: scheduled, waiting, free */
 	struct list_head list;
@@ -61,6 +212,14 @@ struct crc_task {
 	struct crc_session *session;
 	/* This is a size of meaningful data in buffer */
 	size_t data_count;
+	/* Time of submission in ns, 0 if latency is not accounted */
+	u64 stamp;
+	/* Ring data slot and submission cookie if task comes from ring */
+	int ring_slot;
+	u64 ring_user_data;
+	/* Address of data to be processed in device's address space, either
+	 * data_dma or a run of pages from registered user buffer */
+	dma_addr_t cmd_dma;
 	/* Address of data in device's address space */
 	dma_addr_t data_dma;
 	u8 *data;
@@ -72,30 +231,123 @@ struct crc_command {
 } __packed;
 
 /* crc_device */
+struct crc_stats {
+	/* MMIO accesses on hot paths */
+	atomic64_t mmio;
+	/* Commands put to the device and completed */
+	atomic64_t cmds_submitted;
+	atomic64_t bytes_submitted;
+	atomic64_t cmds_done;
+	/* Threaded interrupt handler passes by type */
+	atomic64_t irq_fetch_data;
+	atomic64_t irq_cmd_nonfull;
+	/* Scheduler passes stopped by lack of contexts or full command block */
+	atomic64_t no_free_context;
+	atomic64_t cmd_full;
+	/* Write position updates (one per batch of commands) */
+	atomic64_t doorbells;
+	/* Bytes of completed commands */
+	atomic64_t bytes_done;
+	/* Context loads and evictions of idle sessions */
+	atomic64_t ctx_loads;
+	atomic64_t ctx_evictions;
+	/* Bytes checksummed on CPU instead of the device */
+	atomic64_t cpu_bytes;
+	/* Task reservations which found session out of credit */
+	atomic64_t credit_limit_hits;
+	/* Switches to polling mode and passes of the poller */
+	atomic64_t poll_enter;
+	atomic64_t poll_passes;
+};
+
+/* Per-CPU, updated without locks and summed up on read */
+struct crc_latency {
+	u64 buckets[CRCDEV_LAT_BUCKETS];
+};
+
+/* Writes which are checksummed on CPU: all up to cpu_max bytes, up to
+ * cpu_busy_max bytes if session cannot get a context right away; writes of
+ * at least stripe_min bytes are striped (0 disables); session_credits is
+ * the default limit of tasks held by one session (0 disables); latency
+ * histogram is collected iff latency_stats is set; completions are polled
+ * above poll_threshold per second (0 disables) until the rate falls below
+ * half of it or device idles, poller sleeps poll_interval us after each run
+ * of at most poll_budget us */
+struct crc_tunables {
+	unsigned int cpu_max;
+	unsigned int cpu_busy_max;
+	unsigned int stripe_min;
+	unsigned int session_credits;
+	unsigned int latency_stats;
+	unsigned int poll_threshold;
+	unsigned int poll_interval;
+	unsigned int poll_budget;
+};
+
 #define	CRCDEV_STATUS_IRQ	1
 #define	CRCDEV_STATUS_READY	2
 #define	CRCDEV_STATUS_CHRDEV	4
 #define	CRCDEV_STATUS_REMOVED	8
+#define	CRCDEV_STATUS_POLLING	16
 
 struct crc_device {
 	unsigned long status;		// atomic bitops
 	/* Locks */
 	spinlock_t dev_lock;
-	struct rw_semaphore remove_lock; /* no reader will ever wait */
+	/* Readers never wait, they check STATUS_REMOVED under it */
+	struct srcu_struct remove_srcu;
 	struct semaphore free_tasks_wait;
-	/* Contexts */
+	/* Pollers waiting for free tasks */
+	wait_queue_head_t free_tasks_poll;
+	/* Contexts, each one stays bound to its last session until evicted */
 	DECLARE_BITMAP(contexts_map, CRCDEV_CTX_COUNT);		// dev_lock(rw)
-	/* Tasks for this device */
+	struct crc_session *ctx_owner[CRCDEV_CTX_COUNT];	// dev_lock(rw)
+	/* Last use of each context, for LRU eviction */
+	unsigned long ctx_used[CRCDEV_CTX_COUNT];		// dev_lock(rw)
+	unsigned long ctx_clock;				// dev_lock(rw)
+	/* Tasks' buffers, pool can be resized while device is live */
+	struct dma_pool *task_pool;		// init
+	struct mutex pool_lock;
+	size_t tasks_count;			// pool_lock(w), dev_lock(w)
+	/* Tasks for this device, waiting ones are queued in sessions */
 	struct list_head free_tasks;		// dev_lock(rw)
-	struct list_head waiting_tasks;		// dev_lock(rw)
 	struct list_head scheduled_tasks;	// dev_lock(rw)
+	/* Sessions with waiting tasks in round robin order */
+	struct list_head ready_sessions;	// dev_lock(rw)
+	size_t ready_count;			// dev_lock(rw)
 	/* BAR0 address */
 	void __iomem *bar0;			// dev_lock(rw)
 	/* Address of first cmd_block entry in dev address space */
 	dma_addr_t cmd_block_dma;		// init
 	struct crc_command *cmd_block;		// dev_lock(rw)
 	/* Index in cmd_block of cmd next-to-be-processed by FETCH_DATA irq */
-	size_t next_pos;
+	size_t next_pos;			// dev_lock(rw)
+	/* Shadows of device's FETCH_CMD positions, read position is cached
+	 * once per interrupt pass, write position is only written by us */
+	size_t read_pos;			// dev_lock(rw)
+	size_t write_pos;			// dev_lock(rw)
+	/* Statistics and sysfs tunables */
+	struct crc_stats stats;			// atomic
+	struct crc_latency __percpu *latency;	// per-CPU
+	struct crc_tunables tun;		// ACCESS_ONCE
+	/* Completion rate (per second) sampled by interrupt handler and the
+	 * poller, the poller serves device iff STATUS_POLLING is set */
+	struct {
+		unsigned long stamp;
+		size_t count;
+		unsigned long rate;
+	} poll;					// dev_lock(rw)
+	struct task_struct *poller;		// init
+	/* Number of sessions opened by users on this device */
+	atomic_t sessions_count;		// atomic
+	/* Throughput (MB/s) sampled by interrupt handler and the poller */
+	struct {
+		unsigned long stamp;
+		u64 bytes;
+		unsigned long rate;
+	} load;					// dev_lock(rw)
+	/* PCI device we map user buffers for */
+	struct pci_dev *pdev;			// init
 	/* Sysfs device */
 	struct device *sysfs_dev;		// init
 	/* Char dev and its minor number */
@@ -105,12 +357,16 @@ struct crc_device {
 	struct kref refc;			// private
 };
 
-struct crc_device * __must_check crc_device_alloc(void);
+struct crc_device * __must_check crc_device_alloc(struct pci_dev *);
 
 struct crc_device * __must_check crc_device_get(unsigned int);
+struct crc_device * __must_check crc_device_get_any(void);
 void crc_device_put(struct crc_device *);
 
 int __must_check crc_device_dma_alloc(struct pci_dev *, struct crc_device *);
+int __must_check crc_device_pool_resize(struct crc_device *, size_t);
+void crc_device_occupancy(struct crc_device *, size_t *, size_t *, size_t *);
+void crc_device_latency(struct crc_device *, u64 *);
 void crc_device_dma_free(struct pci_dev *, struct crc_device *);
 
 #endif  /* SESSION_H_ */
@@ -0,0 +1,107 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM crcdev
+
+#if !defined(CRCDEV_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define CRCDEV_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include "concepts.h"
+
+/* Lifecycle of a task: reserve -> queue -> schedule -> complete, contexts
+ * are loaded on schedule and released on eviction or unbinding. Session and
+ * task might be NULL, ring positions are read without dev_lock outside of
+ * interrupt handler. */
+DECLARE_EVENT_CLASS(crcdev_task,
+	TP_PROTO(struct crc_device *cdev, struct crc_session *sess,
+		struct crc_task *task),
+	TP_ARGS(cdev, sess, task),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(const void *, sess)
+		__field(const void *, task)
+		__field(int, ctx)
+		__field(unsigned int, count)
+		__field(unsigned int, next_pos)
+		__field(unsigned int, write_pos)
+	),
+	TP_fast_assign(
+		__entry->minor = cdev->minor;
+		__entry->sess = sess;
+		__entry->task = task;
+		__entry->ctx = sess ? sess->ctx : CRCDEV_SESSION_NOCTX;
+		__entry->count = task ? task->data_count : 0;
+		__entry->next_pos = cdev->next_pos;
+		__entry->write_pos = cdev->write_pos;
+	),
+	TP_printk("minor=%u sess=%p task=%p ctx=%d count=%u next=%u write=%u",
+		__entry->minor, __entry->sess, __entry->task, __entry->ctx,
+		__entry->count, __entry->next_pos, __entry->write_pos)
+);
+
+#define CRCDEV_TRACE_TASK(name) \
+DEFINE_EVENT(crcdev_task, name, \
+	TP_PROTO(struct crc_device *cdev, struct crc_session *sess, \
+		struct crc_task *task), \
+	TP_ARGS(cdev, sess, task))
+
+CRCDEV_TRACE_TASK(crcdev_task_reserve);
+CRCDEV_TRACE_TASK(crcdev_task_queue);
+CRCDEV_TRACE_TASK(crcdev_task_schedule);
+CRCDEV_TRACE_TASK(crcdev_task_complete);
+CRCDEV_TRACE_TASK(crcdev_ctx_load);
+CRCDEV_TRACE_TASK(crcdev_ctx_release);
+CRCDEV_TRACE_TASK(crcdev_device_remove);
+
+/* What a session is blocked on */
+#define	CRCDEV_WAIT_TASK	0
+#define	CRCDEV_WAIT_CREDIT	1
+#define	CRCDEV_WAIT_DONE	2
+
+/* Emitted only when the wait actually sleeps */
+DECLARE_EVENT_CLASS(crcdev_wait,
+	TP_PROTO(struct crc_device *cdev, struct crc_session *sess,
+		int reason),
+	TP_ARGS(cdev, sess, reason),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(const void *, sess)
+		__field(int, ctx)
+		__field(int, reason)
+		__field(unsigned int, next_pos)
+		__field(unsigned int, write_pos)
+	),
+	TP_fast_assign(
+		__entry->minor = cdev->minor;
+		__entry->sess = sess;
+		__entry->ctx = sess ? sess->ctx : CRCDEV_SESSION_NOCTX;
+		__entry->reason = reason;
+		__entry->next_pos = cdev->next_pos;
+		__entry->write_pos = cdev->write_pos;
+	),
+	TP_printk("minor=%u sess=%p ctx=%d reason=%s next=%u write=%u",
+		__entry->minor, __entry->sess, __entry->ctx,
+		__print_symbolic(__entry->reason,
+			{ CRCDEV_WAIT_TASK, "task" },
+			{ CRCDEV_WAIT_CREDIT, "credit" },
+			{ CRCDEV_WAIT_DONE, "done" }),
+		__entry->next_pos, __entry->write_pos)
+);
+
+DEFINE_EVENT(crcdev_wait, crcdev_wait_start,
+	TP_PROTO(struct crc_device *cdev, struct crc_session *sess,
+		int reason),
+	TP_ARGS(cdev, sess, reason));
+
+DEFINE_EVENT(crcdev_wait, crcdev_wait_end,
+	TP_PROTO(struct crc_device *cdev, struct crc_session *sess,
+		int reason),
+	TP_ARGS(cdev, sess, reason));
+
+#endif  // CRCDEV_TRACE_H_
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE crcdev_trace
+#include <trace/define_trace.h>
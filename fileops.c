@@ -1,24 +1,41 @@
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/aio.h>
+#include <linux/eventfd.h>
 #include <asm/uaccess.h>
 #include "crcdev_ioctl.h"
 #include "fileops.h"
 #include "concepts.h"
 #include "monitors.h"
 #include "interrupts.h"
+#include "softcrc.h"
 
 MODULE_LICENSE("GPL");
 
 static int crc_fileops_open(struct inode *inode, struct file *filp) {
 	struct crc_session *sess;
 	unsigned minor = iminor(inode);
-	struct crc_device *cdev = crc_device_get(minor);
+	struct crc_device *cdev;
 	filp->private_data = NULL;
-	if (cdev == NULL || cdev != container_of(inode->i_cdev, struct
-				crc_device, char_dev))
-		goto fail_dev;
+	if (CRCDEV_ANY_MINOR == minor) {
+		/* Pooled device, session goes to the least loaded one */
+		if (!(cdev = crc_device_get_any()))
+			return -ENODEV;
+	} else {
+		cdev = crc_device_get(minor);
+		if (cdev == NULL || cdev != container_of(inode->i_cdev, struct
+					crc_device, char_dev))
+			goto fail_dev;
+	}
 	if (!(sess = crc_session_alloc(cdev)))
 		goto fail_session;
+	/* Children of the session are not counted */
+	atomic_inc(&cdev->sessions_count);
 	filp->private_data = sess;
 	return 0;
 fail_session:
@@ -30,7 +47,7 @@ fail_dev:
 }
 
 static int crc_fileops_release(struct inode *inode, struct file *filp) {
-	int rv = 0;
+	int rv = 0, idx;
 	struct crc_device *cdev;
 	struct crc_session *sess;
 	/* Note that there are no other syscalls to this session, it can be
@@ -40,117 +57,1294 @@ static int crc_fileops_release(struct inode *inode, struct file *filp) {
 		/* Wait for all tasks to complete, tasks's session pointer must
 		 * stay valid since it will be dereferenced by irq handler */
 		rv = mon_session_tasks_wait(sess);
+		for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++)
+			if (sess->stripes[idx])
+				rv = mon_session_tasks_wait(sess->stripes[idx]);
+		for (idx = 0; idx < CRCDEV_CTX_COUNT; idx++)
+			if (sess->compute[idx])
+				rv = mon_session_tasks_wait(
+						sess->compute[idx]);
+		/* Context cannot be bound to a freed session, nor can
+		 * session stay queued after removal */
+		mon_device_lock(cdev);
+		/* BEGIN CRITICAL (cdev->dev_lock) */
+		for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++) {
+			if (!sess->stripes[idx])
+				continue;
+			crc_session_unqueue(sess->stripes[idx]);
+			crc_session_ctx_release(sess->stripes[idx]);
+		}
+		for (idx = 0; idx < CRCDEV_CTX_COUNT; idx++) {
+			if (!sess->compute[idx])
+				continue;
+			crc_session_unqueue(sess->compute[idx]);
+			crc_session_ctx_release(sess->compute[idx]);
+		}
+		crc_session_unqueue(sess);
+		crc_session_ctx_release(sess);
+		/* END CRITICAL (cdev->dev_lock) */
+		mon_device_unlock(cdev);
 		crc_session_free(sess); sess = NULL;
+		atomic_dec(&cdev->sessions_count);
 		crc_device_put(cdev); cdev = NULL;
 	}
 	/* IGNORE (rv) */
 	return 0;
 }
 
-/* Note that write and ioctl are serialized using session->call_lock */
-static ssize_t crc_fileops_write(struct file *filp, const char __user *buff,
-		size_t lcount, loff_t *offp) {
+/* CRITICAL (call_devwide), sleeps unless nonblock is set */
+static struct crc_task * __must_check crc_task_take(struct crc_session *sess,
+		int nonblock) {
 	int rv;
-	struct crc_session *sess = filp->private_data;
 	struct crc_device *cdev = sess->crc_dev;
-	unsigned long flags;
 	struct crc_task *task;
+	if (nonblock)
+		rv = mon_session_try_reserve_task(sess);
+	else
+		rv = mon_session_reserve_task(sess);
+	if (rv)
+		return ERR_PTR(rv);
+	/* We know that there is a task for us (we can take only one) */
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	BUG_ON(list_empty(&cdev->free_tasks));
+	task = list_first_entry(&cdev->free_tasks, struct crc_task, list);
+	list_del(&task->list);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	/* Acquired block must be returned to either free_tasks or
+	 * session's ready_tasks before we leave CRITICAL (call_devwide) */
+	task->session = sess;
+	task->ring_slot = CRCDEV_TASK_NORING;
+	task->data_count = 0;
+	trace_crcdev_task_reserve(cdev, sess, task);
+	return task;
+}
+
+/* CRITICAL (call_devwide) */
+static void crc_task_return(struct crc_task *task) {
+	struct crc_session *sess = task->session;
+	struct crc_device *cdev = sess->crc_dev;
+	task->session = NULL;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	list_add(&task->list, &cdev->free_tasks);
+	mon_session_free_task(sess);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+}
+
+/* Tasks filled by one syscall are queued together, with one dev_lock round
+ * trip and one interrupt enable per batch */
+struct crc_batch {
+	struct list_head tasks;
+	size_t count;
+	size_t ring_count;
+	size_t bytes;
+};
+
+static void crc_batch_init(struct crc_batch *batch) {
+	INIT_LIST_HEAD(&batch->tasks);
+	batch->count = 0;
+	batch->ring_count = 0;
+	batch->bytes = 0;
+}
+
+/* CRITICAL (call_devwide) */
+static void crc_batch_queue(struct crc_session *sess, struct crc_batch *batch)
+{
+	struct crc_device *cdev = sess->crc_dev;
+	struct crc_task *task;
+	if (batch->count == 0)
+		return;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	/* There is no concurrent ioctl nor remove has started, we have
+	 * locked interrupts, no one will wait or complete ioctl_comp */
+	INIT_COMPLETION(sess->ioctl_comp);
+	list_for_each_entry(task, &batch->tasks, list)
+		trace_crcdev_task_queue(cdev, sess, task);
+	list_splice_tail_init(&batch->tasks, &sess->ready_tasks);
+	sess->waiting_count += batch->count;
+	sess->pending_bytes += batch->bytes;
+	if (list_empty(&sess->ready_list)) {
+		list_add_tail(&sess->ready_list, &cdev->ready_sessions);
+		cdev->ready_count++;
+	}
+	if (batch->ring_count)
+		sess->ring->inflight += batch->ring_count;
+	crc_irq_enable(cdev);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	crc_batch_init(batch);
+}
+
+/* CRITICAL (call_devwide) */
+static void crc_batch_add(struct crc_session *sess, struct crc_batch *batch,
+		struct crc_task *task) {
+	/* Latency is measured from here to completion */
+	task->stamp = ACCESS_ONCE(sess->crc_dev->tun.latency_stats) ?
+		ktime_to_ns(ktime_get()) : 0;
+	list_add_tail(&task->list, &batch->tasks);
+	batch->count++;
+	batch->bytes += task->data_count;
+	if (task->ring_slot != CRCDEV_TASK_NORING)
+		batch->ring_count++;
+	/* Do not let the device idle while we fill a long batch */
+	if (batch->count >= CRCDEV_BATCH_COUNT)
+		crc_batch_queue(sess, batch);
+}
+
+/* CRITICAL (call_devwide), we can hold tasks in batch only as long as we do
+ * not wait for more of them */
+static struct crc_task * __must_check crc_batch_take(struct crc_session *sess,
+		struct crc_batch *batch, int nonblock) {
+	struct crc_task *task;
+	if (batch->count == 0 || nonblock)
+		return crc_task_take(sess, nonblock);
+	task = crc_task_take(sess, 1);
+	if (PTR_ERR(task) != -EAGAIN)
+		return task;
+	crc_batch_queue(sess, batch);
+	return crc_task_take(sess, 0);
+}
+
+/* Bytes copied from user at once by software checksum */
+#define	CRCDEV_SOFT_CHUNK	256
+
+/* CRITICAL (call_devwide), decides whether write is checksummed on CPU, if so
+ * returns session's params, sum is final since session has no tasks */
+static int crc_soft_pick(struct crc_session *sess, size_t count, u32 *poly,
+		u32 *sum) {
+	struct crc_device *cdev = sess->crc_dev;
+	unsigned int cpu_max = ACCESS_ONCE(cdev->tun.cpu_max);
+	unsigned int busy_max = ACCESS_ONCE(cdev->tun.cpu_busy_max);
+	int pick = 0;
+	if (0 == count || (count > cpu_max && count > busy_max))
+		return 0;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	if (0 == sess->waiting_count && 0 == sess->scheduled_count) {
+		pick = count <= cpu_max || (count <= busy_max &&
+				!crc_session_ctx_available(sess));
+		if (pick) {
+			crc_session_ctx_sync(sess);
+			*poly = sess->poly;
+			*sum = sess->sum;
+		}
+	}
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	return pick;
+}
+
+/* CRITICAL (call) */
+static int __must_check crc_soft_prepare(struct crc_session *sess, u32 poly) {
+	if (CRCPOLY_LE == poly)
+		return 0;
+	if (sess->soft_table && sess->soft_poly == poly)
+		return 0;
+	if (!sess->soft_table && !(sess->soft_table = kmalloc(sizeof(u32) *
+					CRCDEV_SOFT_TABLE_SIZE, GFP_KERNEL)))
+		return -ENOMEM;
+	crc_soft_table_init(sess->soft_table, poly);
+	sess->soft_poly = poly;
+	return 0;
+}
+
+/* CRITICAL (call_devwide) */
+static ssize_t crc_soft_write_iov(struct crc_session *sess, const struct iovec
+		*iov, unsigned long nr_segs, u32 poly, u32 sum) {
+	ssize_t rv = 0;
+	struct crc_device *cdev = sess->crc_dev;
+	u8 chunk[CRCDEV_SOFT_CHUNK];
+	const char __user *buff;
+	size_t written = 0, seg_count, to_copy;
+	unsigned long seg;
+	for (seg = 0; seg < nr_segs; seg++) {
+		buff = iov[seg].iov_base;
+		seg_count = iov[seg].iov_len;
+		while (seg_count > 0) {
+			/* This may sleep */
+			to_copy = min_t(size_t, seg_count, sizeof(chunk));
+			if (copy_from_user(chunk, buff, to_copy)) {
+				rv = -EFAULT;
+				goto out;
+			}
+			sum = crc_soft_update(sess->soft_table, poly, sum,
+					chunk, to_copy);
+			buff += to_copy;
+			seg_count -= to_copy;
+			written += to_copy;
+		}
+	}
+out:
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	sess->sum = sum;
+	sess->done_bytes += written;
+	sess->sum_bytes = sess->done_bytes;
+	crc_session_ctx_writeback(sess);
+	/* Data drained as soon as it was written */
+	if (sess->eventfd)
+		eventfd_signal(sess->eventfd, 1);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	atomic64_add(written, &cdev->stats.cpu_bytes);
+	my_debug("soft_write: bytes %ld sum %x", written, sum);
+	return written ? written : rv;
+}
+
+/* Position in a vector of user segments */
+struct crc_iov_iter {
+	const struct iovec *iov;
+	unsigned long nr_segs;
+	size_t offset;
+};
+
+/* CRITICAL (call_devwide), queues at most count bytes to the session, packs
+ * them into as few tasks as possible */
+static ssize_t crc_write_queue(struct crc_session *sess,
+		struct crc_iov_iter *it, size_t count, int nonblock) {
+	ssize_t rv = 0;
+	struct crc_batch batch;
+	struct crc_task *task = NULL;
+	const char __user *buff;
 	size_t written = 0, to_copy;
-	/* ENTER (call_devwide) */
-	if ((rv = mon_session_call_devwide_enter(cdev, sess)))
-		goto fail_call_devwide_enter;
-	while (lcount > 0) {
-		if ((rv = mon_session_reserve_task(sess)))
-			goto fail_reserve_task;
-		/* We know that there is a task for us (we can take only one) */
-		/* BEGIN CRITICAL (cdev->dev_lock) */
-		mon_device_lock(cdev, flags);
-		BUG_ON(list_empty(&cdev->free_tasks));
-		task = list_first_entry(&cdev->free_tasks, struct crc_task,
-				list);
-		list_del(&task->list);
-		mon_device_unlock(cdev, flags);
-		/* END CRITICAL (cdev->dev_lock) */
-		/* Acquired block must be returned to either free_tasks or
-		 * waiting_tasks before we leave CRITICAL (call_devwide) */
-		task->session = sess;
+	crc_batch_init(&batch);
+	while (written < count && it->nr_segs > 0) {
+		if (it->offset == it->iov->iov_len) {
+			it->iov++;
+			it->nr_segs--;
+			it->offset = 0;
+			continue;
+		}
+		if (!task) {
+			task = crc_batch_take(sess, &batch, nonblock);
+			if (IS_ERR(task)) {
+				rv = PTR_ERR(task);
+				task = NULL;
+				goto out;
+			}
+			task->cmd_dma = task->data_dma;
+		}
+		buff = it->iov->iov_base + it->offset;
+		to_copy = min_t(size_t, count - written, it->iov->iov_len -
+				it->offset);
+		to_copy = min_t(size_t, to_copy, CRCDEV_BUFFER_SIZE -
+				task->data_count);
 		/* This may sleep */
-		to_copy = min(lcount, (size_t) CRCDEV_BUFFER_SIZE);
-		if (copy_from_user(task->data, buff, to_copy))
-			goto fail_copy;
-		task->data_count = to_copy;
-		lcount -= to_copy;
-		buff += to_copy;
-		*offp += to_copy;
+		if (copy_from_user(task->data + task->data_count, buff,
+					to_copy)) {
+			rv = -EFAULT;
+			goto out;
+		}
+		task->data_count += to_copy;
+		it->offset += to_copy;
 		written += to_copy;
-		/* BEGIN CRITICAL (cdev->dev_lock) */
-		mon_device_lock(cdev, flags);
-		/* There is no concurrent ioctl nor remove has started, we have
-		 * locked interrupts, no one will wait or complete ioctl_comp */
-		INIT_COMPLETION(sess->ioctl_comp);
-		list_add_tail(&task->list, &cdev->waiting_tasks);
-		sess->waiting_count++;
-		crc_irq_enable(cdev);
-		mon_device_unlock(cdev, flags);
-		/* END CRITICAL (cdev->dev_lock) */
+		if (task->data_count == CRCDEV_BUFFER_SIZE) {
+			crc_batch_add(sess, &batch, task);
+			task = NULL;
+		}
 	}
-	mon_session_call_devwide_exit(cdev, sess);
-	/* EXIT (call_devwide) */
-	return written;
-fail_copy:
-	/* Return acquired block */
+out:
+	/* Partially filled task goes with the others */
+	if (task && task->data_count)
+		crc_batch_add(sess, &batch, task);
+	else if (task)
+		crc_task_return(task);
+	crc_batch_queue(sess, &batch);
+	/* Report error (signal, EAGAIN, EFAULT) only if haven't written
+	 * anything */
+	return written ? written : rv;
+}
+
+/* Advances iterator by count bytes */
+static void crc_iov_advance(struct crc_iov_iter *it, size_t count) {
+	size_t step;
+	while (count > 0 && it->nr_segs > 0) {
+		if (it->offset == it->iov->iov_len) {
+			it->iov++;
+			it->nr_segs--;
+			it->offset = 0;
+			continue;
+		}
+		step = min_t(size_t, count, it->iov->iov_len - it->offset);
+		it->offset += step;
+		count -= step;
+	}
+}
+
+/* CRITICAL (call_devwide), session which receives data written next */
+static struct crc_session *crc_stripes_tail(struct crc_session *sess) {
+	if (sess->stripes_tail)
+		return sess->stripes[sess->stripes_tail - 1];
+	return sess;
+}
+
+/* CRITICAL (call_devwide) */
+static void crc_stripes_account(struct crc_session *sess, size_t count) {
+	if (sess->stripes_tail)
+		sess->stripes_len[sess->stripes_tail - 1] += count;
+}
+
+/* CRITICAL (call) or (call_devwide), session and its stripes have no tasks,
+ * sums are read under dev_lock but combined outside of it */
+static void crc_stripes_combine(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	struct crc_session *stripe;
+	u32 sums[CRCDEV_STRIPES_COUNT], sum, poly;
+	size_t bytes = 0;
+	int idx;
+	if (!sess->stripes_count)
+		return;
 	/* BEGIN CRITICAL (cdev->dev_lock) */
-	mon_device_lock(cdev, flags);
-	list_add(&task->list, &cdev->free_tasks);
-	mon_session_free_task(sess);
-	mon_device_unlock(cdev, flags);
+	mon_device_lock(cdev);
+	crc_session_ctx_sync(sess);
+	sum = sess->sum;
+	poly = sess->poly;
+	for (idx = 0; idx < sess->stripes_count; idx++) {
+		stripe = sess->stripes[idx];
+		crc_session_ctx_sync(stripe);
+		sums[idx] = stripe->sum;
+		crc_session_ctx_release(stripe);
+	}
+	mon_device_unlock(cdev);
 	/* END CRITICAL (cdev->dev_lock) */
+	for (idx = 0; idx < sess->stripes_tail; idx++) {
+		sum = crc_soft_combine(sum, sums[idx], sess->stripes_len[idx],
+				poly);
+		bytes += sess->stripes_len[idx];
+	}
+	for (idx = 0; idx < sess->stripes_count; idx++)
+		sess->stripes_len[idx] = 0;
+	sess->stripes_count = 0;
+	sess->stripes_tail = 0;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	sess->sum = sum;
+	sess->done_bytes += bytes;
+	sess->sum_bytes = sess->done_bytes;
+	crc_session_ctx_writeback(sess);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	my_debug("stripes_combine: sum %x", sum);
+}
+
+/* CRITICAL (call_devwide), we cannot wait here, stripes are combined only if
+ * all of them are already done */
+static void crc_stripes_combine_nowait(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	int idx, busy;
+	if (!sess->stripes_count)
+		return;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	busy = sess->waiting_count || sess->scheduled_count;
+	for (idx = 0; idx < sess->stripes_count; idx++)
+		busy |= sess->stripes[idx]->waiting_count ||
+			sess->stripes[idx]->scheduled_count;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	if (!busy)
+		crc_stripes_combine(sess);
+}
+
+/* CRITICAL (call), waits for tasks of session and all its stripes */
+static int __must_check crc_stripes_wait(struct crc_session *sess,
+		int nonblock) {
+	struct crc_session *target;
+	int rv, idx;
+	for (idx = -1; idx < sess->stripes_count; idx++) {
+		target = idx < 0 ? sess : sess->stripes[idx];
+		if (nonblock)
+			rv = mon_session_tasks_done_nowait(target);
+		else
+			rv = mon_session_tasks_wait_interruptible(target);
+		if (rv)
+			return rv;
+	}
+	crc_stripes_combine(sess);
+	return 0;
+}
+
+/* CRITICAL (call_devwide), decides whether write is striped and prepares
+ * stripes to start from zero state */
+static int crc_stripes_pick(struct crc_session *sess, size_t count) {
+	struct crc_device *cdev = sess->crc_dev;
+	unsigned int stripe_min = ACCESS_ONCE(cdev->tun.stripe_min);
+	int idx;
+	/* Completions of ring entries are reported with session's sum, one
+	 * eventfd signal has to cover all data */
+	if (!stripe_min || count < stripe_min || sess->stripes_count ||
+			sess->ring || sess->eventfd)
+		return 0;
+	for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++) {
+		if (!sess->stripes[idx] && !(sess->stripes[idx] =
+					crc_session_alloc(cdev)))
+			return 0;
+		sess->stripes[idx]->credit_owner = sess;
+	}
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++) {
+		crc_session_ctx_release(sess->stripes[idx]);
+		sess->stripes[idx]->poly = sess->poly;
+		sess->stripes[idx]->sum = 0;
+	}
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	return 1;
+}
+
+/* Data queued to one stripe at a time, small enough to keep all of them busy
+ * with the shared pool of tasks */
+#define	CRCDEV_STRIPE_CHUNK	(CRCDEV_BUFFER_SIZE * 2)
+
+/* CRITICAL (call_devwide), splits write into equal pieces of whole tasks,
+ * the first one goes to the session, others to stripes; pieces are queued in
+ * turns so that all of them are processed in parallel. If one of them fails,
+ * only the prefix written without holes counts and stripes beyond it are
+ * not combined. */
+static ssize_t crc_stripes_write(struct crc_session *sess,
+		struct crc_iov_iter *it, size_t count, int nonblock) {
+	struct crc_iov_iter its[CRCDEV_STRIPES_COUNT + 1];
+	size_t left[CRCDEV_STRIPES_COUNT + 1], done[CRCDEV_STRIPES_COUNT + 1];
+	size_t piece, want, written = 0;
+	ssize_t rv = 0;
+	int idx, parts, progress, failed = 0;
+	piece = roundup(DIV_ROUND_UP(count, CRCDEV_STRIPES_COUNT + 1),
+			CRCDEV_BUFFER_SIZE);
+	parts = DIV_ROUND_UP(count, piece);
+	for (idx = 0; idx < parts; idx++) {
+		its[idx] = *it;
+		crc_iov_advance(it, piece);
+		left[idx] = min_t(size_t, piece, count - idx * piece);
+		done[idx] = 0;
+	}
+	do {
+		progress = 0;
+		for (idx = 0; idx < parts && !failed; idx++) {
+			if (!left[idx])
+				continue;
+			want = min_t(size_t, left[idx], CRCDEV_STRIPE_CHUNK);
+			rv = crc_write_queue(idx ? sess->stripes[idx - 1] :
+					sess, &its[idx], want, nonblock);
+			if (rv > 0) {
+				done[idx] += rv;
+				left[idx] -= rv;
+			}
+			if (rv < (ssize_t) want)
+				failed = 1;
+			progress = 1;
+		}
+	} while (progress && !failed);
+	/* Pieces which got any data must be waited for */
+	for (idx = 1; idx < parts; idx++) {
+		sess->stripes_len[idx - 1] = done[idx];
+		if (done[idx])
+			sess->stripes_count = idx;
+	}
+	/* Prefix without holes */
+	for (idx = 0; idx < parts; idx++) {
+		written += done[idx];
+		if (done[idx])
+			sess->stripes_tail = idx;
+		if (left[idx])
+			break;
+	}
+	my_debug("write: striped %ld bytes into %d", written,
+			sess->stripes_tail);
+	return written ? written : rv;
+}
+
+/* CRITICAL (call_devwide) */
+static ssize_t crc_write_iov(struct crc_session *sess, const struct iovec *iov,
+		unsigned long nr_segs, int nonblock) {
+	struct crc_iov_iter it = { iov, nr_segs, 0 };
+	size_t count = iov_length(iov, nr_segs);
+	ssize_t rv;
+	u32 poly, sum;
+	crc_stripes_combine_nowait(sess);
+	/* Small writes and these which would wait for a context are cheaper
+	 * on CPU */
+	if (!sess->stripes_count && crc_soft_pick(sess, count, &poly, &sum) &&
+			!crc_soft_prepare(sess, poly))
+		return crc_soft_write_iov(sess, iov, nr_segs, poly, sum);
+	if (crc_stripes_pick(sess, count))
+		return crc_stripes_write(sess, &it, count, nonblock);
+	rv = crc_write_queue(crc_stripes_tail(sess), &it, count, nonblock);
+	if (rv > 0)
+		crc_stripes_account(sess, rv);
+	return rv;
+}
+
+/* Note that write and ioctl are serialized using session->call_lock */
+static ssize_t crc_fileops_write(struct file *filp, const char __user *buff,
+		size_t lcount, loff_t *offp) {
+	ssize_t rv;
+	struct crc_session *sess = filp->private_data;
+	struct crc_device *cdev = sess->crc_dev;
+	struct iovec iov = { (void __user *) buff, lcount };
+	/* ENTER (call_devwide) */
+	if ((rv = mon_session_call_devwide_enter(cdev, sess)))
+		return rv;
+	rv = crc_write_iov(sess, &iov, 1, filp->f_flags & O_NONBLOCK);
 	mon_session_call_devwide_exit(cdev, sess);
 	/* EXIT (call_devwide) */
-	return -EFAULT;
-fail_reserve_task:
+	if (rv > 0)
+		*offp += rv;
+	return rv;
+}
+
+/* CRITICAL (call_devwide), asynchronous write is never striped and never
+ * waits for the device, it sleeps only for free tasks (as block layer does
+ * for requests) so that pipelined writes stay in order; iocb completes once
+ * the device has checksummed all queued data, CPU writes complete at once */
+static ssize_t crc_aio_write_iov(struct crc_session *sess, struct kiocb *iocb,
+		const struct iovec *iov, unsigned long nr_segs, int nonblock) {
+	struct crc_iov_iter it = { iov, nr_segs, 0 };
+	struct crc_device *cdev = sess->crc_dev;
+	struct crc_session *target;
+	struct crc_aio *aio;
+	size_t count = iov_length(iov, nr_segs);
+	ssize_t rv;
+	u32 poly, sum;
+	crc_stripes_combine_nowait(sess);
+	if (!sess->stripes_count && crc_soft_pick(sess, count, &poly, &sum) &&
+			!crc_soft_prepare(sess, poly))
+		return crc_soft_write_iov(sess, iov, nr_segs, poly, sum);
+	if (!(aio = kmalloc(sizeof(*aio), GFP_KERNEL)))
+		return -ENOMEM;
+	target = crc_stripes_tail(sess);
+	rv = crc_write_queue(target, &it, count, nonblock);
+	if (rv <= 0)
+		goto out;
+	crc_stripes_account(sess, rv);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	/* Tasks complete in order, this write is done after all queued data */
+	if (target->pending_bytes) {
+		aio->iocb = iocb;
+		aio->res = rv;
+		aio->target = target->done_bytes + target->pending_bytes;
+		list_add_tail(&aio->list, &target->aio_list);
+		aio = NULL;
+		rv = -EIOCBQUEUED;
+	}
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+out:
+	kfree(aio);
+	return rv;
+}
+
+/* Vectored write (writev) or asynchronous one (AIO), segments are verified
+ * by VFS */
+static ssize_t crc_fileops_aio_write(struct kiocb *iocb, const struct iovec
+		*iov, unsigned long nr_segs, loff_t pos) {
+	ssize_t rv;
+	struct file *filp = iocb->ki_filp;
+	struct crc_session *sess = filp->private_data;
+	struct crc_device *cdev = sess->crc_dev;
+	int nonblock = filp->f_flags & O_NONBLOCK;
+	/* ENTER (call_devwide) */
+	if ((rv = mon_session_call_devwide_enter(cdev, sess)))
+		return rv;
+	if (is_sync_kiocb(iocb))
+		rv = crc_write_iov(sess, iov, nr_segs, nonblock);
+	else
+		rv = crc_aio_write_iov(sess, iocb, iov, nr_segs, nonblock);
 	mon_session_call_devwide_exit(cdev, sess);
 	/* EXIT (call_devwide) */
-	/* Report error (or signal) only if haven't written anything */
-	if (written == 0) return rv;
-	else return written;
-fail_call_devwide_enter:
-	/* We've done nothing so far */
 	return rv;
 }
 
+/* CRITICAL (call_devwide) */
+static long crc_ioctl_buffer_submit(struct crc_session *sess,
+		void __user *argp, int nonblock) {
+	long rv = 0, submitted = 0;
+	struct crcdev_ioctl_buffer_submit submit;
+	struct crc_batch batch;
+	struct crc_ubuf *ubuf;
+	struct crc_session *target;
+	struct crc_task *task;
+	dma_addr_t dma;
+	size_t run;
+	if (copy_from_user(&submit, argp, sizeof(submit)))
+		return -EFAULT;
+	if (submit.id >= CRCDEV_UBUFS_COUNT || !(ubuf = sess->ubufs[submit.id]))
+		return -EINVAL;
+	if (submit.offset > ubuf->len || submit.len > ubuf->len - submit.offset)
+		return -EINVAL;
+	/* Data goes after stripes, if any */
+	crc_stripes_combine_nowait(sess);
+	target = crc_stripes_tail(sess);
+	crc_batch_init(&batch);
+	while (submit.len > 0) {
+		task = crc_batch_take(target, &batch, nonblock);
+		if (IS_ERR(task)) {
+			rv = PTR_ERR(task);
+			break;
+		}
+		/* Command points directly to pinned user pages, scheduler
+		 * needs commands no larger than its quantum */
+		run = crc_ubuf_run(ubuf, submit.offset, min_t(size_t,
+					submit.len, CRCDEV_DRR_QUANTUM), &dma);
+		/* Mapping is long-lived, data written since registration
+		 * has to reach the device (bounce buffers, non-coherent
+		 * caches) */
+		pci_dma_sync_single_for_device(sess->crc_dev->pdev, dma, run,
+				PCI_DMA_TODEVICE);
+		task->cmd_dma = dma;
+		task->data_count = run;
+		submit.offset += run;
+		submit.len -= run;
+		submitted += run;
+		crc_batch_add(target, &batch, task);
+	}
+	crc_batch_queue(target, &batch);
+	crc_stripes_account(sess, submitted);
+	my_debug("buffer_submit: id %u bytes %ld", submit.id, submitted);
+	/* Report error (or signal) only if haven't queued anything */
+	return submitted ? submitted : rv;
+}
+
+/* Number of entries completion queue can take in addition to these in flight,
+ * this can only grow behind our back */
+static u32 crc_ring_cq_space(struct crc_session *sess) {
+	struct crc_ring *ring = sess->ring;
+	u32 used;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(sess->crc_dev);
+	used = ring->cq_tail - ACCESS_ONCE(ring->head->cq_head) +
+		ring->inflight;
+	mon_device_unlock(sess->crc_dev);
+	/* END CRITICAL (cdev->dev_lock) */
+	return used < ring->entries ? ring->entries - used : 0;
+}
+
+/* CRITICAL (call_devwide) */
+static int crc_ring_submit(struct crc_session *sess, u32 to_submit,
+		u32 *submitted, int nonblock) {
+	int rv = 0;
+	struct crc_ring *ring = sess->ring;
+	struct crc_batch batch;
+	struct crc_task *task;
+	struct crcdev_ring_sqe sqe;
+	u32 sq_tail = ACCESS_ONCE(ring->head->sq_tail);
+	/* Every entry gets a completion, we cannot overflow cq */
+	u32 cq_space = crc_ring_cq_space(sess);
+	/* Read entries after tail */
+	smp_rmb();
+	*submitted = 0;
+	crc_batch_init(&batch);
+	while (*submitted < min(to_submit, cq_space) &&
+			ring->sq_head != sq_tail) {
+		/* Userspace can modify this entry concurrently */
+		sqe = ring->sqes[ring->sq_head & (ring->entries - 1)];
+		if (sqe.slot >= ring->entries || sqe.len == 0 ||
+				sqe.len > CRCDEV_BUFFER_SIZE) {
+			rv = -EINVAL;
+			break;
+		}
+		task = crc_batch_take(sess, &batch, nonblock);
+		if (IS_ERR(task)) {
+			rv = PTR_ERR(task);
+			break;
+		}
+		task->cmd_dma = ring->slots_dma[sqe.slot];
+		task->data_count = sqe.len;
+		task->ring_slot = sqe.slot;
+		task->ring_user_data = sqe.user_data;
+		pci_dma_sync_single_for_device(sess->crc_dev->pdev,
+				task->cmd_dma, task->data_count,
+				PCI_DMA_TODEVICE);
+		crc_batch_add(sess, &batch, task);
+		ring->sq_head++;
+		(*submitted)++;
+	}
+	crc_batch_queue(sess, &batch);
+	ACCESS_ONCE(ring->head->sq_head) = ring->sq_head;
+	/* Report error (or signal) only if haven't submitted anything */
+	return *submitted ? 0 : rv;
+}
+
+static int crc_ioctl_ring_enter(struct crc_session *sess, void __user *argp,
+		int nonblock) {
+	int rv;
+	struct crc_device *cdev = sess->crc_dev;
+	struct crc_ring *ring = ACCESS_ONCE(sess->ring);
+	struct crcdev_ioctl_ring_enter enter;
+	if (copy_from_user(&enter, argp, sizeof(enter)))
+		return -EFAULT;
+	if (!ring)
+		return -EINVAL;
+	enter.submitted = 0;
+	if (enter.to_submit > 0) {
+		/* ENTER (call_devwide) */
+		if ((rv = mon_session_call_devwide_enter(cdev, sess)))
+			return rv;
+		rv = crc_ring_submit(sess, enter.to_submit, &enter.submitted,
+				nonblock);
+		mon_session_call_devwide_exit(cdev, sess);
+		/* EXIT (call_devwide) */
+		if (rv)
+			return rv;
+	}
+	if (enter.min_complete > 0) {
+		enter.min_complete = min(enter.min_complete, ring->entries);
+		rv = wait_event_interruptible(ring->cq_wait,
+				ACCESS_ONCE(ring->cq_tail) - ACCESS_ONCE(
+					ring->head->cq_head) >=
+				enter.min_complete || test_bit(
+					CRCDEV_STATUS_REMOVED, &cdev->status));
+		/* Submitted entries must be reported anyway */
+		if (rv && enter.submitted == 0)
+			return -EINTR;
+		if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status)) {
+			crc_error_hot_unplug();
+			return -ENODEV;
+		}
+	}
+	if (copy_to_user(argp, &enter, sizeof(enter)))
+		return -EFAULT;
+	return 0;
+}
+
+/* CRITICAL (call) */
+static int crc_ioctl_ring_setup(struct crc_session *sess, void __user *argp) {
+	struct crcdev_ioctl_ring_setup setup;
+	struct crc_ring *ring;
+	if (copy_from_user(&setup, argp, sizeof(setup)))
+		return -EFAULT;
+	if (sess->ring)
+		return -EBUSY;
+	if (!is_power_of_2(setup.entries) ||
+			setup.entries > CRCDEV_RING_MAX_ENTRIES)
+		return -EINVAL;
+	if (!(ring = crc_ring_alloc(sess->crc_dev, setup.entries)))
+		return -ENOMEM;
+	setup.slot_size = CRCDEV_BUFFER_SIZE;
+	setup.sq_off = CRCDEV_RING_SQ_OFF;
+	setup.cq_off = CRCDEV_RING_CQ_OFF(ring->entries);
+	setup.rings_size = ring->rings_size;
+	setup.data_size = ring->entries * CRCDEV_BUFFER_SIZE;
+	if (copy_to_user(argp, &setup, sizeof(setup))) {
+		crc_ring_free(sess->crc_dev, ring); ring = NULL;
+		return -EFAULT;
+	}
+	/* Publish initialized ring for mmap() and ring_enter */
+	smp_wmb();
+	sess->ring = ring;
+	my_debug("ring_setup: entries %u", ring->entries);
+	return 0;
+}
+
+/* CRITICAL (call) */
+static int crc_ioctl_buffer_register(struct crc_session *sess,
+		void __user *argp) {
+	struct crcdev_ioctl_buffer_register reg;
+	struct crc_ubuf *ubuf;
+	int id;
+	if (copy_from_user(&reg, argp, sizeof(reg)))
+		return -EFAULT;
+	if (reg.addr != (unsigned long) reg.addr ||
+			reg.len != (size_t) reg.len)
+		return -EINVAL;
+	for (id = 0; id < CRCDEV_UBUFS_COUNT && sess->ubufs[id]; id++);
+	if (id == CRCDEV_UBUFS_COUNT)
+		return -ENOSPC;
+	ubuf = crc_ubuf_alloc(sess->crc_dev, reg.addr, reg.len);
+	if (IS_ERR(ubuf))
+		return PTR_ERR(ubuf);
+	reg.id = id;
+	if (copy_to_user(argp, &reg, sizeof(reg))) {
+		crc_ubuf_free(sess->crc_dev, ubuf); ubuf = NULL;
+		return -EFAULT;
+	}
+	sess->ubufs[id] = ubuf;
+	my_debug("buffer_register: id %d pages %d", id, ubuf->nr_pages);
+	return 0;
+}
+
+/* CRITICAL (call) */
+static int crc_ioctl_buffer_unregister(struct crc_session *sess,
+		void __user *argp) {
+	struct crcdev_ioctl_buffer_unregister unreg;
+	if (copy_from_user(&unreg, argp, sizeof(unreg)))
+		return -EFAULT;
+	if (unreg.id >= CRCDEV_UBUFS_COUNT || !sess->ubufs[unreg.id])
+		return -EINVAL;
+	/* All tasks have completed, none of them refers to this buffer */
+	crc_ubuf_free(sess->crc_dev, sess->ubufs[unreg.id]);
+	sess->ubufs[unreg.id] = NULL;
+	return 0;
+}
+
 /* CRITICAL (call) */
 static int crc_ioctl_set_params(struct crc_session *sess, void __user * argp) {
 	struct crcdev_ioctl_set_params params = { 0, 0 };
 	if (copy_from_user(&params, argp, sizeof(params)))
 		return -EFAULT;
+	mon_device_lock(sess->crc_dev);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	/* Device copy is dropped, new state is loaded on next schedule */
+	crc_session_ctx_release(sess);
 	sess->poly = params.poly;
 	sess->sum = params.sum;
+	sess->done_bytes = 0;
+	sess->sum_bytes = 0;
+	/* END CRITICAL (cdev->dev_lock) */
+	mon_device_unlock(sess->crc_dev);
 	my_debug("set_params: poly %x sum %x", params.poly, params.sum);
 	return 0;
 }
 
+/* CRITICAL (call) */
+static int crc_ioctl_set_credits(struct crc_session *sess, void __user *argp) {
+	struct crcdev_ioctl_set_credits cred;
+	if (copy_from_user(&cred, argp, sizeof(cred)))
+		return -EFAULT;
+	if (cred.pad || cred.credits > CRCDEV_BUFFERS_MAX)
+		return -EINVAL;
+	/* Children are charged to this session, the limit covers them too */
+	sess->credits = cred.credits;
+	my_debug("set_credits: %u", cred.credits);
+	return 0;
+}
+
 /* CRITICAL (call) */
 static int crc_ioctl_get_result(struct crc_session *sess, void __user * argp) {
 	struct crcdev_ioctl_get_result result = { 0 };
+	mon_device_lock(sess->crc_dev);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	crc_session_ctx_sync(sess);
 	result.sum = sess->sum;
+	/* END CRITICAL (cdev->dev_lock) */
+	mon_device_unlock(sess->crc_dev);
 	my_debug("get_result: sum %x", result.sum);
 	if (copy_to_user(argp, &result, sizeof(result)))
 		return -EFAULT;
 	return 0;
 }
 
+/* CRITICAL (call) */
+static int crc_ioctl_checkpoint_save(struct crc_session *sess,
+		void __user *argp) {
+	struct crcdev_ioctl_checkpoint ckpt;
+	struct crc_checkpoint *slot;
+	if (copy_from_user(&ckpt, argp, sizeof(ckpt)))
+		return -EFAULT;
+	if (ckpt.pad || ckpt.slot >= CRCDEV_CHECKPOINTS)
+		return -EINVAL;
+	if (!sess->checkpoints)
+		sess->checkpoints = kcalloc(CRCDEV_CHECKPOINTS,
+				sizeof(*sess->checkpoints), GFP_KERNEL);
+	if (!sess->checkpoints)
+		return -ENOMEM;
+	slot = sess->checkpoints + ckpt.slot;
+	mon_device_lock(sess->crc_dev);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	crc_session_ctx_sync(sess);
+	slot->poly = sess->poly;
+	slot->sum = sess->sum;
+	slot->bytes = sess->done_bytes;
+	/* END CRITICAL (cdev->dev_lock) */
+	mon_device_unlock(sess->crc_dev);
+	slot->valid = 1;
+	my_debug("checkpoint_save: %u poly %x sum %x", ckpt.slot, slot->poly,
+			slot->sum);
+	return 0;
+}
+
+/* CRITICAL (call) */
+static int crc_ioctl_checkpoint_restore(struct crc_session *sess,
+		void __user *argp) {
+	struct crcdev_ioctl_checkpoint ckpt;
+	struct crc_checkpoint *slot;
+	if (copy_from_user(&ckpt, argp, sizeof(ckpt)))
+		return -EFAULT;
+	if (ckpt.pad || ckpt.slot >= CRCDEV_CHECKPOINTS ||
+			!sess->checkpoints)
+		return -EINVAL;
+	slot = sess->checkpoints + ckpt.slot;
+	if (!slot->valid)
+		return -EINVAL;
+	mon_device_lock(sess->crc_dev);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	/* Same as SET_PARAMS, new state is loaded on next schedule */
+	crc_session_ctx_release(sess);
+	sess->poly = slot->poly;
+	sess->sum = slot->sum;
+	sess->done_bytes = slot->bytes;
+	sess->sum_bytes = slot->bytes;
+	/* END CRITICAL (cdev->dev_lock) */
+	mon_device_unlock(sess->crc_dev);
+	my_debug("checkpoint_restore: %u poly %x sum %x", ckpt.slot,
+			slot->poly, slot->sum);
+	return 0;
+}
+
+/* CRITICAL (call) */
+static int crc_ioctl_set_eventfd(struct crc_session *sess, void __user *argp) {
+	struct crcdev_ioctl_set_eventfd efd;
+	struct eventfd_ctx *ctx = NULL, *old;
+	if (copy_from_user(&efd, argp, sizeof(efd)))
+		return -EFAULT;
+	if (efd.pad)
+		return -EINVAL;
+	if (efd.fd >= 0 && IS_ERR(ctx = eventfd_ctx_fdget(efd.fd)))
+		return PTR_ERR(ctx);
+	mon_device_lock(sess->crc_dev);
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	old = sess->eventfd;
+	sess->eventfd = ctx;
+	/* END CRITICAL (cdev->dev_lock) */
+	mon_device_unlock(sess->crc_dev);
+	if (old)
+		eventfd_ctx_put(old);
+	my_debug("set_eventfd: %d", efd.fd);
+	return 0;
+}
+
+/* Decides whether COMPUTE of len bytes is done on CPU, by the same rules as
+ * writes, unlocked read of a child is only a hint */
+static int crc_compute_pick_soft(struct crc_session *sess, size_t len) {
+	struct crc_device *cdev = sess->crc_dev;
+	int pick;
+	if (len <= ACCESS_ONCE(cdev->tun.cpu_max))
+		return 1;
+	if (len > ACCESS_ONCE(cdev->tun.cpu_busy_max))
+		return 0;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	pick = !crc_session_ctx_available(ACCESS_ONCE(sess->compute[0]) ?:
+			sess);
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	return pick;
+}
+
+/* CRITICAL (call) unless poly is the standard one, table must be prepared */
+static int crc_compute_soft_run(struct crc_session *sess,
+		struct crcdev_ioctl_compute *comp) {
+	const char __user *buff = (const char __user *) (unsigned long)
+		comp->addr;
+	size_t left = comp->len, to_copy;
+	u8 chunk[CRCDEV_SOFT_CHUNK];
+	while (left > 0) {
+		/* This may sleep */
+		to_copy = min_t(size_t, left, sizeof(chunk));
+		if (copy_from_user(chunk, buff, to_copy))
+			return -EFAULT;
+		comp->sum = crc_soft_update(sess->soft_table, comp->poly,
+				comp->sum, chunk, to_copy);
+		buff += to_copy;
+		left -= to_copy;
+	}
+	atomic64_add(comp->len, &sess->crc_dev->stats.cpu_bytes);
+	return 0;
+}
+
+/* Standard poly needs neither a table nor session_call, so that short
+ * requests run without any lock */
+static long crc_compute_soft(struct crc_session *sess,
+		struct crcdev_ioctl_compute *comp) {
+	long rv;
+	if (CRCPOLY_LE == comp->poly)
+		return crc_compute_soft_run(sess, comp);
+	/* ENTER (call) */
+	if ((rv = mon_session_call_enter(sess)))
+		return rv;
+	if (!(rv = crc_soft_prepare(sess, comp->poly)))
+		rv = crc_compute_soft_run(sess, comp);
+	mon_session_call_exit(sess);
+	/* EXIT (call) */
+	return rv;
+}
+
+/* CRITICAL (call), children are allocated on first use and charged to the
+ * session, so that a whole batch holds no more tasks than it is allowed to */
+static struct crc_session *crc_compute_child(struct crc_session *sess,
+		int idx) {
+	if (!sess->compute[idx] && !(sess->compute[idx] =
+				crc_session_alloc(sess->crc_dev)))
+		return NULL;
+	sess->compute[idx]->credit_owner = sess;
+	return sess->compute[idx];
+}
+
+/* CRITICAL (call), queues whole request to the child, which has been waited
+ * for; session's own tasks are neither waited for nor affected */
+static long crc_compute_queue(struct crc_session *child,
+		struct crcdev_ioctl_compute *comp) {
+	struct crc_device *cdev = child->crc_dev;
+	struct iovec iov = { (void __user *) (unsigned long) comp->addr,
+		comp->len };
+	struct crc_iov_iter it = { &iov, 1, 0 };
+	size_t queued = 0;
+	ssize_t count;
+	long rv;
+	int idx;
+	/* Previous request might have been interrupted */
+	if ((rv = mon_session_tasks_wait_interruptible(child)))
+		return rv;
+	/* ENTER (devwide) */
+	if ((rv = mon_session_devwide_enter(cdev, &idx)))
+		return rv;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	crc_session_ctx_release(child);
+	child->poly = comp->poly;
+	child->sum = comp->sum;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	while (queued < comp->len) {
+		count = crc_write_queue(child, &it, comp->len - queued, 0);
+		if (count <= 0) {
+			rv = count ? count : -EFAULT;
+			break;
+		}
+		queued += count;
+	}
+	mon_session_devwide_exit(cdev, idx);
+	/* EXIT (devwide) */
+	/* Whatever has been queued is waited for by the next request */
+	return rv;
+}
+
+/* CRITICAL (call), waits for the child and reads its sum */
+static long crc_compute_collect(struct crc_session *child, u32 *sum) {
+	struct crc_device *cdev = child->crc_dev;
+	long rv;
+	if ((rv = mon_session_tasks_wait_interruptible(child)))
+		return rv;
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	crc_session_ctx_sync(child);
+	*sum = child->sum;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	return 0;
+}
+
+static long crc_compute_device(struct crc_session *sess,
+		struct crcdev_ioctl_compute *comp) {
+	struct crc_session *child;
+	long rv;
+	/* ENTER (call) */
+	if ((rv = mon_session_call_enter(sess)))
+		return rv;
+	if (!(child = crc_compute_child(sess, 0)))
+		rv = -ENOMEM;
+	else if (!(rv = crc_compute_queue(child, comp)))
+		rv = crc_compute_collect(child, &comp->sum);
+	mon_session_call_exit(sess);
+	/* EXIT (call) */
+	return rv;
+}
+
+static int crc_compute_check(struct crcdev_ioctl_compute *comp) {
+	if (comp->addr != (unsigned long) comp->addr ||
+			comp->len != (size_t) comp->len)
+		return -EINVAL;
+	return 0;
+}
+
+static long crc_ioctl_compute(struct crc_session *sess, void __user *argp) {
+	struct crcdev_ioctl_compute comp;
+	long rv;
+	if (copy_from_user(&comp, argp, sizeof(comp)))
+		return -EFAULT;
+	if ((rv = crc_compute_check(&comp)))
+		return rv;
+	if (test_bit(CRCDEV_STATUS_REMOVED, &sess->crc_dev->status)) {
+		crc_error_hot_unplug();
+		return -ENODEV;
+	}
+	if (crc_compute_pick_soft(sess, comp.len))
+		rv = crc_compute_soft(sess, &comp);
+	else
+		rv = crc_compute_device(sess, &comp);
+	if (rv)
+		return rv;
+	my_debug("compute: poly %x bytes %llu sum %x", comp.poly, comp.len,
+			comp.sum);
+	if (copy_to_user(argp, &comp, sizeof(comp)))
+		return -EFAULT;
+	return 0;
+}
+
+/* CRITICAL (call), collects request idx from the child and stores its sum */
+static long crc_compute_batch_finish(struct crc_session *child,
+		struct crcdev_ioctl_compute __user *udescs, u32 idx) {
+	long rv;
+	u32 sum;
+	if ((rv = crc_compute_collect(child, &sum)))
+		return rv;
+	if (put_user(sum, &udescs[idx].sum))
+		return -EFAULT;
+	return 0;
+}
+
+/* Requests too long for CPU go to children in turns, one per hardware
+ * context, so that up to CRCDEV_CTX_COUNT of them are processed in parallel;
+ * sums of a prefix of done requests are stored back, a signal stops the
+ * batch between requests */
+static long crc_ioctl_compute_batch(struct crc_session *sess,
+		void __user *argp) {
+	struct crcdev_ioctl_compute_batch batch;
+	struct crcdev_ioctl_compute __user *udescs;
+	struct crcdev_ioctl_compute desc;
+	struct crc_session *child;
+	/* Request held by each child or -1 */
+	s64 pending[CRCDEV_CTX_COUNT];
+	u32 idx, done;
+	int slot, next = 0;
+	long rv, err = 0;
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	if (batch.descs != (unsigned long) batch.descs)
+		return -EINVAL;
+	udescs = (struct crcdev_ioctl_compute __user *) (unsigned long)
+		batch.descs;
+	for (slot = 0; slot < CRCDEV_CTX_COUNT; slot++)
+		pending[slot] = -1;
+	/* ENTER (call) */
+	if ((rv = mon_session_call_enter(sess)))
+		return rv;
+	for (idx = 0; idx < batch.count; idx++) {
+		/* Batch can be long and CPU requests never sleep */
+		if (signal_pending(current)) {
+			err = -ERESTARTSYS;
+			break;
+		}
+		cond_resched();
+		if (copy_from_user(&desc, &udescs[idx], sizeof(desc))) {
+			err = -EFAULT;
+			break;
+		}
+		if ((err = crc_compute_check(&desc)))
+			break;
+		if (crc_compute_pick_soft(sess, desc.len)) {
+			err = crc_soft_prepare(sess, desc.poly);
+			if (err || (err = crc_compute_soft_run(sess, &desc)))
+				break;
+			if (put_user(desc.sum, &udescs[idx].sum)) {
+				err = -EFAULT;
+				break;
+			}
+			continue;
+		}
+		slot = next;
+		next = (next + 1) % CRCDEV_CTX_COUNT;
+		if (!(child = crc_compute_child(sess, slot))) {
+			err = -ENOMEM;
+			break;
+		}
+		if (pending[slot] >= 0 && (err = crc_compute_batch_finish(
+						child, udescs, pending[slot])))
+			break;
+		pending[slot] = -1;
+		if ((err = crc_compute_queue(child, &desc)))
+			break;
+		pending[slot] = idx;
+	}
+	done = idx;
+	/* Requests in flight are collected even after a failure */
+	for (slot = 0; slot < CRCDEV_CTX_COUNT; slot++) {
+		if (pending[slot] < 0)
+			continue;
+		if ((rv = crc_compute_batch_finish(sess->compute[slot], udescs,
+						pending[slot]))) {
+			done = min_t(u32, done, pending[slot]);
+			err = err ?: rv;
+		}
+	}
+	mon_session_call_exit(sess);
+	/* EXIT (call) */
+	my_debug("compute_batch: %u of %u", done, batch.count);
+	batch.done = done;
+	if (copy_to_user(argp, &batch, sizeof(batch)))
+		return -EFAULT;
+	/* Report error (or signal) only if nothing has been done */
+	return done || !err ? 0 : err;
+}
+
+/* Neither waits nor takes call_lock, stripes are read as in
+ * crc_stripes_done() */
+static int crc_ioctl_query(struct crc_session *sess, void __user *argp) {
+	struct crcdev_ioctl_query query = { 0 };
+	struct crc_device *cdev = sess->crc_dev;
+	int idx, count = ACCESS_ONCE(sess->stripes_count);
+	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status)) {
+		crc_error_hot_unplug();
+		return -ENODEV;
+	}
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	mon_device_lock(cdev);
+	crc_session_progress(sess);
+	query.pending = sess->pending_bytes;
+	for (idx = 0; idx < count; idx++)
+		query.pending += sess->stripes[idx]->pending_bytes;
+	query.sum = sess->sum;
+	query.sum_bytes = sess->sum_bytes;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	/* Stripes are combined by the next write or ioctl */
+	if (!query.pending && !count)
+		query.flags |= CRCDEV_QUERY_F_DONE;
+	if (copy_to_user(argp, &query, sizeof(query)))
+		return -EFAULT;
+	return 0;
+}
+
+/* These commands only queue tasks, they do not wait for completion */
+static long crc_fileops_ioctl_devwide(struct crc_session *sess, unsigned int
+		cmd, void __user *argp, int nonblock) {
+	long rv;
+	struct crc_device *cdev = sess->crc_dev;
+	/* ENTER (call_devwide) */
+	if ((rv = mon_session_call_devwide_enter(cdev, sess)))
+		goto fail_call_devwide_enter;
+	switch (cmd) {
+	case CRCDEV_IOCTL_BUFFER_SUBMIT:
+		rv = crc_ioctl_buffer_submit(sess, argp, nonblock);
+		break;
+	default:
+		BUG();
+	}
+	mon_session_call_devwide_exit(cdev, sess);
+	/* EXIT (call_devwide) */
+fail_call_devwide_enter:
+	return rv;
+}
+
 static long crc_fileops_ioctl(struct file *filp, unsigned int cmd, unsigned long
 		arg) {
 	int rv;
 	void __user *argp = (__force void __user *) arg;
 	struct crc_session *sess = filp->private_data;
+	int nonblock = filp->f_flags & O_NONBLOCK;
+	switch (cmd) {
+	case CRCDEV_IOCTL_BUFFER_SUBMIT:
+		return crc_fileops_ioctl_devwide(sess, cmd, argp, nonblock);
+	case CRCDEV_IOCTL_RING_ENTER:
+		return crc_ioctl_ring_enter(sess, argp, nonblock);
+	case CRCDEV_IOCTL_COMPUTE:
+		return crc_ioctl_compute(sess, argp);
+	case CRCDEV_IOCTL_COMPUTE_BATCH:
+		return crc_ioctl_compute_batch(sess, argp);
+	case CRCDEV_IOCTL_QUERY:
+		return crc_ioctl_query(sess, argp);
+	}
 	/* ENTER (call) */
 	if ((rv = mon_session_call_enter(sess)))
 		goto fail_call_enter;
 	/* Wait for all tasks to complete, there is no concurrent write (no one
-	 * can reinitialize this completion) */
-	if ((rv = mon_session_tasks_wait_interruptible(sess)))
+	 * can reinitialize these completions), stripes are combined then */
+	if ((rv = crc_stripes_wait(sess, nonblock)))
 		goto fail_ioctl_comp;
 	/* There are no waiting tasks nor concurrent write */
 	switch (cmd) {
@@ -160,6 +1354,27 @@ static long crc_fileops_ioctl(struct file *filp, unsigned int cmd, unsigned long
 	case CRCDEV_IOCTL_GET_RESULT:
 		rv = crc_ioctl_get_result(sess, argp);
 		break;
+	case CRCDEV_IOCTL_BUFFER_REGISTER:
+		rv = crc_ioctl_buffer_register(sess, argp);
+		break;
+	case CRCDEV_IOCTL_BUFFER_UNREGISTER:
+		rv = crc_ioctl_buffer_unregister(sess, argp);
+		break;
+	case CRCDEV_IOCTL_RING_SETUP:
+		rv = crc_ioctl_ring_setup(sess, argp);
+		break;
+	case CRCDEV_IOCTL_SET_CREDITS:
+		rv = crc_ioctl_set_credits(sess, argp);
+		break;
+	case CRCDEV_IOCTL_SET_EVENTFD:
+		rv = crc_ioctl_set_eventfd(sess, argp);
+		break;
+	case CRCDEV_IOCTL_CHECKPOINT_SAVE:
+		rv = crc_ioctl_checkpoint_save(sess, argp);
+		break;
+	case CRCDEV_IOCTL_CHECKPOINT_RESTORE:
+		rv = crc_ioctl_checkpoint_restore(sess, argp);
+		break;
 	default:
 		printk(KERN_WARNING "crcdev: unrecognized ioctl %u", cmd);
 		rv = -ENOTTY;
@@ -174,11 +1389,87 @@ fail_call_enter:
 	return rv;
 }
 
+/* Lockless hint, stripes are never freed before the session */
+static int crc_stripes_done(struct crc_session *sess) {
+	int idx, count = ACCESS_ONCE(sess->stripes_count);
+	for (idx = 0; idx < count; idx++)
+		if (!completion_done(&sess->stripes[idx]->ioctl_comp))
+			return 0;
+	return 1;
+}
+
+static unsigned int crc_fileops_poll(struct file *filp, poll_table *wait) {
+	struct crc_session *sess = filp->private_data;
+	struct crc_device *cdev = sess->crc_dev;
+	unsigned int mask = 0, credits;
+	int idx;
+	poll_wait(filp, &cdev->free_tasks_poll, wait);
+	poll_wait(filp, &sess->credit_wait, wait);
+	/* Completion wakes up its waiters atomically */
+	poll_wait(filp, &sess->ioctl_comp.wait, wait);
+	for (idx = 0; idx < CRCDEV_STRIPES_COUNT; idx++)
+		if (sess->stripes[idx])
+			poll_wait(filp, &sess->stripes[idx]->ioctl_comp.wait,
+					wait);
+	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status))
+		return POLLERR | POLLHUP;
+	/* This is only a hint, write can still return -EAGAIN */
+	/* BEGIN CRITICAL (cdev->dev_lock) */
+	credits = mon_session_credits(sess);
+	mon_device_lock(cdev);
+	if (!list_empty(&cdev->free_tasks) && (!credits ||
+			atomic_read(&sess->credits_used) < credits))
+		mask |= POLLOUT | POLLWRNORM;
+	mon_device_unlock(cdev);
+	/* END CRITICAL (cdev->dev_lock) */
+	/* GET_RESULT will not block */
+	if (completion_done(&sess->ioctl_comp) && crc_stripes_done(sess))
+		mask |= POLLIN | POLLRDNORM;
+	return mask;
+}
+
+static int crc_ring_mmap_data(struct crc_ring *ring, struct vm_area_struct
+		*vma) {
+	int rv;
+	unsigned long addr, idx = 0;
+	const unsigned long slot_pages = CRCDEV_BUFFER_SIZE >> PAGE_SHIFT;
+	if (vma->vm_end - vma->vm_start > ring->entries * CRCDEV_BUFFER_SIZE)
+		return -EINVAL;
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+		if ((rv = vm_insert_page(vma, addr, nth_page(ring->slots[idx /
+							slot_pages], idx %
+						slot_pages))))
+			return rv;
+		idx++;
+	}
+	return 0;
+}
+
+/* Does not take call_lock, it would invert mmap_sem ordering of
+ * buffer_register, ring once published is never changed nor freed */
+static int crc_fileops_mmap(struct file *filp, struct vm_area_struct *vma) {
+	struct crc_session *sess = filp->private_data;
+	struct crc_ring *ring = ACCESS_ONCE(sess->ring);
+	if (!ring)
+		return -EINVAL;
+	smp_rmb();
+	switch ((u64) vma->vm_pgoff << PAGE_SHIFT) {
+	case CRCDEV_RING_OFF_RINGS:
+		return remap_vmalloc_range(vma, ring->rings, 0);
+	case CRCDEV_RING_OFF_DATA:
+		return crc_ring_mmap_data(ring, vma);
+	}
+	return -EINVAL;
+}
+
 struct file_operations crc_fileops_fops = {
 	.owner = THIS_MODULE,
 	.open = crc_fileops_open,
 	.release = crc_fileops_release,
 	.write = crc_fileops_write,
+	.aio_write = crc_fileops_aio_write,
+	.poll = crc_fileops_poll,
+	.mmap = crc_fileops_mmap,
 	.unlocked_ioctl = crc_fileops_ioctl,
 	.compat_ioctl = crc_fileops_ioctl,
 	/* We do not support llseek */
@@ -1,3 +1,5 @@
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
 #include "interrupts.h"
 #include "concepts.h"
 #include "crcdev.h"
@@ -8,64 +10,207 @@ MODULE_LICENSE("GPL");
 /* Hardware abstraction layer */
 #define	cdev_next_cmd_idx(cdev, idx) (((idx) + 1) % (CRCDEV_COMMANDS_LENGTH))
 #define	cdev_is_cmd_full(cdev)	({ \
-		BUILD_BUG_ON(CRCDEV_COMMANDS_LENGTH <= CRCDEV_BUFFERS_COUNT); \
+		BUILD_BUG_ON(CRCDEV_COMMANDS_LENGTH <= CRCDEV_BUFFERS_MAX); \
 		0; })
 #define	cdev_pending_done(cdev)	do { (cdev)->next_pos = \
 	cdev_next_cmd_idx((cdev), (cdev)->next_pos); } while(0)
 
-static __always_inline int cdev_is_pending(struct crc_device *cdev) {
-	size_t read_pos;
+/* Number of commands completed since last pass, device's read position is
+ * read once per pass */
+static __always_inline size_t cdev_pending_count(struct crc_device *cdev) {
+	size_t count;
 	u32 status;
 	/* Do not reorder these under any circumstances */
-	read_pos = ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_READ_POS);
-	status = ioread32(cdev->bar0 + CRCDEV_STATUS);
-	if (read_pos == cdev->next_pos)
-		return false;
-	if (status & CRCDEV_STATUS_FETCH_DATA)
-		return cdev_next_cmd_idx(cdev, cdev->next_pos) != read_pos;
-	return true;
+	cdev->read_pos = cdev_ioread32(cdev, CRCDEV_FETCH_CMD_READ_POS);
+	status = cdev_ioread32(cdev, CRCDEV_STATUS);
+	count = (cdev->read_pos + CRCDEV_COMMANDS_LENGTH - cdev->next_pos) %
+		CRCDEV_COMMANDS_LENGTH;
+	/* Last fetched command might be still processed */
+	if (count > 0 && (status & CRCDEV_STATUS_FETCH_DATA))
+		count--;
+	return count;
 }
 
+/* Command becomes visible to the device after cdev_ring_doorbell() */
 static __always_inline void cdev_put_command(struct crc_task *task) {
 	struct crc_device *cdev = task->session->crc_dev;
-	size_t idx = ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_WRITE_POS);
+	size_t idx = cdev->write_pos;
 	struct crc_command *cmd = cdev->cmd_block + idx;
 	size_t ctx = task->session->ctx;
 	cmd->count_ctx = cpu_to_le32((task->data_count & CRCDEV_CMD_COUNT_MASK)
 			| ((ctx & CRCDEV_CMD_CTX_MASK) <<
 				CRCDEV_CMD_CTX_SHIFT));
-	cmd->addr = cpu_to_le32(task->data_dma);
+	cmd->addr = cpu_to_le32(task->cmd_dma);
 	my_debug("irq: cmd: idx %u ctx %u count %u addr %x",
 			idx,
 			le32_to_cpu(cmd->count_ctx) >> CRCDEV_CMD_CTX_SHIFT,
 			le32_to_cpu(cmd->count_ctx) & CRCDEV_CMD_CTX_MASK,
 			le32_to_cpu(cmd->addr));
-	idx = cdev_next_cmd_idx(cdev, idx);
-	iowrite32(idx, cdev->bar0 + CRCDEV_FETCH_CMD_WRITE_POS);
-	crc_pci_iomb(cdev->bar0);
+	cdev->write_pos = cdev_next_cmd_idx(cdev, idx);
+	atomic64_inc(&cdev->stats.cmds_submitted);
+	atomic64_add(task->data_count, &cdev->stats.bytes_submitted);
 }
 
+/* Accounts time from submission of stamped task to its completion at now
+ * (in ns), runs with preemption disabled */
+static __always_inline void cdev_account_latency(struct crc_device *cdev,
+		struct crc_task *task, u64 now) {
+	u64 us = div_u64(now - task->stamp, NSEC_PER_USEC);
+	int bucket = us ? fls64(us) - 1 : 0;
+	if (bucket >= CRCDEV_LAT_BUCKETS)
+		bucket = CRCDEV_LAT_BUCKETS - 1;
+	this_cpu_inc(cdev->latency->buckets[bucket]);
+	task->stamp = 0;
+}
+
+/* Publishes all commands put since last doorbell, flushed by the caller */
+static __always_inline void cdev_ring_doorbell(struct crc_device *cdev) {
+	/* Commands must be visible before new write position */
+	wmb();
+	cdev_iowrite32(cdev, cdev->write_pos, CRCDEV_FETCH_CMD_WRITE_POS);
+	atomic64_inc(&cdev->stats.doorbells);
+}
+
+/* Only the sum changes while context is in use, poly is never read back,
+ * session has no scheduled tasks so the sum covers all completed data */
 static __always_inline void cdev_get_context(struct crc_session *sess) {
 	BUG_ON(sess->ctx < 0 || CRCDEV_CTX_COUNT <= sess->ctx);
+	sess->sum = cdev_ioread32(sess->crc_dev, CRCDEV_CRC_SUM(sess->ctx));
+	sess->sum_bytes = sess->done_bytes;
 	my_debug("irq: get: ctx %u poly %x sum %x", sess->ctx, sess->poly,
 			sess->sum);
-	sess->poly = ioread32(sess->crc_dev->bar0 + CRCDEV_CRC_POLY(sess->ctx));
-	sess->sum = ioread32(sess->crc_dev->bar0 + CRCDEV_CRC_SUM(sess->ctx));
 }
 
 static __always_inline void cdev_put_context(struct crc_session *sess) {
 	BUG_ON(sess->ctx < 0 || CRCDEV_CTX_COUNT <= sess->ctx);
-	iowrite32(sess->poly, sess->crc_dev->bar0 + CRCDEV_CRC_POLY(sess->ctx));
-	iowrite32(sess->sum, sess->crc_dev->bar0 + CRCDEV_CRC_SUM(sess->ctx));
-	crc_pci_iomb(sess->crc_dev->bar0);
+	cdev_iowrite32(sess->crc_dev, sess->poly, CRCDEV_CRC_POLY(sess->ctx));
+	cdev_iowrite32(sess->crc_dev, sess->sum, CRCDEV_CRC_SUM(sess->ctx));
+	cdev_iomb(sess->crc_dev);
+	atomic64_inc(&sess->crc_dev->stats.ctx_loads);
 	my_debug("irq: put: ctx %u poly %x sum %x", sess->ctx, sess->poly,
 			sess->sum);
 }
 
+/* Drops binding between session and its context, caller decides whether
+ * device copy of the state is needed */
+static __always_inline void cdev_unbind_context(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	BUG_ON(cdev->ctx_owner[sess->ctx] != sess);
+	trace_crcdev_ctx_release(cdev, sess, NULL);
+	cdev->ctx_owner[sess->ctx] = NULL;
+	clear_bit(sess->ctx, cdev->contexts_map);
+	sess->ctx = CRCDEV_SESSION_NOCTX;
+}
+
+/* Eviction order: sessions without waiting tasks first, then by last use */
+static __always_inline int cdev_ctx_before(struct crc_device *cdev, int a,
+		int b) {
+	int wa = !!cdev->ctx_owner[a]->waiting_count;
+	int wb = !!cdev->ctx_owner[b]->waiting_count;
+	if (wa != wb)
+		return wa < wb;
+	/* Clock may wrap */
+	return (long) (cdev->ctx_used[a] - cdev->ctx_used[b]) < 0;
+}
+
+/* Returns free context or evicts least recently used one, sessions with
+ * scheduled tasks are never evicted */
+static int cdev_find_context(struct crc_device *cdev) {
+	int ctx, victim = -1;
+	struct crc_session *owner;
+	ctx = find_first_zero_bit(cdev->contexts_map, CRCDEV_CTX_COUNT);
+	if (0 <= ctx && ctx < CRCDEV_CTX_COUNT)
+		return ctx;
+	for (ctx = 0; ctx < CRCDEV_CTX_COUNT; ctx++) {
+		if (cdev->ctx_owner[ctx]->scheduled_count)
+			continue;
+		if (victim < 0 || cdev_ctx_before(cdev, ctx, victim))
+			victim = ctx;
+	}
+	if (victim < 0)
+		return -1;
+	/* Sync context to its old owner */
+	owner = cdev->ctx_owner[victim];
+	cdev_get_context(owner);
+	cdev_unbind_context(owner);
+	atomic64_inc(&cdev->stats.ctx_evictions);
+	return victim;
+}
+
+/* CRITICAL (cdev->dev_lock) */
+void crc_session_ctx_sync(struct crc_session *sess) {
+	/* Device can be gone, session state is then as good as it gets */
+	if (CRCDEV_SESSION_NOCTX != sess->ctx &&
+			test_bit(CRCDEV_STATUS_READY, &sess->crc_dev->status))
+		cdev_get_context(sess);
+}
+
+/* CRITICAL (cdev->dev_lock), context is stable while session has nothing
+ * scheduled, otherwise the sum stays as of its last drain which interrupt
+ * handler reads back from now on */
+void crc_session_progress(struct crc_session *sess) {
+	sess->track_sum = 1;
+	if (0 == sess->scheduled_count)
+		crc_session_ctx_sync(sess);
+}
+
+/* CRITICAL (cdev->dev_lock) */
+void crc_session_ctx_release(struct crc_session *sess) {
+	if (CRCDEV_SESSION_NOCTX != sess->ctx)
+		cdev_unbind_context(sess);
+}
+
+/* CRITICAL (cdev->dev_lock), tells whether scheduler could give session a
+ * context right now */
+int crc_session_ctx_available(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	int ctx;
+	if (CRCDEV_SESSION_NOCTX != sess->ctx)
+		return 1;
+	for (ctx = 0; ctx < CRCDEV_CTX_COUNT; ctx++)
+		if (!cdev->ctx_owner[ctx] ||
+				!cdev->ctx_owner[ctx]->scheduled_count)
+			return 1;
+	return 0;
+}
+
+/* CRITICAL (cdev->dev_lock), session has no tasks, its sum has been changed
+ * behind device's back */
+void crc_session_ctx_writeback(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	if (CRCDEV_SESSION_NOCTX == sess->ctx)
+		return;
+	if (test_bit(CRCDEV_STATUS_READY, &cdev->status)) {
+		cdev_iowrite32(cdev, sess->sum, CRCDEV_CRC_SUM(sess->ctx));
+		cdev_iomb(cdev);
+	} else {
+		cdev_unbind_context(sess);
+	}
+}
+
+/* CRITICAL (cdev->dev_lock), session can have waiting tasks only if device
+ * has been removed, these are returned to free list */
+void crc_session_unqueue(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	struct crc_task *task;
+	if (list_empty(&sess->ready_list))
+		return;
+	list_for_each_entry(task, &sess->ready_tasks, list) {
+		sess->pending_bytes -= task->data_count;
+		task->session = NULL;
+	}
+	list_splice_init(&sess->ready_tasks, &cdev->free_tasks);
+	list_del_init(&sess->ready_list);
+	cdev->ready_count--;
+	sess->waiting_count = 0;
+	sess->deficit = 0;
+}
+
 /* Device status (direct) */
 static __always_inline void cdev_report_status(struct crc_device *cdev) {
 	my_debug("dev %u: enable %u status %u intr %u intr_e %u\n"
-			"               next %u read %u write %u length %u",
+			"               next %u read %u write %u length %u\n"
+			"               cached read %u write %u",
 			cdev->minor,
 			ioread32(cdev->bar0 + CRCDEV_ENABLE),
 			ioread32(cdev->bar0 + CRCDEV_STATUS),
@@ -74,134 +219,350 @@ static __always_inline void cdev_report_status(struct crc_device *cdev) {
 			cdev->next_pos,
 			ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_READ_POS),
 			ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_WRITE_POS),
-			ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_SIZE));
+			ioread32(cdev->bar0 + CRCDEV_FETCH_CMD_SIZE),
+			cdev->read_pos, cdev->write_pos);
+}
+
+/* Posts completion of a task submitted through session's ring */
+static __always_inline void crc_ring_complete(struct crc_task *task) {
+	struct crc_session *sess = task->session;
+	struct crc_ring *ring = sess->ring;
+	struct crcdev_ring_cqe *cqe = ring->cqes + (ring->cq_tail &
+			(ring->entries - 1));
+	cqe->user_data = task->ring_user_data;
+	cqe->slot = task->ring_slot;
+	cqe->res = task->data_count;
+	/* Sum is known iff session has no tasks, it has to be read back since
+	 * session keeps its context */
+	if (0 == sess->scheduled_count && 0 == sess->waiting_count) {
+		cdev_get_context(sess);
+		cqe->flags = CRCDEV_CQE_F_SUM;
+		cqe->sum = sess->sum;
+	} else {
+		cqe->flags = 0;
+		cqe->sum = 0;
+	}
+	ring->inflight--;
+	ring->cq_tail++;
 }
 
-/* CRITICAL (interrupt) */
-static void crc_irq_handler_fetch_data(struct crc_device *cdev) {
+/* Publishes completions posted in this pass, once per session */
+static __always_inline void crc_ring_publish(struct crc_session *sess) {
+	struct crc_ring *ring = sess->ring;
+	/* Entries must be visible before new tail */
+	smp_wmb();
+	ACCESS_ONCE(ring->head->cq_tail) = ring->cq_tail;
+	wake_up_interruptible(&ring->cq_wait);
+}
+
+/* CRITICAL (interrupt), interrupt is not acked in polling mode, returns number
+ * of completed tasks */
+static size_t crc_irq_handler_fetch_data(struct crc_device *cdev, int ack) {
 	struct crc_task *task;
-	struct crc_session *sess;
+	struct crc_session *sess, *tmp;
+	size_t freed = 0, pending;
+	u64 now = 0;
+	LIST_HEAD(wake);
 	/* This interrupt must be ACKed before we start processing
 	 * pending tasks, do not reorder these */
-	crc_irq_fetch_data_ack(cdev);
-	while (cdev_is_pending(cdev)) {
+	if (ack)
+		crc_irq_fetch_data_ack(cdev);
+	/* Commands completed after this point will raise FETCH_DATA again */
+	pending = cdev_pending_count(cdev);
+	while (pending--) {
 		task = list_first_entry(&cdev->scheduled_tasks, struct crc_task,
 				list);
 		sess = task->session;
+		/* Session keeps its context until it is evicted */
 		sess->scheduled_count--;
-		if (0 == sess->scheduled_count) {
-			/* Sync context to session */
-			cdev_get_context(sess);
-			/* Free context */
-			clear_bit(sess->ctx, cdev->contexts_map);
-			sess->ctx = CRCDEV_SESSION_NOCTX;
-			if (0 == sess->waiting_count) {
-				complete_all(&sess->ioctl_comp);
-			}
-		}
+		sess->pending_bytes -= task->data_count;
+		sess->done_bytes += task->data_count;
+		if (task->ring_slot != CRCDEV_TASK_NORING)
+			crc_ring_complete(task);
+		if (list_empty(&sess->wake_list))
+			list_add_tail(&sess->wake_list, &wake);
 		list_del(&task->list);
+		atomic64_add(task->data_count, &cdev->stats.bytes_done);
+		trace_crcdev_task_complete(cdev, sess, task);
+		if (task->stamp) {
+			if (!now)
+				now = ktime_to_ns(ktime_get());
+			cdev_account_latency(cdev, task, now);
+		}
 		task->session = NULL;
 		task->data_count = 0;
 		list_add(&task->list, &cdev->free_tasks);
-		mon_session_free_task(sess);
+		mon_session_return_credits(sess, 1);
 		cdev_pending_done(cdev);
+		freed++;
+	}
+	/* Each session is woken up once per pass, we cannot touch a session
+	 * after its tasks are done, release() might free it */
+	list_for_each_entry_safe(sess, tmp, &wake, wake_list) {
+		list_del_init(&sess->wake_list);
+		if (sess->ring)
+			crc_ring_publish(sess);
+		/* Someone queries progress, context is stable for a moment */
+		if (sess->track_sum && 0 == sess->scheduled_count &&
+				CRCDEV_SESSION_NOCTX != sess->ctx)
+			cdev_get_context(sess);
+		if (!list_empty(&sess->aio_list))
+			mon_session_aio_done(sess, 0);
+		if (0 == sess->scheduled_count && 0 == sess->waiting_count)
+			mon_session_tasks_done(sess);
 	}
-	/* Enable nonfull */
-	crc_irq_enable(cdev);
+	if (freed) {
+		atomic64_add(freed, &cdev->stats.cmds_done);
+		mon_device_free_tasks(cdev, freed);
+	}
+	return freed;
 }
 
-/* CRITICAL (interrupt) */
-static void crc_irq_handler_cmd_nonfull(struct crc_device *cdev) {
+/* CRITICAL (interrupt), completion rate is updated once per window */
+static void crc_irq_poll_account(struct crc_device *cdev, size_t freed) {
+	unsigned long now = jiffies, elapsed = now - cdev->poll.stamp;
+	cdev->poll.count += freed;
+	if (elapsed < CRCDEV_POLL_WINDOW)
+		return;
+	cdev->poll.rate = cdev->poll.count * HZ / elapsed;
+	cdev->poll.stamp = now;
+	cdev->poll.count = 0;
+}
+
+/* CRITICAL (interrupt), throughput is updated once per period, a sample
+ * spanning an idle gap would average over the gap and is dropped */
+static void crc_irq_load_account(struct crc_device *cdev) {
+	unsigned long now = jiffies, elapsed = now - cdev->load.stamp;
+	u64 bytes;
+	if (elapsed < CRCDEV_LOAD_PERIOD)
+		return;
+	bytes = atomic64_read(&cdev->stats.bytes_done);
+	if (elapsed < 2 * CRCDEV_LOAD_PERIOD)
+		cdev->load.rate = (unsigned long) ((bytes - cdev->load.bytes)
+				>> 20) * HZ / elapsed;
+	else
+		cdev->load.rate = 0;
+	cdev->load.bytes = bytes;
+	cdev->load.stamp = now;
+}
+
+/* CRITICAL (interrupt), schedules session's tasks as long as its credit
+ * allows, returns number of commands put */
+static size_t crc_irq_schedule_session(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
 	struct crc_task *task;
+	size_t queued = 0;
+	sess->deficit += CRCDEV_DRR_QUANTUM;
+	while (!list_empty(&sess->ready_tasks) && !cdev_is_cmd_full(cdev)) {
+		task = list_first_entry(&sess->ready_tasks, struct crc_task,
+				list);
+		if (task->data_count > sess->deficit)
+			break;
+		sess->deficit -= task->data_count;
+		list_move_tail(&task->list, &cdev->scheduled_tasks);
+		sess->waiting_count--;
+		sess->scheduled_count++;
+		cdev_put_command(task);
+		trace_crcdev_task_schedule(cdev, sess, task);
+		queued++;
+	}
+	return queued;
+}
+
+/* CRITICAL (interrupt), deficit round robin over sessions with waiting tasks,
+ * sessions which cannot get a context are skipped */
+static void crc_irq_handler_cmd_nonfull(struct crc_device *cdev) {
 	struct crc_session *sess;
+	size_t queued = 0, skipped = 0;
 	/* Interrupt priorities: FETCH_DATA served */
-	while (!list_empty(&cdev->waiting_tasks)) {
+	while (!list_empty(&cdev->ready_sessions)) {
 		if (cdev_is_cmd_full(cdev))
 			goto cmd_block_full;
-		task = list_first_entry(&cdev->waiting_tasks, struct crc_task,
-				list);
-		sess = task->session;
+		/* Every ready session has been skipped in a row */
+		if (skipped == cdev->ready_count)
+			goto no_free_context;
+		sess = list_first_entry(&cdev->ready_sessions,
+				struct crc_session, ready_list);
 		if (CRCDEV_SESSION_NOCTX == sess->ctx) {
 			/* Find and allocate context */
-			int ctx = find_first_zero_bit(cdev->contexts_map,
-					CRCDEV_CTX_COUNT);
-			if (ctx < 0 || CRCDEV_CTX_COUNT <= ctx)
-				goto no_free_context;
+			int ctx = cdev_find_context(cdev);
+			if (ctx < 0) {
+				list_move_tail(&sess->ready_list,
+						&cdev->ready_sessions);
+				skipped++;
+				continue;
+			}
 			set_bit(ctx, cdev->contexts_map);
+			cdev->ctx_owner[ctx] = sess;
 			/* Sync device with session */
 			sess->ctx = ctx;
 			cdev_put_context(sess);
+			trace_crcdev_ctx_load(cdev, sess, NULL);
 		}
 		BUG_ON(sess->ctx < 0 || CRCDEV_CTX_COUNT <= sess->ctx);
-		/* Session has a context, schedule task */
-		list_del(&task->list);
-		sess->waiting_count--;
-		list_add_tail(&task->list, &cdev->scheduled_tasks);
-		sess->scheduled_count++;
-		cdev_put_command(task);
+		cdev->ctx_used[sess->ctx] = ++cdev->ctx_clock;
+		skipped = 0;
+		/* Session has a context, schedule its tasks */
+		queued += crc_irq_schedule_session(sess);
+		if (list_empty(&sess->ready_tasks)) {
+			/* Idle sessions do not accumulate credit */
+			list_del_init(&sess->ready_list);
+			cdev->ready_count--;
+			sess->deficit = 0;
+		} else {
+			list_move_tail(&sess->ready_list,
+					&cdev->ready_sessions);
+		}
 	}
 	/* We've run out of tasks */
-	crc_irq_disable_nonfull(cdev);
-	return;
+	goto out;
 no_free_context:
 	my_debug("irq: no free context");
-	crc_irq_disable_nonfull(cdev);
-	return;
+	atomic64_inc(&cdev->stats.no_free_context);
+	goto out;
 cmd_block_full:
 	my_debug("irq: cmd block full ");
+	atomic64_inc(&cdev->stats.cmd_full);
+out:
+	/* One doorbell for all commands, flushed together with interrupts
+	 * enable register, which is not touched in polling mode */
+	if (queued) {
+		cdev_ring_doorbell(cdev);
+		if (test_bit(CRCDEV_STATUS_POLLING, &cdev->status))
+			cdev_iomb(cdev);
+	}
 	crc_irq_disable_nonfull(cdev);
-	return;
-}
-
-/* CRITICAL (interrupt) */
-static void crc_irq_handler_cmd_idle(struct crc_device *cdev) {
-	/* Interrupt priorities: FETCH_DATA and CMD_NONFULL served */
-	printk(KERN_WARNING "crcdev: irq: cmd_idle fired");
-	/* Enable only necessary interrupts (not this one) */
-	crc_irq_enable(cdev);
 }
 
+/* Hard interrupt context, we only check whether it was our device and mask
+ * its interrupts, the rest is done in crc_irq_thread() */
 irqreturn_t crc_irq_dispatcher(int irq, void *dev_id) {
-	irqreturn_t rv;
 	u32 intr;
-	unsigned long flags;
 	/* Interrupt handlers share crc_device reference with pci module, but
 	 * this reference can only be destroyed after free_irq() */
 	struct crc_device *cdev = (struct crc_device *) dev_id;
+	if (!test_bit(CRCDEV_STATUS_READY, &cdev->status)) {
+		/* We are not sure this time, if it was our device then it's OK,
+		 * otherwise proper device will raise this again */
+		return IRQ_HANDLED;
+	}
+	/* Check if it was our device */
+	intr = cdev_ioread32(cdev, CRCDEV_INTR);
+	intr &= cdev_ioread32(cdev, CRCDEV_INTR_ENABLE);
+	if (!intr) {
+		/* This is for sure */
+		return IRQ_NONE;
+	}
+	/* Thread handler unmasks interrupts when it's done, if someone
+	 * unmasks them earlier we will simply end up here again */
+	crc_irq_mask(cdev);
+	return IRQ_WAKE_THREAD;
+}
+
+/* Process context, serves all pending events in one pass */
+irqreturn_t crc_irq_thread(int irq, void *dev_id) {
+	u32 intr;
+	unsigned int threshold;
+	struct crc_device *cdev = (struct crc_device *) dev_id;
 	/* ENTER (interrupt) */
-	mon_device_lock(cdev, flags);
+	mon_device_lock(cdev);
 	if (test_bit(CRCDEV_STATUS_READY, &cdev->status)) {
 		cdev_report_status(cdev);
-		/* Check if it was our device and which interrupt fired */
-		intr = ioread32(cdev->bar0 + CRCDEV_INTR);
-		intr &= ioread32(cdev->bar0 + CRCDEV_INTR_ENABLE);
+		intr = cdev_ioread32(cdev, CRCDEV_INTR);
 		/* Priorities here are important */
 		if (intr & CRCDEV_INTR_FETCH_DATA) {
 			my_debug("irq: fetch_data");
-			crc_irq_handler_fetch_data(cdev);
-			rv = IRQ_HANDLED;
-		} else if (intr & CRCDEV_INTR_FETCH_CMD_NONFULL) {
-			my_debug("irq: cmd_nonfull");
-			crc_irq_handler_cmd_nonfull(cdev);
-			rv = IRQ_HANDLED;
-		} else if (intr & CRCDEV_INTR_FETCH_CMD_IDLE) {
-			my_debug("irq: cmd_idle");
-			crc_irq_handler_cmd_idle(cdev);
-			rv = IRQ_HANDLED;
-		} else {
-			/* This is for sure */
-			rv = IRQ_NONE;
+			atomic64_inc(&cdev->stats.irq_fetch_data);
+			crc_irq_poll_account(cdev,
+					crc_irq_handler_fetch_data(cdev, 1));
+			crc_irq_load_account(cdev);
+			threshold = ACCESS_ONCE(cdev->tun.poll_threshold);
+			/* Interrupts are masked by dispatcher, the poller
+			 * takes over and keeps them masked */
+			if (threshold && cdev->poll.rate >= threshold) {
+				my_debug("irq: polling");
+				set_bit(CRCDEV_STATUS_POLLING, &cdev->status);
+				atomic64_inc(&cdev->stats.poll_enter);
+				wake_up_process(cdev->poller);
+			}
 		}
-	} else {
-		/* We are not sure this time, if it was our device then it's OK,
-		 * otherwise proper device will raise this again */
-		rv = IRQ_HANDLED;
+		/* Schedule whatever became possible, this also unmasks
+		 * FETCH_DATA (we do not use cmd_idle at all) */
+		my_debug("irq: cmd_nonfull");
+		atomic64_inc(&cdev->stats.irq_cmd_nonfull);
+		crc_irq_handler_cmd_nonfull(cdev);
 	}
 	/* If device is not ready then crc_remove has been called and interrupts
 	 * are already disabled, this interrupt won't be raised again if it came
 	 * from our device */
-	mon_device_unlock(cdev, flags);
+	mon_device_unlock(cdev);
 	/* EXIT (interrupt) */
 	my_debug("irq: exit");
-	return rv;
+	return IRQ_HANDLED;
+}
+
+/* Process context, one pass of polling mode, returns number of completed
+ * tasks or 0 if device went back to interrupts */
+static size_t crc_irq_poll(struct crc_device *cdev) {
+	size_t freed = 0;
+	unsigned int threshold;
+	/* ENTER (interrupt) */
+	mon_device_lock(cdev);
+	if (!test_bit(CRCDEV_STATUS_READY, &cdev->status)) {
+		clear_bit(CRCDEV_STATUS_POLLING, &cdev->status);
+		goto out;
+	}
+	atomic64_inc(&cdev->stats.poll_passes);
+	freed = crc_irq_handler_fetch_data(cdev, 0);
+	crc_irq_poll_account(cdev, freed);
+	crc_irq_load_account(cdev);
+	crc_irq_handler_cmd_nonfull(cdev);
+	threshold = ACCESS_ONCE(cdev->tun.poll_threshold);
+	if (!threshold || cdev->poll.rate < threshold / 2 || (list_empty(
+					&cdev->scheduled_tasks) && list_empty(
+					&cdev->ready_sessions))) {
+		my_debug("irq: interrupts");
+		clear_bit(CRCDEV_STATUS_POLLING, &cdev->status);
+		/* Completions which were not acked raise FETCH_DATA at once */
+		crc_irq_enable(cdev);
+		freed = 0;
+	}
+out:
+	mon_device_unlock(cdev);
+	/* EXIT (interrupt) */
+	return freed;
+}
+
+/* Per-device kthread, sleeps until interrupt handler switches device to
+ * polling mode, then drains completions for at most poll_budget us at a time
+ * and sleeps poll_interval us in between */
+int crc_irq_poller(void *data) {
+	struct crc_device *cdev = (struct crc_device *) data;
+	ktime_t deadline, interval;
+	while (1) {
+		/* State is set before the check, kthread_stop() in between
+		 * makes schedule() return at once */
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!test_bit(CRCDEV_STATUS_POLLING, &cdev->status)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		deadline = ktime_add_us(ktime_get(),
+				ACCESS_ONCE(cdev->tun.poll_budget));
+		while (crc_irq_poll(cdev) && ktime_to_ns(ktime_sub(
+						ktime_get(), deadline)) < 0)
+			cpu_relax();
+		if (!test_bit(CRCDEV_STATUS_POLLING, &cdev->status))
+			continue;
+		interval = ns_to_ktime((u64) ACCESS_ONCE(
+					cdev->tun.poll_interval) *
+				NSEC_PER_USEC);
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&interval, HRTIMER_MODE_REL);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
 }
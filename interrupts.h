@@ -7,22 +7,63 @@
 #include "pci.h"
 
 irqreturn_t crc_irq_dispatcher(int, void *);
+irqreturn_t crc_irq_thread(int, void *);
+int crc_irq_poller(void *);
 
-/* This enables needed interrupts ONLY (we do not use cmd_idle at all) */
-static __always_inline void crc_irq_enable(struct crc_device *cdev) {
-	iowrite32(CRCDEV_INTR_FETCH_DATA | CRCDEV_INTR_FETCH_CMD_NONFULL,
-			(cdev)->bar0 + CRCDEV_INTR_ENABLE);
+/* CRITICAL (cdev->dev_lock), session has no tasks, safe after removal */
+void crc_session_ctx_sync(struct crc_session *);
+void crc_session_ctx_release(struct crc_session *);
+void crc_session_unqueue(struct crc_session *);
+int crc_session_ctx_available(struct crc_session *);
+void crc_session_ctx_writeback(struct crc_session *);
+/* CRITICAL (cdev->dev_lock), session can have tasks */
+void crc_session_progress(struct crc_session *);
+
+/* MMIO accessors for hot paths, every access is accounted in stats */
+static __always_inline u32 cdev_ioread32(struct crc_device *cdev,
+		unsigned int reg) {
+	atomic64_inc(&cdev->stats.mmio);
+	return ioread32(cdev->bar0 + reg);
+}
+
+static __always_inline void cdev_iowrite32(struct crc_device *cdev, u32 val,
+		unsigned int reg) {
+	atomic64_inc(&cdev->stats.mmio);
+	iowrite32(val, cdev->bar0 + reg);
+}
+
+static __always_inline void cdev_iomb(struct crc_device *cdev) {
+	atomic64_inc(&cdev->stats.mmio);
 	crc_pci_iomb(cdev->bar0);
 }
 
+/* This enables needed interrupts ONLY (we do not use cmd_idle at all), the
+ * poller picks up new tasks on its own */
+static __always_inline void crc_irq_enable(struct crc_device *cdev) {
+	if (test_bit(CRCDEV_STATUS_POLLING, &cdev->status))
+		return;
+	cdev_iowrite32(cdev, CRCDEV_INTR_FETCH_DATA |
+			CRCDEV_INTR_FETCH_CMD_NONFULL, CRCDEV_INTR_ENABLE);
+	cdev_iomb(cdev);
+}
+
+/* Masks all interrupts until threaded handler is done */
+static __always_inline void crc_irq_mask(struct crc_device *cdev) {
+	cdev_iowrite32(cdev, 0, CRCDEV_INTR_ENABLE);
+	cdev_iomb(cdev);
+}
+
+/* Interrupts stay masked in polling mode */
 static __always_inline void crc_irq_disable_nonfull(struct crc_device *cdev) {
-	iowrite32(CRCDEV_INTR_FETCH_DATA, cdev->bar0 + CRCDEV_INTR_ENABLE);
-	crc_pci_iomb(cdev->bar0);
+	if (test_bit(CRCDEV_STATUS_POLLING, &cdev->status))
+		return;
+	cdev_iowrite32(cdev, CRCDEV_INTR_FETCH_DATA, CRCDEV_INTR_ENABLE);
+	cdev_iomb(cdev);
 }
 
 static __always_inline void crc_irq_fetch_data_ack(struct crc_device *cdev) {
-	iowrite32(0, (cdev)->bar0 + CRCDEV_FETCH_DATA_INTR_ACK);
-	crc_pci_iomb(cdev->bar0);
+	cdev_iowrite32(cdev, 0, CRCDEV_FETCH_DATA_INTR_ACK);
+	cdev_iomb(cdev);
 }
 
 #endif  // INTERRUPTS_H_
@@ -4,6 +4,9 @@
 #include "sysfs.h"
 #include "pci.h"
 
+#define CREATE_TRACE_POINTS
+#include "crcdev_trace.h"
+
 MODULE_AUTHOR("Mateusz Machalica");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("crcdev driver");
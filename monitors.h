@@ -1,14 +1,18 @@
 #ifndef MONITORS_H_
 #define MONITORS_H_
 
+#include <linux/eventfd.h>
+#include <linux/aio.h>
+#include <linux/slab.h>
 #include "concepts.h"
 #include "pci.h"
+#include "crcdev_trace.h"
 
 /** SYNCHRONIZATION SCHEMA:
  * mon_device_{lock,unlock}
  * - short period locking (spinlock) of crc_device data structure
  * - not necessary for reading status flags
- * - prevents interrupt handler from servicing this device
+ * - prevents threaded interrupt handler from servicing this device
  * mon_device_ready_start
  * - invoked after successful initialization of a device (before first task)
  * mon_device_remove_start
@@ -20,29 +24,55 @@
  * mon_session_call_devwide_{enter,exit}
  * - serialization of syscalls, one is guaranteed that device will not be
  *   removed until he leaves this monitor
+ * - device side is an SRCU read side section (remove_srcu), entering it
+ *   touches only per-CPU counters, removal sets STATUS_REMOVED and waits
+ *   for the sections which could have missed it
  * - one cannot acquire plain session_call
+ * mon_session_devwide_{enter,exit}
+ * - turns session_call into session_call_devwide and back, so that one can
+ *   queue tasks and then wait for them without leaving session_call
  * mon_session_reserve_task
  * - grants a permission to obtain one free task and put it in waiting tasks
  *   queue (at the end), one is guaranteed that there is a task waiting for him
+ * - session must have a credit first, it waits for its own tasks otherwise
+ * mon_session_try_reserve_task
+ * - same as above but fails with -EAGAIN instead of waiting (O_NONBLOCK)
+ * mon_device_reserve_task
+ * - same as mon_session_reserve_task, the task is taken out of the pool
  * mon_session_free_task
  * - signals that there is a newly added free task in free tasks queue
+ * mon_session_return_credits
+ * - signals that session's tasks were completed or returned
+ * mon_device_free_tasks
+ * - same as above for a number of tasks at once, wakes up pollers
+ * mon_session_aio_done
+ * - completes asynchronous writes whose data has been checksummed, or all of
+ *   them with an error
+ * mon_session_tasks_done
+ * - signals that session has no waiting nor scheduled tasks, also to its
+ *   eventfd
  * mon_session_tasks_wait*
  * - waits for completion of all scheduled tasks, cannot be called when one
  *   acquired session_call_devwide
  * SAFE SCENARIOS:
  * session_call > session_tasks_wait (ioctl)
- * session_call_devwide > session_reserve_task > device_lock (write)
- * device_lock (irq handler)
+ * session_call_devwide > session_reserve_task > device_lock (write, submit)
+ * session_call > session_devwide > session_reserve_task, then
+ *   session_call > session_tasks_wait (compute)
+ * device_lock (threaded irq handler)
+ * pool_lock > device_reserve_task > device_lock (pool resize)
  * session_tasks_wait (release)
  **/
 
 #define crc_error_hot_unplug() printk(KERN_WARNING \
 		"crcdev: device removed while there was pending syscall")
 
-#define mon_device_lock(cdev, flags) \
-	spin_lock_irqsave(&(cdev)->dev_lock, flags);
-#define mon_device_unlock(cdev, flags) \
-	spin_unlock_irqrestore(&(cdev)->dev_lock, flags);
+/* Hard interrupt handler never takes dev_lock, everyone else (including
+ * threaded interrupt handler) runs in process context */
+#define mon_device_lock(cdev) \
+	spin_lock(&(cdev)->dev_lock);
+#define mon_device_unlock(cdev) \
+	spin_unlock(&(cdev)->dev_lock);
 
 static __always_inline __must_check
 int __must_check mon_session_call_enter(struct crc_session *sess) {
@@ -70,6 +100,29 @@ void mon_session_call_exit(struct crc_session *sess) {
 	/* END CRITICAL (sess->call_lock) */
 }
 
+/* CRITICAL (call), read side touches only this CPU's counter, idx has to
+ * be passed back on exit */
+static __always_inline __must_check
+int __must_check mon_session_devwide_enter(struct crc_device *cdev, int *idx) {
+	/* BEGIN CRITICAL (cdev->remove_srcu) READ */
+	*idx = srcu_read_lock(&cdev->remove_srcu);
+	/* We might have entered after start_remove() */
+	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status))
+		goto fail_removed;
+	return 0;
+fail_removed:
+	srcu_read_unlock(&cdev->remove_srcu, *idx);
+	/* END CRITICAL (cdev->remove_srcu) READ */
+	crc_error_hot_unplug();
+	return -ENODEV;
+}
+
+static __always_inline
+void mon_session_devwide_exit(struct crc_device *cdev, int idx) {
+	srcu_read_unlock(&cdev->remove_srcu, idx);
+	/* END CRITICAL (cdev->remove_srcu) READ */
+}
+
 static __always_inline __must_check
 int __must_check mon_session_call_devwide_enter(struct crc_device *cdev,
 		struct crc_session *sess) {
@@ -77,21 +130,13 @@ int __must_check mon_session_call_devwide_enter(struct crc_device *cdev,
 	/* ENTER (call) */
 	if ((rv = mon_session_call_enter(sess)))
 		goto fail_call_enter;
-	/* BEGIN CRITICAL (cdev->remove_lock) READ */
-	if (!down_read_trylock(&cdev->remove_lock))
-		goto fail_remove_lock;
-	/* We might have been faster than start_remove() */
-	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status))
-		goto fail_removed_2;
+	/* ENTER (devwide) */
+	if ((rv = mon_session_devwide_enter(cdev, &sess->remove_idx)))
+		goto fail_devwide_enter;
 	return rv;
-fail_removed_2:
-	up_read(&cdev->remove_lock);
-	/* END CRITICAL (cdev->remove_lock) READ */
-fail_remove_lock:
+fail_devwide_enter:
 	mon_session_call_exit(sess);
 	/* EXIT (call) */
-	crc_error_hot_unplug();
-	return -ENODEV;
 fail_call_enter:
 	return rv;
 }
@@ -99,18 +144,22 @@ fail_call_enter:
 static __always_inline
 void mon_session_call_devwide_exit(struct crc_device *cdev,
 		struct crc_session *sess) {
-	up_read(&cdev->remove_lock);
-	/* END CRITICAL (cdev->remove_lock) READ */
+	mon_session_devwide_exit(cdev, sess->remove_idx);
+	/* EXIT (devwide) */
 	mon_session_call_exit(sess);
 	/* EXIT (call) */
 }
 
 static __always_inline __must_check
-int __must_check mon_session_reserve_task(struct crc_session *sess) {
+int __must_check mon_device_reserve_task(struct crc_device *cdev) {
 	int rv = 0;
-	struct crc_device *cdev = sess->crc_dev;
-	if ((rv = down_interruptible(&cdev->free_tasks_wait)))
-		goto fail_free_tasks_wait;
+	if (down_trylock(&cdev->free_tasks_wait)) {
+		trace_crcdev_wait_start(cdev, NULL, CRCDEV_WAIT_TASK);
+		rv = down_interruptible(&cdev->free_tasks_wait);
+		trace_crcdev_wait_end(cdev, NULL, CRCDEV_WAIT_TASK);
+		if (rv)
+			goto fail_free_tasks_wait;
+	}
 	/* We might have been woken up to die */
 	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status))
 		goto fail_removed;
@@ -124,15 +173,138 @@ fail_free_tasks_wait:
 	return rv;
 }
 
+/* Maximal number of tasks held by session, 0 if unlimited */
+static __always_inline
+unsigned int mon_session_credits(struct crc_session *sess) {
+	unsigned int limit = ACCESS_ONCE(sess->credits);
+	if (!limit)
+		limit = ACCESS_ONCE(sess->crc_dev->tun.session_credits);
+	return limit;
+}
+
+/* Takes one credit unless session (with its children) holds as many tasks
+ * as it is allowed to */
+static __always_inline __must_check
+int mon_session_take_credit(struct crc_session *sess) {
+	struct crc_session *owner = sess->credit_owner;
+	unsigned int limit = mon_session_credits(owner);
+	int used;
+	do {
+		used = atomic_read(&owner->credits_used);
+		if (limit && (unsigned int) used >= limit)
+			return 0;
+	} while (atomic_cmpxchg(&owner->credits_used, used, used + 1) != used);
+	return 1;
+}
+
+static __always_inline
+void mon_session_return_credits(struct crc_session *sess, int count) {
+	struct crc_session *owner = sess->credit_owner;
+	atomic_sub(count, &owner->credits_used);
+	/* Pairs with wait_event() in reserve */
+	smp_mb();
+	if (waitqueue_active(&owner->credit_wait))
+		wake_up_interruptible(&owner->credit_wait);
+}
+
+static __always_inline __must_check
+int __must_check mon_session_reserve_task(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	int rv, taken;
+	if (!mon_session_take_credit(sess)) {
+		atomic64_inc(&cdev->stats.credit_limit_hits);
+		trace_crcdev_wait_start(cdev, sess, CRCDEV_WAIT_CREDIT);
+		/* Session or its children have tasks in flight, their
+		 * completion wakes us up */
+		rv = wait_event_interruptible(sess->credit_owner->credit_wait,
+				(taken = mon_session_take_credit(sess)) ||
+				test_bit(CRCDEV_STATUS_REMOVED,
+					&cdev->status));
+		trace_crcdev_wait_end(cdev, sess, CRCDEV_WAIT_CREDIT);
+		if (rv)
+			return rv;
+		if (!taken) {
+			crc_error_hot_unplug();
+			return -ENODEV;
+		}
+	}
+	if ((rv = mon_device_reserve_task(cdev)))
+		mon_session_return_credits(sess, 1);
+	return rv;
+}
+
+static __always_inline __must_check
+int __must_check mon_session_try_reserve_task(struct crc_session *sess) {
+	struct crc_device *cdev = sess->crc_dev;
+	if (!mon_session_take_credit(sess)) {
+		atomic64_inc(&cdev->stats.credit_limit_hits);
+		return -EAGAIN;
+	}
+	if (down_trylock(&cdev->free_tasks_wait)) {
+		mon_session_return_credits(sess, 1);
+		return -EAGAIN;
+	}
+	/* We might have been faster than start_remove() */
+	if (test_bit(CRCDEV_STATUS_REMOVED, &cdev->status))
+		goto fail_removed;
+	return 0;
+fail_removed:
+	/* We let another guy know about this */
+	up(&cdev->free_tasks_wait);
+	mon_session_return_credits(sess, 1);
+	crc_error_hot_unplug();
+	return -ENODEV;
+}
+
 static __always_inline
 void mon_session_free_task(struct crc_session *sess) {
 	up(&sess->crc_dev->free_tasks_wait);
+	mon_session_return_credits(sess, 1);
 }
 
+/* Signals that count tasks were added to free tasks queue */
+static __always_inline
+void mon_device_free_tasks(struct crc_device *cdev, size_t count) {
+	while (count--)
+		up(&cdev->free_tasks_wait);
+	/* Pairs with poll_wait() in poll */
+	smp_mb();
+	if (waitqueue_active(&cdev->free_tasks_poll))
+		wake_up_interruptible(&cdev->free_tasks_poll);
+}
+
+/* CRITICAL (cdev->dev_lock), iocbs hold their files, hence the session */
+static __always_inline
+void mon_session_aio_done(struct crc_session *sess, long err) {
+	struct crc_aio *aio, *tmp;
+	list_for_each_entry_safe(aio, tmp, &sess->aio_list, list) {
+		if (!err && aio->target > sess->done_bytes)
+			break;
+		list_del(&aio->list);
+		aio_complete(aio->iocb, err ?: aio->res, 0);
+		kfree(aio);
+	}
+}
+
+/* Pollers wait on ioctl_comp's wait queue, therefore this wakes them up
+ * atomically, session must not be touched afterwards */
+static __always_inline
+void mon_session_tasks_done(struct crc_session *sess) {
+	if (sess->eventfd)
+		eventfd_signal(sess->eventfd, 1);
+	complete_all(&sess->ioctl_comp);
+}
+
+
 static __always_inline __must_check
 int mon_session_tasks_wait_interruptible(struct crc_session *sess) {
-	int rv;
-	if ((rv = wait_for_completion_interruptible(&sess->ioctl_comp))) {
+	int rv = 0;
+	if (!completion_done(&sess->ioctl_comp)) {
+		trace_crcdev_wait_start(sess->crc_dev, sess, CRCDEV_WAIT_DONE);
+		rv = wait_for_completion_interruptible(&sess->ioctl_comp);
+		trace_crcdev_wait_end(sess->crc_dev, sess, CRCDEV_WAIT_DONE);
+	}
+	if (rv) {
 		if (rv == -ERESTARTSYS)
 			return -EINTR;
 		return rv;
@@ -146,9 +318,21 @@ int mon_session_tasks_wait_interruptible(struct crc_session *sess) {
 	return 0;
 }
 
+/* Nonblocking check for completion of all session's tasks */
+static __always_inline __must_check
+int mon_session_tasks_done_nowait(struct crc_session *sess) {
+	if (!completion_done(&sess->ioctl_comp))
+		return -EAGAIN;
+	return mon_session_tasks_wait_interruptible(sess);
+}
+
 static __always_inline __must_check
 int mon_session_tasks_wait(struct crc_session *sess) {
-	wait_for_completion(&sess->ioctl_comp);
+	if (!completion_done(&sess->ioctl_comp)) {
+		trace_crcdev_wait_start(sess->crc_dev, sess, CRCDEV_WAIT_DONE);
+		wait_for_completion(&sess->ioctl_comp);
+		trace_crcdev_wait_end(sess->crc_dev, sess, CRCDEV_WAIT_DONE);
+	}
 	if (test_bit(CRCDEV_STATUS_REMOVED, &sess->crc_dev->status)) {
 		crc_error_hot_unplug();
 		return -ENODEV;
@@ -158,56 +342,75 @@ int mon_session_tasks_wait(struct crc_session *sess) {
 	return 0;
 }
 
+/* Wakes up everyone waiting for session's tasks, used on removal */
+static __always_inline
+void mon_session_wakeup_all(struct crc_session *sess) {
+	if (sess->ring)
+		wake_up_interruptible_all(&sess->ring->cq_wait);
+	wake_up_interruptible_all(&sess->credit_owner->credit_wait);
+	mon_session_aio_done(sess, -ENODEV);
+	mon_session_tasks_done(sess);
+}
+
 static __always_inline
 void mon_device_ready_start(struct crc_device *cdev) {
-	unsigned long flags;
 	/* BEGIN CRITICAL (cdev->dev_lock) */
-	mon_device_lock(cdev, flags);
+	mon_device_lock(cdev);
 	set_bit(CRCDEV_STATUS_READY, &cdev->status);
-	mon_device_unlock(cdev, flags);
+	mon_device_unlock(cdev);
 	/* END CRITICAL (cdev->dev_lock) */
 }
 
 static __always_inline
 void mon_device_remove_start(struct crc_device *cdev) {
-	unsigned long flags;
 	struct crc_task *task, *tmp;
+	struct crc_session *sess;
+	trace_crcdev_device_remove(cdev, NULL, NULL);
 	/* BEGIN CRITICAL (cdev->dev_lock) */
-	mon_device_lock(cdev, flags);
+	mon_device_lock(cdev);
 	/* Interrupts will start to abort from now */
 	clear_bit(CRCDEV_STATUS_READY, &cdev->status);
 	/* New syscalls and awoken ones will start to fail with -ENODEV */
 	set_bit(CRCDEV_STATUS_REMOVED, &cdev->status);
 	/* This stops DMA activity and disables interrupts */
 	crc_reset_device(cdev->bar0);
-	mon_device_unlock(cdev, flags);
+	/* Writers out of credit are in remove_srcu read side, every one of
+	 * them has tasks queued or scheduled */
+	list_for_each_entry(sess, &cdev->ready_sessions, ready_list)
+		wake_up_interruptible_all(&sess->credit_owner->credit_wait);
+	list_for_each_entry(task, &cdev->scheduled_tasks, list)
+		wake_up_interruptible_all(
+				&task->session->credit_owner->credit_wait);
+	mon_device_unlock(cdev);
 	/* END CRITICAL (cdev->dev_lock) */
 
-	/* Wakeup all waiting remove_lock holders, every process waiting or
+	/* Wakeup all waiting remove_srcu readers, every process waiting or
 	 * just-to-be waiting on free_tasks_wait will spot STATUS_REMOVED flags
 	 * and reup() the semaphore, all waiters will wake up sequentially */
 	up(&cdev->free_tasks_wait);
+	wake_up_interruptible_all(&cdev->free_tasks_poll);
 
-	/* Acquire remove_lock, all readers with remmove_lock are woken up and
-	 * all locks readers might wait on (free_tasks_wait) are up */
-	/* BEGIN CRITICAL (cdev->remove_lock) WRITE */
-	down_write(&cdev->remove_lock);
+	/* Wait for remove_srcu readers, all of them are woken up and all locks
+	 * readers might wait on (free_tasks_wait) are up, readers which enter
+	 * from now see STATUS_REMOVED and leave at once */
+	synchronize_srcu(&cdev->remove_srcu);
 	/* There is no call_devwide from now */
 
 	/* Wakeup all waiting ioctls, to do this we have to complete_all() all
 	 * not completed ioctl_comp in sessions. We can't reach all sessions,
-	 * but only those who have waiting/scheduled tasks.
+	 * but only those who have waiting/scheduled tasks, release() takes
+	 * dev_lock before it frees a session.
 	 * REMARK: ioctl_compl is completed `iff` session has no tasks
 	 * therefore we can scan waiting and scheduled tasks only */
 	/* BEGIN CRITICAL (cdev->dev_lock) */
-	mon_device_lock(cdev, flags);
-	list_for_each_entry_safe(task, tmp, &cdev->waiting_tasks, list) {
-		complete_all(&task->session->ioctl_comp);
+	mon_device_lock(cdev);
+	list_for_each_entry(sess, &cdev->ready_sessions, ready_list) {
+		mon_session_wakeup_all(sess);
 	}
 	list_for_each_entry_safe(task, tmp, &cdev->scheduled_tasks, list) {
-		complete_all(&task->session->ioctl_comp);
+		mon_session_wakeup_all(task->session);
 	}
-	mon_device_unlock(cdev, flags);
+	mon_device_unlock(cdev);
 	/* END CRITICAL (cdev->dev_lock) */
 }
 
@@ -1,4 +1,6 @@
 #include <linux/pci.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
 #include "crcdev.h"
 #include "pci.h"
 #include "concepts.h"
@@ -56,8 +58,9 @@ void crc_reset_device(void __iomem* bar0) {
 static void crc_prepare_fetch_cmd(struct crc_device *cdev) {
 	iowrite32(cdev->cmd_block_dma, cdev->bar0 + CRCDEV_FETCH_CMD_ADDR);
 	/* Just like the initial value of  cdev->next_pos */
-	iowrite32(cdev->next_pos, cdev->bar0 + CRCDEV_FETCH_CMD_READ_POS);
-	iowrite32(cdev->next_pos, cdev->bar0 + CRCDEV_FETCH_CMD_WRITE_POS);
+	cdev->read_pos = cdev->write_pos = cdev->next_pos;
+	iowrite32(cdev->read_pos, cdev->bar0 + CRCDEV_FETCH_CMD_READ_POS);
+	iowrite32(cdev->write_pos, cdev->bar0 + CRCDEV_FETCH_CMD_WRITE_POS);
 	/* This is one more than actual number of cmds that can fit in */
 	iowrite32(CRCDEV_COMMANDS_LENGTH, cdev->bar0 + CRCDEV_FETCH_CMD_SIZE);
 	/* Enable fetch cmd and fetch data (there are no commands) */
@@ -77,7 +80,7 @@ static int crc_probe(struct pci_dev *pdev, const struct pci_device_id *id) {
 		goto fail_enable;
 	if ((rv = pci_request_regions(pdev, CRCDEV_PCI_NAME)))
 		goto fail_request;
-	if (!(cdev = crc_device_alloc())) {
+	if (!(cdev = crc_device_alloc(pdev))) {
 		rv = -ENOMEM;
 		goto fail;
 	}
@@ -103,8 +106,19 @@ static int crc_probe(struct pci_dev *pdev, const struct pci_device_id *id) {
 		rv = -ENODEV;
 		goto fail;
 	}
-	/* Interrupt handlers share crc_device reference with pci module */
-	if ((rv = request_irq(pdev->irq, crc_irq_dispatcher, IRQF_SHARED,
+	/* Poller sleeps until interrupt handler hands device over to it */
+	cdev->poller = kthread_create(crc_irq_poller, cdev, "crcdev%u-poll",
+			cdev->minor);
+	if (IS_ERR(cdev->poller)) {
+		rv = PTR_ERR(cdev->poller);
+		cdev->poller = NULL;
+		goto fail;
+	}
+	wake_up_process(cdev->poller);
+	/* Interrupt handlers share crc_device reference with pci module, we
+	 * mask device's interrupts ourselves, the line stays unmasked */
+	if ((rv = request_threaded_irq(pdev->irq, crc_irq_dispatcher,
+					crc_irq_thread, IRQF_SHARED,
 					CRCDEV_PCI_NAME, cdev)))
 		goto fail;
 	set_bit(CRCDEV_STATUS_IRQ, &cdev->status);
@@ -155,6 +169,10 @@ static void crc_remove(struct pci_dev *pdev) {
 	if (test_bit(CRCDEV_STATUS_IRQ, &cdev->status))
 		free_irq(pdev->irq, cdev);
 	clear_bit(CRCDEV_STATUS_IRQ, &cdev->status);
+	/* Interrupt handler was the only one to wake the poller up */
+	if (cdev->poller)
+		kthread_stop(cdev->poller);
+	cdev->poller = NULL;
 	/* Free DMA memory (this needs irqs), we also need all
 	 * tasks to reside in one of the queues */
 	crc_device_dma_free(pdev, cdev);
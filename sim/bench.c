@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include "../crcdev_ioctl.h"
+#include "sim.h"
+
+/* Checks and benchmarks of the driver running on simulated devices */
+
+#define	POLY_LE		0xedb88320
+#define	POLY_C		0x82f63b78
+#define	DATA_SIZE	(4 << 20)
+#define	MAX_SESSIONS	64
+#define	BATCH		40
+#define	AIOS		24
+#define	SCALE_WRITE	64
+
+static unsigned char data[DATA_SIZE + 4096];
+static int quick;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void gen(unsigned char *buf, size_t len) {
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	size_t idx;
+	for (idx = 0; idx < len; idx++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[idx] = x >> 24;
+	}
+}
+
+/* Bitwise reference, independent of both driver and device model */
+static uint32_t ref_crc(uint32_t poly, uint32_t sum, const unsigned char *buf,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= *buf++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ (sum & 1 ? poly : 0);
+	}
+	return sum;
+}
+
+static struct file *session(unsigned int minor, uint32_t poly, uint32_t sum) {
+	struct crcdev_ioctl_set_params params = { poly, sum };
+	struct file *filp;
+	int rv;
+	if ((rv = sim_open(minor, O_RDWR, &filp))) {
+		fprintf(stderr, "open: %s\n", strerror(-rv));
+		exit(1);
+	}
+	if ((rv = sim_ioctl(filp, CRCDEV_IOCTL_SET_PARAMS, &params))) {
+		fprintf(stderr, "set_params: %s\n", strerror(-rv));
+		exit(1);
+	}
+	return filp;
+}
+
+static uint32_t result(struct file *filp) {
+	struct crcdev_ioctl_get_result res = { 0 };
+	long rv;
+	if ((rv = sim_ioctl(filp, CRCDEV_IOCTL_GET_RESULT, &res))) {
+		fprintf(stderr, "get_result: %s\n", strerror(-rv));
+		exit(1);
+	}
+	return res.sum;
+}
+
+static int write_all(struct file *filp, const unsigned char *buf, size_t len)
+{
+	ssize_t rv;
+	while (len > 0) {
+		if ((rv = sim_write(filp, buf, len)) <= 0) {
+			fprintf(stderr, "write: %s\n", strerror(-rv));
+			return -1;
+		}
+		buf += rv;
+		len -= rv;
+	}
+	return 0;
+}
+
+static int verdict(const char *name, uint32_t got, uint32_t want) {
+	if (got == want)
+		return 0;
+	printf("FAIL %-28s got %08x want %08x\n", name, got, want);
+	return 1;
+}
+
+/* Checksums of every path (CPU, device, striped, vectored, zero copy,
+ * one-shot, progress queries, asynchronous, checkpoints, pooled) against the
+ * reference */
+static int check(void) {
+	static const size_t sizes[] = { 1, 100, 256, 4096, 0x4007, 0x10000,
+		0x100000, DATA_SIZE - 123 };
+	static const uint32_t polys[] = { POLY_LE, POLY_C };
+	struct crcdev_ioctl_buffer_register reg;
+	struct crcdev_ioctl_buffer_unregister unreg;
+	struct crcdev_ioctl_buffer_submit submit;
+	struct crcdev_ioctl_compute comp, descs[BATCH];
+	struct crcdev_ioctl_compute_batch batch;
+	struct crcdev_ioctl_set_eventfd efd;
+	struct crcdev_ioctl_query query;
+	struct crcdev_ioctl_checkpoint ckpt;
+	struct rlimit memlock, lowered;
+	uint64_t events;
+	struct kiocb *iocbs[AIOS];
+	struct iovec iov[3], aio_iov[AIOS];
+	struct file *filp;
+	char name[64];
+	size_t idx, pos;
+	int failures = 0, p;
+	for (p = 0; p < 2; p++) {
+		for (idx = 0; idx < sizeof(sizes) / sizeof(*sizes); idx++) {
+			filp = session(0, polys[p], 0xffffffff);
+			if (write_all(filp, data + 3, sizes[idx]))
+				return 1;
+			snprintf(name, sizeof(name), "write %08x %zu", polys[p],
+					sizes[idx]);
+			failures += verdict(name, result(filp), ref_crc(
+						polys[p], 0xffffffff, data + 3,
+						sizes[idx]));
+			sim_close(filp);
+		}
+	}
+	/* Many small writes accumulate in one session */
+	filp = session(0, POLY_C, 0);
+	for (pos = 0; pos < 0x40000; pos += 1000)
+		if (write_all(filp, data + pos, 1000))
+			return 1;
+	failures += verdict("small writes", result(filp), ref_crc(POLY_C, 0,
+				data, pos));
+	sim_close(filp);
+	/* Vectored */
+	filp = session(0, POLY_LE, 0xffffffff);
+	iov[0].iov_base = data;
+	iov[0].iov_len = 5000;
+	iov[1].iov_base = data + 5000;
+	iov[1].iov_len = 0x20000;
+	iov[2].iov_base = data + 5000 + 0x20000;
+	iov[2].iov_len = 77;
+	if (sim_writev(filp, iov, 3) != 5000 + 0x20000 + 77) {
+		fprintf(stderr, "writev failed\n");
+		return 1;
+	}
+	failures += verdict("writev", result(filp), ref_crc(POLY_LE,
+				0xffffffff, data, 5000 + 0x20000 + 77));
+	sim_close(filp);
+	/* Registered buffer */
+	filp = session(0, POLY_LE, 0xffffffff);
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long) (data + 100);
+	reg.len = 0x80000;
+	if (sim_ioctl(filp, CRCDEV_IOCTL_BUFFER_REGISTER, &reg)) {
+		fprintf(stderr, "buffer_register failed\n");
+		return 1;
+	}
+	submit.id = reg.id;
+	submit.offset = 10;
+	submit.len = 0x7f000;
+	if (sim_ioctl(filp, CRCDEV_IOCTL_BUFFER_SUBMIT, &submit) != 0x7f000) {
+		fprintf(stderr, "buffer_submit failed\n");
+		return 1;
+	}
+	failures += verdict("registered buffer", result(filp), ref_crc(POLY_LE,
+				0xffffffff, data + 110, 0x7f000));
+	/* Pinned pages count against RLIMIT_MEMLOCK until unregistered */
+	getrlimit(RLIMIT_MEMLOCK, &memlock);
+	lowered = memlock;
+	lowered.rlim_cur = 0x100000;
+	setrlimit(RLIMIT_MEMLOCK, &lowered);
+	unreg.id = reg.id;
+	failures += verdict("memlock limit", sim_ioctl(filp,
+				CRCDEV_IOCTL_BUFFER_REGISTER, &reg), -ENOMEM);
+	if (sim_ioctl(filp, CRCDEV_IOCTL_BUFFER_UNREGISTER, &unreg)) {
+		fprintf(stderr, "buffer_unregister failed\n");
+		return 1;
+	}
+	failures += verdict("memlock uncharged", sim_ioctl(filp,
+				CRCDEV_IOCTL_BUFFER_REGISTER, &reg), 0);
+	unreg.id = reg.id;
+	sim_ioctl(filp, CRCDEV_IOCTL_BUFFER_UNREGISTER, &unreg);
+	setrlimit(RLIMIT_MEMLOCK, &memlock);
+	sim_close(filp);
+	/* One-shot computations on CPU and device, session's own stream
+	 * continues unaffected */
+	filp = session(0, POLY_LE, 0xffffffff);
+	if (write_all(filp, data, 0x20000))
+		return 1;
+	for (idx = 0; idx < sizeof(sizes) / sizeof(*sizes) - 1; idx++) {
+		for (p = 0; p < 2; p++) {
+			comp.poly = polys[p];
+			comp.sum = 0x12345678;
+			comp.addr = (unsigned long) (data + 7);
+			comp.len = sizes[idx];
+			if (sim_ioctl(filp, CRCDEV_IOCTL_COMPUTE, &comp)) {
+				fprintf(stderr, "compute failed\n");
+				return 1;
+			}
+			snprintf(name, sizeof(name), "compute %08x %zu",
+					polys[p], sizes[idx]);
+			failures += verdict(name, comp.sum, ref_crc(polys[p],
+						0x12345678, data + 7,
+						sizes[idx]));
+		}
+	}
+	if (write_all(filp, data + 0x20000, 0x20000))
+		return 1;
+	failures += verdict("write around compute", result(filp), ref_crc(
+				POLY_LE, 0xffffffff, data, 0x40000));
+	/* Batch of independent requests of mixed sizes and params */
+	for (idx = 0; idx < BATCH; idx++) {
+		descs[idx].poly = polys[idx % 2];
+		descs[idx].sum = idx * 0x01010101;
+		descs[idx].addr = (unsigned long) (data + idx * 997);
+		descs[idx].len = sizes[idx % 7] + idx;
+	}
+	batch.descs = (unsigned long) descs;
+	batch.count = BATCH;
+	if (sim_ioctl(filp, CRCDEV_IOCTL_COMPUTE_BATCH, &batch) ||
+			batch.done != BATCH) {
+		fprintf(stderr, "compute_batch failed\n");
+		return 1;
+	}
+	for (idx = 0; idx < BATCH; idx++) {
+		snprintf(name, sizeof(name), "batch %zu", idx);
+		failures += verdict(name, descs[idx].sum, ref_crc(
+					polys[idx % 2], idx * 0x01010101,
+					data + idx * 997, sizes[idx % 7] +
+					idx));
+	}
+	sim_close(filp);
+	/* Progress of a long write, waited for on eventfd */
+	filp = session(0, POLY_C, 0xffffffff);
+	efd.fd = eventfd(0, 0);
+	efd.pad = 0;
+	if (efd.fd < 0 || sim_ioctl(filp, CRCDEV_IOCTL_SET_EVENTFD, &efd)) {
+		fprintf(stderr, "set_eventfd failed\n");
+		return 1;
+	}
+	if (write_all(filp, data, 0x200000))
+		return 1;
+	do {
+		if (sim_ioctl(filp, CRCDEV_IOCTL_QUERY, &query)) {
+			fprintf(stderr, "query failed\n");
+			return 1;
+		}
+		if (query.pending + query.sum_bytes > 0x200000 ||
+				query.sum != ref_crc(POLY_C, 0xffffffff, data,
+					query.sum_bytes))
+			failures += verdict("query progress", query.sum, 0);
+	} while (!(query.flags & CRCDEV_QUERY_F_DONE) &&
+			read(efd.fd, &events, sizeof(events)) > 0);
+	failures += verdict("query", query.sum, ref_crc(POLY_C, 0xffffffff,
+				data, 0x200000));
+	failures += verdict("query bytes", query.sum_bytes, 0x200000);
+	sim_close(filp);
+	close(efd.fd);
+	/* Pipelined asynchronous writes of mixed sizes complete in order */
+	filp = session(0, POLY_LE, 0xffffffff);
+	for (idx = 0, pos = 0; idx < AIOS; idx++) {
+		aio_iov[idx].iov_base = data + pos;
+		aio_iov[idx].iov_len = sizes[idx % 7];
+		iocbs[idx] = sim_aio_writev(filp, &aio_iov[idx], 1);
+		pos += sizes[idx % 7];
+	}
+	for (idx = 0; idx < AIOS; idx++) {
+		snprintf(name, sizeof(name), "aio %zu", idx);
+		failures += verdict(name, sim_aio_wait(iocbs[idx]),
+				sizes[idx % 7]);
+	}
+	failures += verdict("aio", result(filp), ref_crc(POLY_LE, 0xffffffff,
+				data, pos));
+	sim_close(filp);
+	/* Suffixes of a common prefix continue from its checkpoint */
+	filp = session(0, POLY_C, 0xffffffff);
+	ckpt.slot = 3;
+	ckpt.pad = 0;
+	if (sim_ioctl(filp, CRCDEV_IOCTL_CHECKPOINT_RESTORE, &ckpt) !=
+			-EINVAL || write_all(filp, data, 0x30000) ||
+			sim_ioctl(filp, CRCDEV_IOCTL_CHECKPOINT_SAVE, &ckpt)) {
+		fprintf(stderr, "checkpoint_save failed\n");
+		return 1;
+	}
+	for (idx = 1; idx < sizeof(sizes) / sizeof(*sizes) - 1; idx++) {
+		if (sim_ioctl(filp, CRCDEV_IOCTL_CHECKPOINT_RESTORE, &ckpt) ||
+				write_all(filp, data + idx * 4099,
+					sizes[idx])) {
+			fprintf(stderr, "checkpoint_restore failed\n");
+			return 1;
+		}
+		snprintf(name, sizeof(name), "checkpoint %zu", sizes[idx]);
+		failures += verdict(name, result(filp), ref_crc(POLY_C,
+					ref_crc(POLY_C, 0xffffffff, data,
+						0x30000), data + idx * 4099,
+					sizes[idx]));
+	}
+	sim_close(filp);
+	/* Pooled device */
+	filp = session(SIM_ANY_MINOR, POLY_LE, 0xffffffff);
+	if (write_all(filp, data, 0x30000))
+		return 1;
+	failures += verdict("pooled", result(filp), ref_crc(POLY_LE,
+				0xffffffff, data, 0x30000));
+	if (!(sim_poll(filp) & 0x0001))
+		failures += verdict("poll readable", 0, 1);
+	sim_close(filp);
+	printf("check: %s\n", failures ? "FAILED" : "ok");
+	return failures;
+}
+
+struct sampler {
+	pthread_t thread;
+	volatile int stop;
+	long long held;
+};
+
+/* Tasks out of the free list of crc0, sampled until stopped */
+static void *sampler_run(void *arg) {
+	struct sampler *sp = arg;
+	long long held;
+	while (!sp->stop) {
+		held = sim_sysfs_value("crc0", "pool_size") -
+			sim_sysfs_value("crc0", "tasks_free");
+		if (held > sp->held)
+			sp->held = held;
+		sched_yield();
+	}
+	return NULL;
+}
+
+/* Striped write is the only one on the device, its stripes are charged to
+ * the session and all of them together never hold more than its credits */
+static int credits(void) {
+	struct sampler sp;
+	struct file *filp;
+	long long limit = sim_sysfs_value("crc0", "session_credits");
+	int failures = 0;
+	memset(&sp, 0, sizeof(sp));
+	filp = session(0, POLY_LE, 0xffffffff);
+	pthread_create(&sp.thread, NULL, sampler_run, &sp);
+	if (write_all(filp, data, DATA_SIZE))
+		failures++;
+	failures += verdict("credits striped", result(filp), ref_crc(POLY_LE,
+				0xffffffff, data, DATA_SIZE));
+	sp.stop = 1;
+	pthread_join(sp.thread, NULL);
+	sim_close(filp);
+	if (sp.held > limit) {
+		printf("FAIL %-28s held %lld tasks, limit %lld\n",
+				"credits striped", sp.held, limit);
+		failures++;
+	}
+	printf("credits: %s (held at most %lld of %lld)\n", failures ?
+			"FAILED" : "ok", sp.held, limit);
+	return failures;
+}
+
+struct worker {
+	pthread_t thread;
+	unsigned int minor;
+	size_t chunk;
+	size_t total;
+	uint32_t sum;
+	int failed;
+};
+
+static void *worker_run(void *arg) {
+	struct worker *w = arg;
+	struct file *filp = session(w->minor, POLY_LE, 0xffffffff);
+	size_t done = 0, len;
+	while (done < w->total) {
+		len = w->chunk;
+		if (len > w->total - done)
+			len = w->total - done;
+		if (write_all(filp, data + done % DATA_SIZE, len)) {
+			w->failed = 1;
+			break;
+		}
+		done += len;
+	}
+	w->sum = result(filp);
+	sim_close(filp);
+	return NULL;
+}
+
+static long long stat_sum(const char *attr, int devices) {
+	char name[16];
+	long long total = 0;
+	int idx;
+	for (idx = 0; idx < devices; idx++) {
+		snprintf(name, sizeof(name), "crc%d", idx);
+		total += sim_sysfs_value(name, attr);
+	}
+	return total;
+}
+
+/* Sessions write total bytes each in chunks, returns number of failures */
+static int throughput(int sessions, size_t chunk, size_t total, int devices) {
+	struct worker workers[MAX_SESSIONS];
+	long long cmds, irqs, polls;
+	uint32_t want;
+	double start, elapsed;
+	int idx, failures = 0;
+	memset(workers, 0, sizeof(workers));
+	/* Every session writes the same prefix of data (modulo wrap) */
+	want = ref_crc(POLY_LE, 0xffffffff, data, total < DATA_SIZE ? total :
+			DATA_SIZE);
+	cmds = stat_sum("cmds_done", devices);
+	irqs = stat_sum("irq_fetch_data", devices);
+	polls = stat_sum("poll_passes", devices);
+	start = now();
+	for (idx = 0; idx < sessions; idx++) {
+		workers[idx].minor = devices > 1 ? SIM_ANY_MINOR : 0;
+		workers[idx].chunk = chunk;
+		workers[idx].total = total;
+		pthread_create(&workers[idx].thread, NULL, worker_run,
+				&workers[idx]);
+	}
+	for (idx = 0; idx < sessions; idx++) {
+		pthread_join(workers[idx].thread, NULL);
+		if (workers[idx].failed || (total <= DATA_SIZE &&
+					workers[idx].sum != want))
+			failures++;
+	}
+	elapsed = now() - start;
+	cmds = stat_sum("cmds_done", devices) - cmds;
+	printf("%8d %8zu %10.1f %10.0f %10lld %10lld %10lld%s\n", sessions,
+			chunk, sessions * total / elapsed / (1 << 20),
+			cmds / elapsed, cmds,
+			stat_sum("irq_fetch_data", devices) - irqs,
+			stat_sum("poll_passes", devices) - polls,
+			failures ? " FAILED" : "");
+	return failures;
+}
+
+struct scaler {
+	pthread_t thread;
+	long writes;
+	int failed;
+};
+
+/* Small writes are checksummed on CPU, the syscall path is all it costs */
+static void *scaler_run(void *arg) {
+	struct scaler *sc = arg;
+	struct file *filp = session(0, POLY_LE, 0xffffffff);
+	long idx;
+	for (idx = 0; idx < sc->writes; idx++)
+		if (sim_write(filp, data, SCALE_WRITE) != SCALE_WRITE) {
+			sc->failed = 1;
+			break;
+		}
+	sim_close(filp);
+	return NULL;
+}
+
+/* Threads, one session each, write to one device at once */
+static int scaling(int threads, long writes) {
+	struct scaler scalers[MAX_SESSIONS];
+	double start, elapsed;
+	int idx, failures = 0;
+	memset(scalers, 0, sizeof(scalers));
+	start = now();
+	for (idx = 0; idx < threads; idx++) {
+		scalers[idx].writes = writes;
+		pthread_create(&scalers[idx].thread, NULL, scaler_run,
+				&scalers[idx]);
+	}
+	for (idx = 0; idx < threads; idx++) {
+		pthread_join(scalers[idx].thread, NULL);
+		failures += scalers[idx].failed;
+	}
+	elapsed = now() - start;
+	printf("%8d %8d %12.0f %12.0f%s\n", threads, SCALE_WRITE,
+			threads * writes / elapsed, writes / elapsed,
+			failures ? " FAILED" : "");
+	return failures;
+}
+
+struct unplug_writer {
+	struct file *filp;
+	ssize_t rv;
+};
+
+static void *unplug_writer_run(void *arg) {
+	struct unplug_writer *uw = arg;
+	while ((uw->rv = sim_write(uw->filp, data, 0x10000)) > 0);
+	return NULL;
+}
+
+/* Surprise removal of the last device while a writer sleeps for credits,
+ * both removal and the writer have to finish */
+static int unplug(int devices) {
+	struct crcdev_ioctl_set_credits cred = { 1, 0 };
+	struct crcdev_ioctl_query query;
+	struct unplug_writer uw;
+	pthread_t thread;
+	int failures = 0;
+	uw.filp = session(devices - 1, POLY_LE, 0xffffffff);
+	if (sim_ioctl(uw.filp, CRCDEV_IOCTL_SET_CREDITS, &cred)) {
+		fprintf(stderr, "set_credits failed\n");
+		return 1;
+	}
+	pthread_create(&thread, NULL, unplug_writer_run, &uw);
+	usleep(20000);
+	if (sim_device_unplug(devices - 1)) {
+		fprintf(stderr, "unplug failed\n");
+		return 1;
+	}
+	pthread_join(thread, NULL);
+	failures += verdict("unplug writer", uw.rv, -ENODEV);
+	failures += verdict("unplug query", sim_ioctl(uw.filp,
+				CRCDEV_IOCTL_QUERY, &query), -ENODEV);
+	sim_close(uw.filp);
+	printf("unplug: %s\n", failures ? "FAILED" : "ok");
+	return failures;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Write of size bytes followed by GET_RESULT, one at a time */
+static int latency(size_t size, int iterations) {
+	double *samples = calloc(iterations, sizeof(*samples));
+	struct file *filp = session(0, POLY_LE, 0xffffffff);
+	double start;
+	int idx;
+	if (!samples)
+		return 1;
+	for (idx = 0; idx < iterations; idx++) {
+		start = now();
+		if (write_all(filp, data, size))
+			return 1;
+		result(filp);
+		samples[idx] = (now() - start) * 1e6;
+	}
+	sim_close(filp);
+	qsort(samples, iterations, sizeof(*samples), cmp_double);
+	printf("%8zu %8d %10.1f %10.1f %10.1f %10.1f\n", size, iterations,
+			samples[iterations / 2], samples[iterations * 99 / 100],
+			samples[iterations * 999 / 1000],
+			samples[iterations - 1]);
+	free(samples);
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-d devices] [-l latency_us] [-t MB/s] "
+			"[-b buffers] [-m MB per session] [-w max threads] "
+			"[-q] [-v]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	struct sim_dev_params params = { 10000, 2000ULL << 20 };
+	struct sim_dev_stats stats;
+	static const int sessions[] = { 1, 4, 16 };
+	static const size_t chunks[] = { 0x1000, 0x10000, 0x100000 };
+	size_t total = 32 << 20;
+	int devices = 1, threads = 0, failures = 0, opt, idx, rv;
+	while ((opt = getopt(argc, argv, "d:l:t:b:m:w:qv")) != -1) {
+		switch (opt) {
+		case 'd':
+			devices = atoi(optarg);
+			break;
+		case 'l':
+			params.latency_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 't':
+			params.bytes_per_sec = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'b':
+			sim_param_buffers(strtoul(optarg, NULL, 0));
+			break;
+		case 'm':
+			total = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'w':
+			threads = atoi(optarg);
+			break;
+		case 'q':
+			quick = 1;
+			break;
+		case 'v':
+			sim_loglevel = 7;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (devices < 1 || total == 0 || threads < 0 ||
+			threads > MAX_SESSIONS)
+		usage(argv[0]);
+	if (!threads)
+		threads = quick ? 4 : 16;
+	if (quick)
+		total = 4 << 20;
+	gen(data, sizeof(data));
+	for (idx = 0; idx < devices; idx++)
+		if ((rv = sim_device_add(&params)) < 0) {
+			fprintf(stderr, "device: %s\n", strerror(-rv));
+			return 1;
+		}
+	if ((rv = sim_module_init())) {
+		fprintf(stderr, "module init: %s\n", strerror(-rv));
+		return 1;
+	}
+	printf("%d device(s), latency %llu us, %llu MB/s\n", devices,
+			(unsigned long long) params.latency_ns / 1000,
+			(unsigned long long) params.bytes_per_sec >> 20);
+	failures += check();
+	failures += credits();
+	printf("\n%8s %8s %10s %10s %10s %10s %10s\n", "sessions", "chunk",
+			"MB/s", "cmds/s", "cmds", "irqs", "polls");
+	for (idx = 0; idx < 3; idx++)
+		failures += throughput(sessions[idx], 0x10000, total, devices);
+	for (idx = 0; idx < 3; idx++)
+		if (chunks[idx] != 0x10000)
+			failures += throughput(4, chunks[idx], total, devices);
+	printf("\n%8s %8s %10s %10s %10s %10s\n", "size", "count", "p50 us",
+			"p99 us", "p99.9 us", "max us");
+	failures += latency(0x4000, quick ? 200 : 2000);
+	failures += latency(0x40000, quick ? 50 : 500);
+	printf("\n%8s %8s %12s %12s\n", "threads", "size", "writes/s",
+			"per thread");
+	for (idx = 1; idx <= threads; idx *= 2)
+		failures += scaling(idx, quick ? 20000 : 200000);
+	failures += unplug(devices);
+	printf("\n%8s %12s %12s %10s %10s %8s\n", "device", "mmio reads",
+			"mmio writes", "cmds", "interrupts", "faults");
+	for (idx = 0; idx < devices; idx++) {
+		sim_device_stats(idx, &stats);
+		printf("%8d %12llu %12llu %10llu %10llu %8llu\n", idx,
+				(unsigned long long) stats.mmio_reads,
+				(unsigned long long) stats.mmio_writes,
+				(unsigned long long) stats.cmds,
+				(unsigned long long) stats.interrupts,
+				(unsigned long long) stats.faults);
+		failures += stats.faults != 0;
+	}
+	sim_module_exit();
+	sim_device_free_all();
+	if (failures)
+		printf("%d failure(s)\n", failures);
+	return failures ? 1 : 0;
+}
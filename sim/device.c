@@ -0,0 +1,463 @@
+#include <sim_kernel.h>
+#include <time.h>
+#include "../crcdev.h"
+#include "sim.h"
+
+/* Model of crcdev's BAR0: the engine thread fetches commands from the ring
+ * in host memory, checksums them on their contexts and raises FETCH_DATA
+ * after configured latency, the interrupt thread runs driver's handlers
+ * whenever an enabled interrupt is pending. BAR0 is the first member of a
+ * device aligned to SIM_BAR_ALIGN, so MMIO address identifies the device. */
+
+#define	SIM_BAR_SIZE		0x100
+#define	SIM_BAR_ALIGN		0x10000
+#define	SIM_DEVS_COUNT		16
+#define	SIM_IRQ_BASE		16
+/* Interrupt handled but not masked, e.g. during probe or removal */
+#define	SIM_IRQ_BACKOFF_NS	(100 * NSEC_PER_USEC)
+
+/* Command block entry as read by the device */
+struct sim_command {
+	__le32 addr;
+	__le32 count_ctx;
+};
+
+struct sim_device {
+	u8 bar[SIM_BAR_SIZE];
+	struct pci_dev pdev;
+	struct sim_dev_params params;
+	int bound;
+	/* Registers */
+	pthread_mutex_t lock;
+	pthread_cond_t engine_cond;
+	pthread_cond_t irq_cond;
+	u32 enable;
+	u32 intr;
+	u32 intr_enable;
+	u32 poly[CRCDEV_CTX_COUNT];
+	u32 sum[CRCDEV_CTX_COUNT];
+	u32 fetch_data_addr;
+	u32 fetch_data_count;
+	u32 fetch_data_ctx;
+	u32 cmd_addr;
+	u32 cmd_size;
+	u32 cmd_read;
+	u32 cmd_write;
+	/* Command fetched and being processed */
+	int busy;
+	/* Lookup tables of contexts, rebuilt after poly changes */
+	u32 table[CRCDEV_CTX_COUNT][256];
+	int table_valid[CRCDEV_CTX_COUNT];
+	/* Threads */
+	pthread_t engine;
+	int engine_stop;
+	pthread_t irq_thread;
+	int irq_stop;
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+	void *dev_id;
+	struct sim_dev_stats stats;
+};
+
+static struct sim_device *sim_devices[SIM_DEVS_COUNT];
+static int sim_devices_count;
+static struct pci_driver *sim_driver;
+
+static struct sim_device *sim_bar_device(const void __iomem *addr,
+		unsigned int *reg) {
+	struct sim_device *dev = (struct sim_device *) ((unsigned long) addr &
+			~(SIM_BAR_ALIGN - 1UL));
+	*reg = (const u8 *) addr - dev->bar;
+	BUG_ON(*reg >= SIM_BAR_SIZE || *reg & 3);
+	return dev;
+}
+
+/* CRITICAL (dev->lock), pending interrupts including level triggered ones */
+static u32 sim_intr_level(struct sim_device *dev) {
+	u32 intr = dev->intr;
+	if (dev->cmd_size && (dev->cmd_write + 1) % dev->cmd_size !=
+			dev->cmd_read)
+		intr |= CRCDEV_INTR_FETCH_CMD_NONFULL;
+	if (dev->cmd_read == dev->cmd_write && !dev->busy)
+		intr |= CRCDEV_INTR_FETCH_CMD_IDLE;
+	return intr;
+}
+
+/* CRITICAL (dev->lock) */
+static int sim_engine_ready(struct sim_device *dev) {
+	return (dev->enable & CRCDEV_ENABLE_FETCH_CMD) &&
+		(dev->enable & CRCDEV_ENABLE_FETCH_DATA) && dev->cmd_size &&
+		dev->cmd_read != dev->cmd_write;
+}
+
+/* CRITICAL (dev->lock) */
+static void sim_changed(struct sim_device *dev) {
+	pthread_cond_broadcast(&dev->engine_cond);
+	pthread_cond_broadcast(&dev->irq_cond);
+}
+
+u32 ioread32(const void __iomem *addr) {
+	unsigned int reg;
+	struct sim_device *dev = sim_bar_device(addr, &reg);
+	u32 val = 0;
+	int ctx = (reg - CRCDEV_CRC_POLY(0)) / 0x10;
+	pthread_mutex_lock(&dev->lock);
+	dev->stats.mmio_reads++;
+	switch (reg) {
+	case CRCDEV_ENABLE:
+		val = dev->enable;
+		break;
+	case CRCDEV_STATUS:
+		if (dev->busy)
+			val |= CRCDEV_STATUS_FETCH_DATA;
+		if (sim_engine_ready(dev))
+			val |= CRCDEV_STATUS_FETCH_CMD;
+		break;
+	case CRCDEV_INTR:
+		val = sim_intr_level(dev);
+		break;
+	case CRCDEV_INTR_ENABLE:
+		val = dev->intr_enable;
+		break;
+	case CRCDEV_FETCH_DATA_ADDR:
+		val = dev->fetch_data_addr;
+		break;
+	case CRCDEV_FETCH_DATA_COUNT:
+		val = dev->fetch_data_count;
+		break;
+	case CRCDEV_FETCH_DATA_CTX:
+		val = dev->fetch_data_ctx;
+		break;
+	case CRCDEV_FETCH_CMD_ADDR:
+		val = dev->cmd_addr;
+		break;
+	case CRCDEV_FETCH_CMD_SIZE:
+		val = dev->cmd_size;
+		break;
+	case CRCDEV_FETCH_CMD_READ_POS:
+		val = dev->cmd_read;
+		break;
+	case CRCDEV_FETCH_CMD_WRITE_POS:
+		val = dev->cmd_write;
+		break;
+	default:
+		if (0 <= ctx && ctx < CRCDEV_CTX_COUNT) {
+			if (reg == CRCDEV_CRC_POLY(ctx))
+				val = dev->poly[ctx];
+			else if (reg == CRCDEV_CRC_SUM(ctx))
+				val = dev->sum[ctx];
+		}
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return val;
+}
+
+/* CRITICAL (dev->lock), reflected CRC, neither input nor output inverted */
+static void sim_ctx_table(struct sim_device *dev, int ctx) {
+	u32 crc, poly = dev->poly[ctx];
+	int idx, bit;
+	if (dev->table_valid[ctx])
+		return;
+	for (idx = 0; idx < 256; idx++) {
+		crc = idx;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (crc & 1 ? poly : 0);
+		dev->table[ctx][idx] = crc;
+	}
+	dev->table_valid[ctx] = 1;
+}
+
+static u32 sim_crc(const u32 *table, u32 crc, const u8 *data, size_t len) {
+	while (len--)
+		crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+void iowrite32(u32 val, void __iomem *addr) {
+	unsigned int reg;
+	struct sim_device *dev = sim_bar_device(addr, &reg);
+	int ctx = (reg - CRCDEV_CRC_POLY(0)) / 0x10;
+	u8 bytes[4];
+	pthread_mutex_lock(&dev->lock);
+	dev->stats.mmio_writes++;
+	switch (reg) {
+	case CRCDEV_ENABLE:
+		dev->enable = val;
+		break;
+	case CRCDEV_INTR:
+		/* Write one to clear */
+		dev->intr &= ~val;
+		break;
+	case CRCDEV_INTR_ENABLE:
+		dev->intr_enable = val;
+		break;
+	case CRCDEV_FETCH_DATA_ADDR:
+		dev->fetch_data_addr = val;
+		break;
+	case CRCDEV_FETCH_DATA_COUNT:
+		dev->fetch_data_count = val;
+		break;
+	case CRCDEV_FETCH_DATA_CTX:
+		dev->fetch_data_ctx = val;
+		break;
+	case CRCDEV_FETCH_DATA_INTR_ACK:
+		dev->intr &= ~CRCDEV_INTR_FETCH_DATA;
+		break;
+	case CRCDEV_FETCH_CMD_ADDR:
+		dev->cmd_addr = val;
+		break;
+	case CRCDEV_FETCH_CMD_SIZE:
+		dev->cmd_size = val;
+		break;
+	case CRCDEV_FETCH_CMD_READ_POS:
+		dev->cmd_read = val;
+		break;
+	case CRCDEV_FETCH_CMD_WRITE_POS:
+		dev->cmd_write = val;
+		break;
+	default:
+		if (ctx < 0 || CRCDEV_CTX_COUNT <= ctx)
+			break;
+		if (reg == CRCDEV_CRC_POLY(ctx)) {
+			if (dev->poly[ctx] != val)
+				dev->table_valid[ctx] = 0;
+			dev->poly[ctx] = val;
+		} else if (reg == CRCDEV_CRC_SUM(ctx)) {
+			dev->sum[ctx] = val;
+		} else if (reg == CRCDEV_CRC_DATA(ctx)) {
+			memcpy(bytes, &val, sizeof(bytes));
+			sim_ctx_table(dev, ctx);
+			dev->sum[ctx] = sim_crc(dev->table[ctx], dev->sum[ctx],
+					bytes, sizeof(bytes));
+		}
+	}
+	sim_changed(dev);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+static void sim_sleep_until(u64 deadline) {
+	struct timespec ts;
+	ts.tv_sec = deadline / NSEC_PER_SEC;
+	ts.tv_nsec = deadline % NSEC_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+			EINTR);
+}
+
+/* Processes one command at a time, context is not touched by the driver
+ * while its command is in flight */
+static void *sim_engine(void *data) {
+	struct sim_device *dev = data;
+	struct sim_command cmd, *cmdp;
+	u32 count, ctx, sum;
+	const u8 *buf;
+	u64 start, deadline;
+	pthread_mutex_lock(&dev->lock);
+	for (;;) {
+		while (!dev->engine_stop && !sim_engine_ready(dev))
+			pthread_cond_wait(&dev->engine_cond, &dev->lock);
+		if (dev->engine_stop)
+			break;
+		start = sim_clock_ns();
+		cmdp = sim_dma_virt(dev->cmd_addr + dev->cmd_read *
+				CRCDEV_CMD_SIZE, CRCDEV_CMD_SIZE);
+		if (!cmdp) {
+			printk(KERN_ERR "sim: command fetch fault at %x",
+					dev->cmd_addr);
+			dev->stats.faults++;
+			dev->enable = 0;
+			continue;
+		}
+		memcpy(&cmd, cmdp, sizeof(cmd));
+		count = le32_to_cpu(cmd.count_ctx) & CRCDEV_CMD_COUNT_MASK;
+		ctx = (le32_to_cpu(cmd.count_ctx) >> CRCDEV_CMD_CTX_SHIFT) &
+			CRCDEV_CMD_CTX_MASK;
+		dev->cmd_read = (dev->cmd_read + 1) % dev->cmd_size;
+		dev->busy = 1;
+		dev->fetch_data_addr = le32_to_cpu(cmd.addr);
+		dev->fetch_data_count = count;
+		dev->fetch_data_ctx = ctx;
+		sim_ctx_table(dev, ctx);
+		sum = dev->sum[ctx];
+		sim_changed(dev);
+		pthread_mutex_unlock(&dev->lock);
+		if ((buf = sim_dma_virt(le32_to_cpu(cmd.addr), count)))
+			sum = sim_crc(dev->table[ctx], sum, buf, count);
+		deadline = start + dev->params.latency_ns;
+		if (dev->params.bytes_per_sec)
+			deadline += (u64) count * NSEC_PER_SEC /
+				dev->params.bytes_per_sec;
+		sim_sleep_until(deadline);
+		pthread_mutex_lock(&dev->lock);
+		if (!buf) {
+			printk(KERN_ERR "sim: data fetch fault at %x count %u",
+					le32_to_cpu(cmd.addr), count);
+			dev->stats.faults++;
+		}
+		dev->sum[ctx] = sum;
+		dev->busy = 0;
+		dev->fetch_data_count = 0;
+		dev->intr |= CRCDEV_INTR_FETCH_DATA;
+		dev->stats.cmds++;
+		dev->stats.bytes += count;
+		sim_changed(dev);
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return NULL;
+}
+
+/* Runs hard handler whenever an enabled interrupt is pending, then the
+ * threaded one if asked to, just like a dedicated line would */
+static void *sim_irq(void *data) {
+	struct sim_device *dev = data;
+	irqreturn_t rv;
+	pthread_mutex_lock(&dev->lock);
+	for (;;) {
+		while (!dev->irq_stop && !(sim_intr_level(dev) &
+					dev->intr_enable))
+			pthread_cond_wait(&dev->irq_cond, &dev->lock);
+		if (dev->irq_stop)
+			break;
+		dev->stats.interrupts++;
+		pthread_mutex_unlock(&dev->lock);
+		rv = dev->handler(dev->pdev.irq, dev->dev_id);
+		if (rv == IRQ_WAKE_THREAD)
+			rv = dev->thread_fn(dev->pdev.irq, dev->dev_id);
+		else if (rv == IRQ_HANDLED)
+			sim_sleep_until(sim_clock_ns() + SIM_IRQ_BACKOFF_NS);
+		pthread_mutex_lock(&dev->lock);
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return NULL;
+}
+
+static struct sim_device *sim_irq_device(unsigned int irq) {
+	int idx = irq - SIM_IRQ_BASE;
+	BUG_ON(idx < 0 || sim_devices_count <= idx);
+	return sim_devices[idx];
+}
+
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+		irq_handler_t thread_fn, unsigned long flags, const char *name,
+		void *dev_id) {
+	struct sim_device *dev = sim_irq_device(irq);
+	if (dev->handler)
+		return -EBUSY;
+	dev->handler = handler;
+	dev->thread_fn = thread_fn;
+	dev->dev_id = dev_id;
+	dev->irq_stop = 0;
+	if (pthread_create(&dev->irq_thread, NULL, sim_irq, dev)) {
+		dev->handler = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void free_irq(unsigned int irq, void *dev_id) {
+	struct sim_device *dev = sim_irq_device(irq);
+	pthread_mutex_lock(&dev->lock);
+	dev->irq_stop = 1;
+	pthread_cond_broadcast(&dev->irq_cond);
+	pthread_mutex_unlock(&dev->lock);
+	pthread_join(dev->irq_thread, NULL);
+	dev->handler = NULL;
+}
+
+void __iomem *pci_iomap(struct pci_dev *pdev, int bar, unsigned long max) {
+	struct sim_device *dev = pdev->sim;
+	return bar == 0 ? dev->bar : NULL;
+}
+
+/* Bus */
+int pci_register_driver(struct pci_driver *drv) {
+	const struct pci_device_id *id;
+	struct sim_device *dev;
+	int idx, rv;
+	sim_driver = drv;
+	for (idx = 0; idx < sim_devices_count; idx++) {
+		dev = sim_devices[idx];
+		for (id = drv->id_table; id->vendor; id++)
+			if (id->vendor == dev->pdev.vendor &&
+					id->device == dev->pdev.device)
+				break;
+		if (!id->vendor)
+			continue;
+		if ((rv = drv->probe(&dev->pdev, id)))
+			printk(KERN_ERR "sim: probe of device %d failed: %d",
+					idx, rv);
+		else
+			dev->bound = 1;
+	}
+	return 0;
+}
+
+void pci_unregister_driver(struct pci_driver *drv) {
+	int idx;
+	for (idx = sim_devices_count - 1; idx >= 0; idx--) {
+		if (!sim_devices[idx]->bound)
+			continue;
+		drv->remove(&sim_devices[idx]->pdev);
+		sim_devices[idx]->bound = 0;
+	}
+	sim_driver = NULL;
+}
+
+int sim_device_unplug(int idx) {
+	if (idx < 0 || sim_devices_count <= idx || !sim_driver ||
+			!sim_devices[idx]->bound)
+		return -ENODEV;
+	sim_driver->remove(&sim_devices[idx]->pdev);
+	sim_devices[idx]->bound = 0;
+	return 0;
+}
+
+int sim_device_add(const struct sim_dev_params *params) {
+	struct sim_device *dev;
+	void *mem;
+	if (sim_devices_count == SIM_DEVS_COUNT)
+		return -ENOSPC;
+	BUILD_BUG_ON(sizeof(*dev) > SIM_BAR_ALIGN);
+	if (posix_memalign(&mem, SIM_BAR_ALIGN, sizeof(*dev)))
+		return -ENOMEM;
+	dev = memset(mem, 0, sizeof(*dev));
+	dev->params = *params;
+	dev->pdev.vendor = CRCDEV_VENDOR_ID;
+	dev->pdev.device = CRCDEV_DEVICE_ID;
+	dev->pdev.devfn = sim_devices_count << 3;
+	dev->pdev.irq = SIM_IRQ_BASE + sim_devices_count;
+	dev->pdev.dev.numa_node = NUMA_NO_NODE;
+	dev->pdev.sim = dev;
+	snprintf(dev->pdev.dev.name, sizeof(dev->pdev.dev.name),
+			"0000:00:%02x.0", sim_devices_count);
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->engine_cond, NULL);
+	pthread_cond_init(&dev->irq_cond, NULL);
+	if (pthread_create(&dev->engine, NULL, sim_engine, dev)) {
+		free(dev);
+		return -ENOMEM;
+	}
+	sim_devices[sim_devices_count] = dev;
+	return sim_devices_count++;
+}
+
+void sim_device_stats(int idx, struct sim_dev_stats *stats) {
+	struct sim_device *dev = sim_devices[idx];
+	pthread_mutex_lock(&dev->lock);
+	*stats = dev->stats;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/* Driver must be unloaded already */
+void sim_device_free_all(void) {
+	struct sim_device *dev;
+	while (sim_devices_count) {
+		dev = sim_devices[--sim_devices_count];
+		pthread_mutex_lock(&dev->lock);
+		dev->engine_stop = 1;
+		pthread_cond_broadcast(&dev->engine_cond);
+		pthread_mutex_unlock(&dev->lock);
+		pthread_join(dev->engine, NULL);
+		free(dev);
+		sim_devices[sim_devices_count] = NULL;
+	}
+}
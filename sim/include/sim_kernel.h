@@ -0,0 +1,916 @@
+#ifndef SIM_KERNEL_H_
+#define SIM_KERNEL_H_
+
+/* Userspace stand-ins of kernel primitives used by the driver, all of them
+ * are thin wrappers of pthreads and libc. Every <linux/...> and <asm/...>
+ * header of the driver resolves to this one. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+
+/* Types */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u32 __le32;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef u32 dma_addr_t;
+typedef unsigned int gfp_t;
+typedef int bool;
+
+/* Byte order, the model runs on little endian hosts only */
+#define cpu_to_le32(x)		((u32) (x))
+#define le32_to_cpu(x)		((u32) (x))
+
+/* Compiler */
+#define __user
+#define __iomem
+#define __force
+#define __percpu
+#define __init
+#define __exit
+#define __must_check
+#define __packed		__attribute__((packed))
+#ifndef __always_inline
+#define __always_inline		inline __attribute__((always_inline))
+#endif
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *) &(x))
+#define barrier()		__asm__ __volatile__("" ::: "memory")
+#define smp_mb()		__sync_synchronize()
+#define smp_rmb()		__sync_synchronize()
+#define smp_wmb()		__sync_synchronize()
+#define mb()			__sync_synchronize()
+#define rmb()			__sync_synchronize()
+#define wmb()			__sync_synchronize()
+#define mmiowb()		__sync_synchronize()
+#define cpu_relax()		barrier()
+#define might_sleep()		do { } while (0)
+#define cond_resched()		do { } while (0)
+
+/* Kernel */
+#define KERN_EMERG		"<0>"
+#define KERN_ALERT		"<1>"
+#define KERN_CRIT		"<2>"
+#define KERN_ERR		"<3>"
+#define KERN_WARNING		"<4>"
+#define KERN_NOTICE		"<5>"
+#define KERN_INFO		"<6>"
+#define KERN_DEBUG		"<7>"
+int printk(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+#define ERESTARTSYS		512
+#define EIOCBQUEUED		529
+
+#define container_of(ptr, type, member) ({ \
+	const typeof(((type *) 0)->member) *__mptr = (ptr); \
+	(type *) ((char *) __mptr - offsetof(type, member)); })
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define min(x, y)		({ typeof(x) _x = (x); typeof(y) _y = (y); \
+				 _x < _y ? _x : _y; })
+#define max(x, y)		({ typeof(x) _x = (x); typeof(y) _y = (y); \
+				 _x > _y ? _x : _y; })
+#define min_t(t, x, y)		({ t _x = (x); t _y = (y); _x < _y ? _x : _y; })
+#define max_t(t, x, y)		({ t _x = (x); t _y = (y); _x > _y ? _x : _y; })
+#define clamp_t(t, v, lo, hi)	min_t(t, max_t(t, v, lo), hi)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define roundup(x, y)		((((x) + ((y) - 1)) / (y)) * (y))
+#define is_power_of_2(n)	((n) != 0 && (((n) & ((n) - 1)) == 0))
+#define div_u64(a, b)		((u64) (a) / (b))
+#define fls64(x)		((x) ? 64 - __builtin_clzll(x) : 0)
+#define fls(x)			((x) ? 32 - __builtin_clz(x) : 0)
+#define BUILD_BUG_ON(c)		((void) sizeof(char[1 - 2 * !!(c)]))
+void sim_bug(const char *, int) __attribute__((noreturn));
+#define BUG()			sim_bug(__FILE__, __LINE__)
+#define BUG_ON(c)		do { if (unlikely(c)) BUG(); } while (0)
+#define WARN_ON(c)		({ int __w = !!(c); if (unlikely(__w)) \
+				 printk(KERN_WARNING "WARN_ON %s:%d", \
+					 __FILE__, __LINE__); __w; })
+#define EXPORT_SYMBOL(s)
+#define NSEC_PER_USEC		1000ULL
+#define NSEC_PER_MSEC		1000000ULL
+#define NSEC_PER_SEC		1000000000ULL
+#define USEC_PER_SEC		1000000ULL
+int strict_strtoul(const char *, unsigned int, unsigned long *);
+
+/* Errors */
+#define MAX_ERRNO		4095
+#define IS_ERR_VALUE(x)		unlikely((x) >= (unsigned long) -MAX_ERRNO)
+static inline void *ERR_PTR(long error) { return (void *) error; }
+static inline long PTR_ERR(const void *ptr) { return (long) ptr; }
+static inline long IS_ERR(const void *ptr) {
+	return IS_ERR_VALUE((unsigned long) ptr);
+}
+static inline long IS_ERR_OR_NULL(const void *ptr) {
+	return !ptr || IS_ERR_VALUE((unsigned long) ptr);
+}
+
+/* Module */
+struct module;
+#define THIS_MODULE		((struct module *) NULL)
+#define MODULE_AUTHOR(s)
+#define MODULE_LICENSE(s)
+#define MODULE_DESCRIPTION(s)
+#define MODULE_PARM_DESC(n, s)
+#define MODULE_DEVICE_TABLE(t, n)
+/* Parameters can be set by the harness before sim_module_init() */
+#define module_param_named(name, var, type, perm) \
+	void sim_param_##name(unsigned long val) { var = val; }
+#define module_init(fn)		int sim_module_init(void) { return fn(); }
+#define module_exit(fn)		void sim_module_exit(void) { fn(); }
+#define S_IRUGO			0444
+#ifndef S_IWUSR
+#define S_IWUSR			0200
+#endif
+
+/* Lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+		struct list_head *next) {
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) {
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new,
+		struct list_head *head) {
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next) {
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry) {
+	__list_del(entry->prev, entry->next);
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry) {
+	__list_del(entry->prev, entry->next);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head) {
+	__list_del(list->prev, list->next);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list,
+		struct list_head *head) {
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head) {
+	return head->next == head;
+}
+
+static inline void __list_splice(const struct list_head *list,
+		struct list_head *prev, struct list_head *next) {
+	struct list_head *first = list->next, *last = list->prev;
+	first->prev = prev;
+	prev->next = first;
+	last->next = next;
+	next->prev = last;
+}
+
+static inline void list_splice(const struct list_head *list,
+		struct list_head *head) {
+	if (!list_empty(list))
+		__list_splice(list, head, head->next);
+}
+
+static inline void list_splice_tail(struct list_head *list,
+		struct list_head *head) {
+	if (!list_empty(list))
+		__list_splice(list, head->prev, head);
+}
+
+static inline void list_splice_init(struct list_head *list,
+		struct list_head *head) {
+	if (!list_empty(list)) {
+		__list_splice(list, head, head->next);
+		INIT_LIST_HEAD(list);
+	}
+}
+
+static inline void list_splice_tail_init(struct list_head *list,
+		struct list_head *head) {
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev, head);
+		INIT_LIST_HEAD(list);
+	}
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+			pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member); \
+			&pos->member != (head); \
+			pos = list_entry(pos->member.next, typeof(*pos), \
+				member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member), \
+			n = list_entry(pos->member.next, typeof(*pos), \
+				member); \
+			&pos->member != (head); \
+			pos = n, n = list_entry(n->member.next, typeof(*n), \
+				member))
+
+/* Atomics */
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic64_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		__atomic_load_n(&(v)->counter, __ATOMIC_SEQ_CST)
+#define atomic_set(v, i)	__atomic_store_n(&(v)->counter, (i), \
+					__ATOMIC_SEQ_CST)
+#define atomic_add(i, v)	((void) __atomic_add_fetch(&(v)->counter, \
+					(i), __ATOMIC_SEQ_CST))
+#define atomic_sub(i, v)	((void) __atomic_sub_fetch(&(v)->counter, \
+					(i), __ATOMIC_SEQ_CST))
+#define atomic_inc(v)		atomic_add(1, v)
+#define atomic_dec(v)		atomic_sub(1, v)
+#define atomic_add_return(i, v)	__atomic_add_fetch(&(v)->counter, (i), \
+					__ATOMIC_SEQ_CST)
+#define atomic_sub_return(i, v)	__atomic_sub_fetch(&(v)->counter, (i), \
+					__ATOMIC_SEQ_CST)
+#define atomic_inc_return(v)	atomic_add_return(1, v)
+#define atomic_dec_return(v)	atomic_sub_return(1, v)
+#define atomic_dec_and_test(v)	(atomic_sub_return(1, v) == 0)
+#define atomic_inc_not_zero(v)	({ typeof((v)->counter) __o = \
+				 atomic_read(v); while (__o && \
+				 !__atomic_compare_exchange_n(&(v)->counter, \
+				 &__o, __o + 1, 0, __ATOMIC_SEQ_CST, \
+				 __ATOMIC_SEQ_CST)); __o != 0; })
+#define atomic_cmpxchg(v, o, n)	({ typeof((v)->counter) __o = (o); \
+				 __atomic_compare_exchange_n(&(v)->counter, \
+				 &__o, (n), 0, __ATOMIC_SEQ_CST, \
+				 __ATOMIC_SEQ_CST); __o; })
+#define atomic_xchg(v, n)	__atomic_exchange_n(&(v)->counter, (n), \
+					__ATOMIC_SEQ_CST)
+#define atomic64_read		atomic_read
+#define atomic64_set		atomic_set
+#define atomic64_add		atomic_add
+#define atomic64_sub		atomic_sub
+#define atomic64_inc		atomic_inc
+#define atomic64_dec		atomic_dec
+#define atomic64_add_return	atomic_add_return
+#define atomic64_inc_return	atomic_inc_return
+#define atomic64_cmpxchg	atomic_cmpxchg
+#define atomic64_xchg		atomic_xchg
+
+/* Bitops */
+#define BITS_PER_LONG		64
+#define BITS_TO_LONGS(n)	DIV_ROUND_UP(n, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(int nr, volatile unsigned long *addr) {
+	__atomic_fetch_or(addr + BIT_WORD(nr), BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+
+static inline void clear_bit(int nr, volatile unsigned long *addr) {
+	__atomic_fetch_and(addr + BIT_WORD(nr), ~BIT_MASK(nr),
+			__ATOMIC_SEQ_CST);
+}
+
+static inline int test_bit(int nr, const volatile unsigned long *addr) {
+	return !!(__atomic_load_n(addr + BIT_WORD(nr), __ATOMIC_SEQ_CST) &
+			BIT_MASK(nr));
+}
+
+static inline int test_and_set_bit(int nr, volatile unsigned long *addr) {
+	return !!(__atomic_fetch_or(addr + BIT_WORD(nr), BIT_MASK(nr),
+				__ATOMIC_SEQ_CST) & BIT_MASK(nr));
+}
+
+static inline int test_and_clear_bit(int nr, volatile unsigned long *addr) {
+	return !!(__atomic_fetch_and(addr + BIT_WORD(nr), ~BIT_MASK(nr),
+				__ATOMIC_SEQ_CST) & BIT_MASK(nr));
+}
+
+static inline int find_first_zero_bit(const unsigned long *addr, int size) {
+	int nr;
+	for (nr = 0; nr < size; nr++)
+		if (!test_bit(nr, addr))
+			return nr;
+	return size;
+}
+
+static inline void bitmap_zero(unsigned long *dst, int nbits) {
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+/* Time, jiffies tick at HZ on the monotonic clock */
+#define HZ			1000
+unsigned long sim_jiffies(void);
+#define jiffies			sim_jiffies()
+#define msecs_to_jiffies(m)	((unsigned long) (m) * HZ / 1000)
+#define jiffies_to_msecs(j)	((unsigned int) ((j) * 1000 / HZ))
+#define time_after(a, b)	((long) ((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+
+typedef union {
+	s64 tv64;
+} ktime_t;
+
+u64 sim_clock_ns(void);
+static inline ktime_t ns_to_ktime(u64 ns) {
+	ktime_t kt = { .tv64 = ns };
+	return kt;
+}
+#define ktime_get()		ns_to_ktime(sim_clock_ns())
+#define ktime_to_ns(kt)		((kt).tv64)
+#define ktime_to_us(kt)		((kt).tv64 / 1000)
+#define ktime_set(s, ns)	ns_to_ktime((u64) (s) * NSEC_PER_SEC + (ns))
+#define ktime_add_us(kt, us)	ns_to_ktime((kt).tv64 + (u64) (us) * 1000)
+#define ktime_add_ns(kt, ns)	ns_to_ktime((kt).tv64 + (ns))
+#define ktime_sub(a, b)		ns_to_ktime((a).tv64 - (b).tv64)
+#define ktime_add(a, b)		ns_to_ktime((a).tv64 + (b).tv64)
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS = 0,
+	HRTIMER_MODE_REL = 1,
+};
+
+/* Scheduler, every thread has its task_struct, kthreads run on pthreads */
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+#define TASK_UNINTERRUPTIBLE	2
+
+struct rw_semaphore {
+	pthread_rwlock_t lock;
+};
+
+struct mm_struct {
+	struct rw_semaphore mmap_sem;
+	unsigned long locked_vm;
+	atomic_t mm_count;
+};
+#define mmdrop(mm)		atomic_dec(&(mm)->mm_count)
+
+struct task_struct {
+	struct mm_struct *mm;
+	int state;
+	int woken;
+	int started;
+	int should_stop;
+	int (*threadfn)(void *);
+	void *data;
+	int result;
+	char comm[32];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct task_struct *sim_current(void);
+#define current			sim_current()
+void set_current_state(int);
+#define __set_current_state(s)	set_current_state(s)
+void schedule(void);
+int schedule_hrtimeout(ktime_t *, enum hrtimer_mode);
+int wake_up_process(struct task_struct *);
+int signal_pending(struct task_struct *);
+struct task_struct *kthread_create(int (*)(void *), void *, const char *, ...)
+	__attribute__((format(printf, 3, 4)));
+int kthread_stop(struct task_struct *);
+int kthread_should_stop(void);
+/* Limits are these of the harness process, which has no capabilities */
+#define CAP_IPC_LOCK		14
+#define capable(cap)		0
+unsigned long rlimit(unsigned int);
+#define NUMA_NO_NODE		(-1)
+#define numa_node_id()		0
+#define smp_processor_id()	0
+#define get_cpu()		0
+#define put_cpu()		do { } while (0)
+#define preempt_disable()	do { } while (0)
+#define preempt_enable()	do { } while (0)
+
+/* Locks */
+typedef struct {
+	pthread_mutex_t lock;
+} spinlock_t;
+
+#define spin_lock_init(l)	pthread_mutex_init(&(l)->lock, NULL)
+#define spin_lock(l)		pthread_mutex_lock(&(l)->lock)
+#define spin_unlock(l)		pthread_mutex_unlock(&(l)->lock)
+#define spin_lock_irq(l)	spin_lock(l)
+#define spin_unlock_irq(l)	spin_unlock(l)
+#define spin_lock_irqsave(l, f)	do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void) (f); spin_unlock(l); } \
+	while (0)
+#define spin_lock_bh(l)		spin_lock(l)
+#define spin_unlock_bh(l)	spin_unlock(l)
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) \
+	struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(m)		pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m)		pthread_mutex_lock(&(m)->lock)
+#define mutex_lock_interruptible(m) (pthread_mutex_lock(&(m)->lock), 0)
+#define mutex_trylock(m)	(pthread_mutex_trylock(&(m)->lock) == 0)
+#define mutex_unlock(m)		pthread_mutex_unlock(&(m)->lock)
+
+#define init_rwsem(s)		pthread_rwlock_init(&(s)->lock, NULL)
+#define down_read(s)		pthread_rwlock_rdlock(&(s)->lock)
+#define down_read_trylock(s)	(pthread_rwlock_tryrdlock(&(s)->lock) == 0)
+#define up_read(s)		pthread_rwlock_unlock(&(s)->lock)
+#define down_write(s)		pthread_rwlock_wrlock(&(s)->lock)
+#define down_write_trylock(s)	(pthread_rwlock_trywrlock(&(s)->lock) == 0)
+#define up_write(s)		pthread_rwlock_unlock(&(s)->lock)
+
+/* SRCU, readers count themselves in a slot of the CPU they run on (any slot
+ * will do for unlock), synchronize_srcu() flips the index twice and waits
+ * for the old one to drain each time */
+#define	SIM_SRCU_SLOTS		64
+
+struct srcu_struct {
+	struct {
+		long count[2];
+	} __attribute__((aligned(64))) slots[SIM_SRCU_SLOTS];
+	unsigned long completed;
+	pthread_mutex_t mutex;
+};
+
+int init_srcu_struct(struct srcu_struct *);
+void cleanup_srcu_struct(struct srcu_struct *);
+int srcu_read_lock(struct srcu_struct *);
+void srcu_read_unlock(struct srcu_struct *, int);
+void synchronize_srcu(struct srcu_struct *);
+
+struct semaphore {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int count;
+};
+
+void sema_init(struct semaphore *, int);
+void down(struct semaphore *);
+int down_interruptible(struct semaphore *);
+int down_trylock(struct semaphore *);
+void up(struct semaphore *);
+
+/* Wait queues, sleepers recheck their condition after every wake up */
+typedef struct wait_queue_head {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long seq;
+} wait_queue_head_t;
+
+void init_waitqueue_head(wait_queue_head_t *);
+void __wake_up(wait_queue_head_t *);
+unsigned long sim_wait_seq(wait_queue_head_t *);
+/* Sleeps until a wake up after seq or timeout (in ns, 0 is infinite),
+ * returns 0 on timeout */
+int sim_wait_until(wait_queue_head_t *, unsigned long, u64);
+#define wake_up(q)			__wake_up(q)
+#define wake_up_all(q)			__wake_up(q)
+#define wake_up_interruptible(q)	__wake_up(q)
+#define wake_up_interruptible_all(q)	__wake_up(q)
+#define wake_up_interruptible_poll(q, m) __wake_up(q)
+#define waitqueue_active(q)		1
+
+#define wait_event(wq, condition) do { \
+	unsigned long __seq; \
+	for (;;) { \
+		__seq = sim_wait_seq(&(wq)); \
+		if (condition) \
+			break; \
+		sim_wait_until(&(wq), __seq, 0); \
+	} \
+} while (0)
+
+#define wait_event_interruptible(wq, condition) ({ \
+	wait_event(wq, condition); \
+	0; })
+
+/* Returns remaining jiffies (at least 1) if condition became true */
+#define wait_event_interruptible_timeout(wq, condition, timeout) ({ \
+	u64 __end = sim_clock_ns() + (u64) (timeout) * (NSEC_PER_SEC / HZ); \
+	long __ret = 0; \
+	unsigned long __seq; \
+	for (;;) { \
+		u64 __now; \
+		__seq = sim_wait_seq(&(wq)); \
+		if (condition) { \
+			__now = sim_clock_ns(); \
+			__ret = __now < __end ? (__end - __now) / \
+				(NSEC_PER_SEC / HZ) + 1 : 1; \
+			break; \
+		} \
+		__now = sim_clock_ns(); \
+		if (__now >= __end) \
+			break; \
+		sim_wait_until(&(wq), __seq, __end - __now); \
+	} \
+	__ret; })
+#define wait_event_timeout	wait_event_interruptible_timeout
+
+struct completion {
+	unsigned int done;
+	wait_queue_head_t wait;
+};
+
+#define SIM_COMPLETE_ALL	(UINT_MAX / 2)
+#define init_completion(x) do { \
+	(x)->done = 0; \
+	init_waitqueue_head(&(x)->wait); \
+} while (0)
+#define INIT_COMPLETION(x)	__atomic_store_n(&(x).done, 0, \
+					__ATOMIC_SEQ_CST)
+#define completion_done(x)	(__atomic_load_n(&(x)->done, \
+					__ATOMIC_SEQ_CST) != 0)
+void complete(struct completion *);
+void complete_all(struct completion *);
+void wait_for_completion(struct completion *);
+#define wait_for_completion_interruptible(x) (wait_for_completion(x), 0)
+
+/* Reference counting */
+struct kref {
+	atomic_t refcount;
+};
+
+#define kref_init(k)		atomic_set(&(k)->refcount, 1)
+#define kref_get(k)		atomic_inc(&(k)->refcount)
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *))
+{
+	if (atomic_dec_and_test(&kref->refcount)) {
+		release(kref);
+		return 1;
+	}
+	return 0;
+}
+
+/* Memory, pages come from refcounted blocks so that split pages can be
+ * freed one by one */
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+#define PAGE_MASK		(~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(a)		(((a) + PAGE_SIZE - 1) & PAGE_MASK)
+
+#define GFP_KERNEL		0x01
+#define GFP_ATOMIC		0x02
+#define GFP_NOWAIT		0x04
+#define __GFP_ZERO		0x08
+#define __GFP_NOWARN		0x10
+
+struct sim_block;
+
+struct page {
+	void *addr;
+	struct sim_block *block;
+};
+
+#define kmalloc(s, f)		malloc(s)
+#define kzalloc(s, f)		calloc(1, s)
+#define kcalloc(n, s, f)	calloc(n, s)
+#define kfree(p)		free((void *) (p))
+void *vmalloc(unsigned long);
+void *vmalloc_user(unsigned long);
+#define vzalloc(s)		vmalloc_user(s)
+void vfree(const void *);
+
+static inline int get_order(unsigned long size) {
+	int order = 0;
+	size = (size - 1) >> PAGE_SHIFT;
+	while (size) {
+		order++;
+		size >>= 1;
+	}
+	return order;
+}
+
+struct page *alloc_pages(gfp_t, unsigned int);
+#define alloc_page(f)		alloc_pages(f, 0)
+#define split_page(p, o)	do { } while (0)
+#define nth_page(p, n)		((p) + (n))
+#define page_address(p)		((p)->addr)
+void __free_page(struct page *);
+void put_page(struct page *);
+#define page_cache_release(p)	put_page(p)
+int get_user_pages(struct task_struct *, struct mm_struct *, unsigned long,
+		int, int, int, struct page **, void *);
+
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_pgoff;
+	unsigned long vm_flags;
+};
+
+int vm_insert_page(struct vm_area_struct *, unsigned long, struct page *);
+int remap_vmalloc_range(struct vm_area_struct *, void *, unsigned long);
+
+/* Per-CPU data is a single instance updated atomically */
+#define alloc_percpu(type)	((type *) calloc(1, sizeof(type)))
+#define free_percpu(p)		free(p)
+#define per_cpu_ptr(p, cpu)	(p)
+#define this_cpu_ptr(p)		(p)
+#define this_cpu_inc(x)		((void) __atomic_add_fetch(&(x), 1, \
+					__ATOMIC_RELAXED))
+#define this_cpu_add(x, v)	((void) __atomic_add_fetch(&(x), (v), \
+					__ATOMIC_RELAXED))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define for_each_online_cpu(cpu) for_each_possible_cpu(cpu)
+
+/* User memory is directly addressable */
+#define access_ok(t, p, n)	1
+#define copy_from_user(to, from, n) (memcpy((to), (from), (n)), 0UL)
+#define copy_to_user(to, from, n) (memcpy((to), (from), (n)), 0UL)
+#define get_user(x, p)		((x) = *(p), 0)
+#define put_user(x, p)		(*(p) = (x), 0)
+#define VERIFY_READ		0
+#define VERIFY_WRITE		1
+
+/* Devices and sysfs */
+struct attribute {
+	const char *name;
+	unsigned int mode;
+};
+
+struct device;
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *, struct device_attribute *, char *);
+	ssize_t (*store)(struct device *, struct device_attribute *,
+			const char *, size_t);
+};
+
+#define __ATTR(_name, _mode, _show, _store) { \
+	.attr = { .name = #_name, .mode = _mode }, \
+	.show = _show, \
+	.store = _store, \
+}
+#define __ATTR_NULL		{ .attr = { .name = NULL } }
+
+#define SIM_DEVICE_ATTRS	64
+
+struct device {
+	char name[32];
+	dev_t devt;
+	int numa_node;
+	void *driver_data;
+	struct device *parent;
+	struct device_attribute *attrs[SIM_DEVICE_ATTRS];
+	struct device *next;
+};
+
+struct class {
+	const char *name;
+};
+
+#define dev_get_drvdata(d)	((d)->driver_data)
+#define dev_set_drvdata(d, p)	((d)->driver_data = (p))
+#define dev_to_node(d)		((d)->numa_node)
+struct class *class_create(struct module *, const char *);
+void class_destroy(struct class *);
+struct device *device_create(struct class *, struct device *, dev_t, void *,
+		const char *, ...) __attribute__((format(printf, 5, 6)));
+void device_destroy(struct class *, dev_t);
+int device_create_file(struct device *, struct device_attribute *);
+void device_remove_file(struct device *, struct device_attribute *);
+
+/* Character devices */
+#define MINORBITS		20
+#define MINORMASK		((1U << MINORBITS) - 1)
+#define MAJOR(dev)		((unsigned int) ((dev) >> MINORBITS))
+#define MINOR(dev)		((unsigned int) ((dev) & MINORMASK))
+#define MKDEV(ma, mi)		(((dev_t) (ma) << MINORBITS) | (mi))
+
+struct file_operations;
+
+struct cdev {
+	struct module *owner;
+	const struct file_operations *ops;
+	dev_t dev;
+	unsigned int count;
+};
+
+void cdev_init(struct cdev *, const struct file_operations *);
+int cdev_add(struct cdev *, dev_t, unsigned);
+void cdev_del(struct cdev *);
+int alloc_chrdev_region(dev_t *, unsigned, unsigned, const char *);
+void unregister_chrdev_region(dev_t, unsigned);
+
+/* Files */
+struct inode {
+	dev_t i_rdev;
+	struct cdev *i_cdev;
+};
+
+struct file {
+	unsigned int f_flags;
+	loff_t f_pos;
+	const struct file_operations *f_op;
+	void *private_data;
+	struct inode *f_inode;
+};
+
+#define iminor(inode)		MINOR((inode)->i_rdev)
+
+/* Asynchronous iocbs are completed by aio_complete() */
+struct kiocb {
+	struct file *ki_filp;
+	loff_t ki_pos;
+	void *private;
+	int ki_async;
+	long ki_res;
+	struct completion ki_done;
+};
+
+int aio_complete(struct kiocb *, long, long);
+
+#define is_sync_kiocb(iocb)	(!(iocb)->ki_async)
+
+static inline size_t iov_length(const struct iovec *iov,
+		unsigned long nr_segs) {
+	size_t ret = 0;
+	unsigned long seg;
+	for (seg = 0; seg < nr_segs; seg++)
+		ret += iov[seg].iov_len;
+	return ret;
+}
+
+typedef struct poll_table_struct {
+	int unused;
+} poll_table;
+
+#define poll_wait(f, q, p)	do { (void) (q); } while (0)
+#define POLLIN			0x0001
+#define POLLPRI			0x0002
+#define POLLOUT			0x0004
+#define POLLERR			0x0008
+#define POLLHUP			0x0010
+#define POLLRDNORM		0x0040
+#define POLLWRNORM		0x0100
+
+struct file_operations {
+	struct module *owner;
+	loff_t (*llseek)(struct file *, loff_t, int);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t,
+			loff_t *);
+	ssize_t (*aio_write)(struct kiocb *, const struct iovec *,
+			unsigned long, loff_t);
+	unsigned int (*poll)(struct file *, struct poll_table_struct *);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	int (*open)(struct inode *, struct file *);
+	int (*flush)(struct file *, void *);
+	int (*release)(struct inode *, struct file *);
+	int (*fsync)(struct file *, int);
+};
+
+loff_t no_llseek(struct file *, loff_t, int);
+
+/* Eventfds are host eventfds of the harness' process */
+struct eventfd_ctx;
+
+struct eventfd_ctx *eventfd_ctx_fdget(int);
+void eventfd_ctx_put(struct eventfd_ctx *);
+int eventfd_signal(struct eventfd_ctx *, int);
+
+/* PCI and DMA, bus addresses are 32-bit and translated by the device model */
+#define DMA_BIT_MASK(n)		(((n) == 64) ? ~0ULL : ((1ULL << (n)) - 1))
+#define PCI_DMA_TODEVICE	1
+#define PCI_DMA_FROMDEVICE	2
+#define PCI_DMA_BIDIRECTIONAL	0
+#define DMA_TO_DEVICE		PCI_DMA_TODEVICE
+
+struct pci_device_id {
+	u32 vendor, device;
+	u32 subvendor, subdevice;
+};
+
+#define PCI_ANY_ID		(~0U)
+#define PCI_DEVICE(vend, dev) \
+	.vendor = (vend), .device = (dev), \
+	.subvendor = PCI_ANY_ID, .subdevice = PCI_ANY_ID
+
+struct pci_dev {
+	struct device dev;
+	unsigned int irq;
+	u16 vendor;
+	u16 device;
+	unsigned int devfn;
+	void *sim;
+};
+
+struct pci_driver {
+	const char *name;
+	const struct pci_device_id *id_table;
+	int (*probe)(struct pci_dev *, const struct pci_device_id *);
+	void (*remove)(struct pci_dev *);
+};
+
+int pci_register_driver(struct pci_driver *);
+void pci_unregister_driver(struct pci_driver *);
+#define pci_enable_device(p)	0
+#define pci_disable_device(p)	do { } while (0)
+#define pci_request_regions(p, n) 0
+#define pci_release_regions(p)	do { } while (0)
+#define pci_set_master(p)	do { } while (0)
+#define pci_clear_master(p)	do { } while (0)
+#define pci_set_dma_mask(p, m)	0
+#define pci_set_consistent_dma_mask(p, m) 0
+#define pci_dev_get(p)		(p)
+#define pci_dev_put(p)		do { } while (0)
+#define pci_set_drvdata(p, d)	dev_set_drvdata(&(p)->dev, d)
+#define pci_get_drvdata(p)	dev_get_drvdata(&(p)->dev)
+void __iomem *pci_iomap(struct pci_dev *, int, unsigned long);
+#define pci_iounmap(p, a)	do { } while (0)
+
+dma_addr_t sim_dma_map(void *, size_t);
+void sim_dma_unmap(dma_addr_t);
+void *sim_dma_virt(dma_addr_t, size_t);
+#define pci_map_page(p, page, off, size, dir) \
+	sim_dma_map((char *) (page)->addr + (off), (size))
+#define pci_unmap_page(p, dma, size, dir) sim_dma_unmap(dma)
+#define pci_map_single(p, ptr, size, dir) sim_dma_map((ptr), (size))
+#define pci_unmap_single(p, dma, size, dir) sim_dma_unmap(dma)
+#define pci_dma_mapping_error(p, dma)	((dma) == 0)
+#define pci_dma_sync_single_for_device(p, dma, size, dir) smp_mb()
+#define pci_dma_sync_single_for_cpu(p, dma, size, dir) smp_mb()
+void *dma_alloc_coherent(struct device *, size_t, dma_addr_t *, gfp_t);
+void dma_free_coherent(struct device *, size_t, void *, dma_addr_t);
+
+struct dma_pool;
+struct dma_pool *dma_pool_create(const char *, struct device *, size_t,
+		size_t, size_t);
+void dma_pool_destroy(struct dma_pool *);
+void *dma_pool_alloc(struct dma_pool *, gfp_t, dma_addr_t *);
+void dma_pool_free(struct dma_pool *, void *, dma_addr_t);
+
+/* MMIO goes to the device model */
+u32 ioread32(const void __iomem *);
+void iowrite32(u32, void __iomem *);
+
+/* Interrupts, each line is served by its own thread */
+typedef enum irqreturn {
+	IRQ_NONE = 0,
+	IRQ_HANDLED = 1,
+	IRQ_WAKE_THREAD = 2,
+} irqreturn_t;
+
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+#define IRQF_SHARED		0x80
+int request_threaded_irq(unsigned int, irq_handler_t, irq_handler_t,
+		unsigned long, const char *, void *);
+void free_irq(unsigned int, void *);
+
+/* Software checksum */
+#define CRCPOLY_LE		0xedb88320
+u32 crc32_le(u32, unsigned char const *, size_t);
+
+#endif  // SIM_KERNEL_H_
@@ -0,0 +1,908 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sim_kernel.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+
+/* Kernel primitives of the simulator, the device model lives in device.c */
+
+int sim_loglevel = 4;
+
+int printk(const char *fmt, ...) {
+	va_list args;
+	int level = 4;
+	if (fmt[0] == '<' && fmt[1] >= '0' && fmt[1] <= '7' && fmt[2] == '>') {
+		level = fmt[1] - '0';
+		fmt += 3;
+	}
+	if (level > sim_loglevel)
+		return 0;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+	return 0;
+}
+
+void sim_bug(const char *file, int line) {
+	fprintf(stderr, "BUG at %s:%d\n", file, line);
+	abort();
+}
+
+int strict_strtoul(const char *cp, unsigned int base, unsigned long *res) {
+	char *end;
+	unsigned long val;
+	errno = 0;
+	val = strtoul(cp, &end, base);
+	if (errno || end == cp || (*end && !(*end == '\n' && !end[1])))
+		return -EINVAL;
+	*res = val;
+	return 0;
+}
+
+/* Time */
+u64 sim_clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+unsigned long sim_jiffies(void) {
+	return sim_clock_ns() / (NSEC_PER_SEC / HZ);
+}
+
+/* Condition variables wait on the monotonic clock */
+static void sim_cond_init(pthread_cond_t *cond) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* Returns 0 on timeout */
+static int sim_cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock,
+		u64 deadline) {
+	struct timespec ts;
+	ts.tv_sec = deadline / NSEC_PER_SEC;
+	ts.tv_nsec = deadline % NSEC_PER_SEC;
+	return pthread_cond_timedwait(cond, lock, &ts) != ETIMEDOUT;
+}
+
+/* Wait queues */
+void init_waitqueue_head(wait_queue_head_t *q) {
+	pthread_mutex_init(&q->lock, NULL);
+	sim_cond_init(&q->cond);
+	q->seq = 0;
+}
+
+void __wake_up(wait_queue_head_t *q) {
+	pthread_mutex_lock(&q->lock);
+	q->seq++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+unsigned long sim_wait_seq(wait_queue_head_t *q) {
+	unsigned long seq;
+	pthread_mutex_lock(&q->lock);
+	seq = q->seq;
+	pthread_mutex_unlock(&q->lock);
+	return seq;
+}
+
+int sim_wait_until(wait_queue_head_t *q, unsigned long seq, u64 timeout) {
+	u64 deadline = timeout ? sim_clock_ns() + timeout : 0;
+	int rv = 1;
+	pthread_mutex_lock(&q->lock);
+	while (q->seq == seq && rv) {
+		if (deadline)
+			rv = sim_cond_wait_until(&q->cond, &q->lock, deadline);
+		else
+			pthread_cond_wait(&q->cond, &q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return rv;
+}
+
+/* Completions */
+void complete(struct completion *x) {
+	__atomic_add_fetch(&x->done, 1, __ATOMIC_SEQ_CST);
+	__wake_up(&x->wait);
+}
+
+void complete_all(struct completion *x) {
+	__atomic_store_n(&x->done, SIM_COMPLETE_ALL, __ATOMIC_SEQ_CST);
+	__wake_up(&x->wait);
+}
+
+void wait_for_completion(struct completion *x) {
+	unsigned int done;
+	for (;;) {
+		wait_event(x->wait, completion_done(x));
+		done = __atomic_load_n(&x->done, __ATOMIC_SEQ_CST);
+		if (done == SIM_COMPLETE_ALL)
+			return;
+		if (done && __atomic_compare_exchange_n(&x->done, &done,
+					done - 1, 0, __ATOMIC_SEQ_CST,
+					__ATOMIC_SEQ_CST))
+			return;
+	}
+}
+
+/* Semaphores */
+void sema_init(struct semaphore *sem, int val) {
+	pthread_mutex_init(&sem->lock, NULL);
+	sim_cond_init(&sem->cond);
+	sem->count = val;
+}
+
+void down(struct semaphore *sem) {
+	pthread_mutex_lock(&sem->lock);
+	while (!sem->count)
+		pthread_cond_wait(&sem->cond, &sem->lock);
+	sem->count--;
+	pthread_mutex_unlock(&sem->lock);
+}
+
+int down_interruptible(struct semaphore *sem) {
+	down(sem);
+	return 0;
+}
+
+int down_trylock(struct semaphore *sem) {
+	int rv = 1;
+	pthread_mutex_lock(&sem->lock);
+	if (sem->count) {
+		sem->count--;
+		rv = 0;
+	}
+	pthread_mutex_unlock(&sem->lock);
+	return rv;
+}
+
+void up(struct semaphore *sem) {
+	pthread_mutex_lock(&sem->lock);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->lock);
+}
+
+/* SRCU */
+static int sim_srcu_slot(void) {
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : cpu % SIM_SRCU_SLOTS;
+}
+
+int init_srcu_struct(struct srcu_struct *sp) {
+	memset(sp->slots, 0, sizeof(sp->slots));
+	sp->completed = 0;
+	return pthread_mutex_init(&sp->mutex, NULL) ? -ENOMEM : 0;
+}
+
+void cleanup_srcu_struct(struct srcu_struct *sp) {
+	pthread_mutex_destroy(&sp->mutex);
+}
+
+int srcu_read_lock(struct srcu_struct *sp) {
+	int idx = __atomic_load_n(&sp->completed, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&sp->slots[sim_srcu_slot()].count[idx], 1,
+			__ATOMIC_SEQ_CST);
+	return idx;
+}
+
+void srcu_read_unlock(struct srcu_struct *sp, int idx) {
+	__atomic_sub_fetch(&sp->slots[sim_srcu_slot()].count[idx], 1,
+			__ATOMIC_SEQ_CST);
+}
+
+static long sim_srcu_readers(struct srcu_struct *sp, int idx) {
+	long sum = 0;
+	int slot;
+	for (slot = 0; slot < SIM_SRCU_SLOTS; slot++)
+		sum += __atomic_load_n(&sp->slots[slot].count[idx],
+				__ATOMIC_SEQ_CST);
+	return sum;
+}
+
+/* Two flips as in the kernel, a reader which got counted too late for both
+ * of them sees everything written before the call (all accesses are
+ * sequentially consistent), which is all the driver relies on */
+void synchronize_srcu(struct srcu_struct *sp) {
+	int flip, idx;
+	pthread_mutex_lock(&sp->mutex);
+	for (flip = 0; flip < 2; flip++) {
+		idx = __atomic_fetch_add(&sp->completed, 1, __ATOMIC_SEQ_CST)
+			& 1;
+		while (sim_srcu_readers(sp, idx))
+			usleep(100);
+	}
+	pthread_mutex_unlock(&sp->mutex);
+}
+
+/* Tasks, threads of the harness get their task_struct on first use */
+static struct mm_struct sim_mm;
+static pthread_once_t sim_mm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sim_task_key;
+static __thread struct task_struct *sim_task;
+
+static void sim_task_free(void *data) {
+	struct task_struct *t = data;
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->cond);
+	free(t);
+}
+
+static void sim_mm_init(void) {
+	init_rwsem(&sim_mm.mmap_sem);
+	pthread_key_create(&sim_task_key, sim_task_free);
+}
+
+static struct task_struct *sim_task_alloc(void) {
+	struct task_struct *t;
+	pthread_once(&sim_mm_once, sim_mm_init);
+	if (!(t = calloc(1, sizeof(*t))))
+		return NULL;
+	t->mm = &sim_mm;
+	t->state = TASK_RUNNING;
+	pthread_mutex_init(&t->lock, NULL);
+	sim_cond_init(&t->cond);
+	return t;
+}
+
+unsigned long rlimit(unsigned int resource) {
+	struct rlimit rlim;
+	if (getrlimit(resource, &rlim))
+		return 0;
+	return rlim.rlim_cur;
+}
+
+struct task_struct *sim_current(void) {
+	if (!sim_task) {
+		if (!(sim_task = sim_task_alloc()))
+			BUG();
+		pthread_setspecific(sim_task_key, sim_task);
+	}
+	return sim_task;
+}
+
+void set_current_state(int state) {
+	struct task_struct *t = current;
+	pthread_mutex_lock(&t->lock);
+	t->state = state;
+	pthread_mutex_unlock(&t->lock);
+}
+
+void schedule(void) {
+	struct task_struct *t = current;
+	pthread_mutex_lock(&t->lock);
+	while (t->state != TASK_RUNNING)
+		pthread_cond_wait(&t->cond, &t->lock);
+	pthread_mutex_unlock(&t->lock);
+}
+
+int schedule_hrtimeout(ktime_t *expires, enum hrtimer_mode mode) {
+	struct task_struct *t = current;
+	u64 deadline = ktime_to_ns(*expires);
+	int rv = 0;
+	if (mode == HRTIMER_MODE_REL)
+		deadline += sim_clock_ns();
+	pthread_mutex_lock(&t->lock);
+	while (t->state != TASK_RUNNING && sim_cond_wait_until(&t->cond,
+				&t->lock, deadline));
+	if (t->state == TASK_RUNNING)
+		rv = -EINTR;
+	t->state = TASK_RUNNING;
+	pthread_mutex_unlock(&t->lock);
+	return rv;
+}
+
+int signal_pending(struct task_struct *t) {
+	return 0;
+}
+
+static void *sim_kthread(void *data) {
+	struct task_struct *t = data;
+	sim_task = t;
+	t->result = t->threadfn(t->data);
+	return NULL;
+}
+
+struct task_struct *kthread_create(int (*threadfn)(void *), void *data,
+		const char *namefmt, ...) {
+	struct task_struct *t;
+	va_list args;
+	if (!(t = sim_task_alloc()))
+		return ERR_PTR(-ENOMEM);
+	t->threadfn = threadfn;
+	t->data = data;
+	va_start(args, namefmt);
+	vsnprintf(t->comm, sizeof(t->comm), namefmt, args);
+	va_end(args);
+	return t;
+}
+
+int wake_up_process(struct task_struct *t) {
+	int rv = 0;
+	pthread_mutex_lock(&t->lock);
+	if (t->threadfn && !t->started) {
+		if (pthread_create(&t->thread, NULL, sim_kthread, t))
+			BUG();
+		t->started = 1;
+	}
+	if (t->state != TASK_RUNNING) {
+		t->state = TASK_RUNNING;
+		pthread_cond_broadcast(&t->cond);
+		rv = 1;
+	}
+	pthread_mutex_unlock(&t->lock);
+	return rv;
+}
+
+int kthread_should_stop(void) {
+	return ACCESS_ONCE(current->should_stop);
+}
+
+int kthread_stop(struct task_struct *t) {
+	int rv = -EINTR;
+	pthread_mutex_lock(&t->lock);
+	t->should_stop = 1;
+	t->state = TASK_RUNNING;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	if (t->started) {
+		pthread_join(t->thread, NULL);
+		rv = t->result;
+	}
+	sim_task_free(t);
+	return rv;
+}
+
+/* Memory */
+struct sim_block {
+	void *mem;
+	struct page *pages;
+	int refs;
+};
+
+static void *sim_alloc_pages(size_t size) {
+	void *mem;
+	if (posix_memalign(&mem, PAGE_SIZE, PAGE_ALIGN(size)))
+		return NULL;
+	memset(mem, 0, PAGE_ALIGN(size));
+	return mem;
+}
+
+void *vmalloc(unsigned long size) {
+	return sim_alloc_pages(size);
+}
+
+void *vmalloc_user(unsigned long size) {
+	return sim_alloc_pages(size);
+}
+
+void vfree(const void *addr) {
+	free((void *) addr);
+}
+
+struct page *alloc_pages(gfp_t gfp, unsigned int order) {
+	struct sim_block *block;
+	int idx, count = 1 << order;
+	if (!(block = calloc(1, sizeof(*block))))
+		return NULL;
+	block->mem = sim_alloc_pages(PAGE_SIZE * count);
+	block->pages = calloc(count, sizeof(*block->pages));
+	if (!block->mem || !block->pages) {
+		free(block->mem);
+		free(block->pages);
+		free(block);
+		return NULL;
+	}
+	for (idx = 0; idx < count; idx++) {
+		block->pages[idx].addr = (char *) block->mem + idx * PAGE_SIZE;
+		block->pages[idx].block = block;
+	}
+	block->refs = count;
+	return block->pages;
+}
+
+void __free_page(struct page *page) {
+	struct sim_block *block = page->block;
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_SEQ_CST))
+		return;
+	free(block->mem);
+	free(block->pages);
+	free(block);
+}
+
+/* Pages of user memory are described on the fly */
+void put_page(struct page *page) {
+	if (page->block)
+		__free_page(page);
+	else
+		free(page);
+}
+
+int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
+		unsigned long start, int nr_pages, int write, int force,
+		struct page **pages, void *vmas) {
+	int idx;
+	for (idx = 0; idx < nr_pages; idx++) {
+		if (!(pages[idx] = calloc(1, sizeof(**pages))))
+			return idx ? idx : -ENOMEM;
+		pages[idx]->addr = (void *) (start + idx * PAGE_SIZE);
+	}
+	return nr_pages;
+}
+
+/* There is no address space to map into */
+int vm_insert_page(struct vm_area_struct *vma, unsigned long addr,
+		struct page *page) {
+	return -ENOSYS;
+}
+
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+		unsigned long pgoff) {
+	return -ENOSYS;
+}
+
+/* Software checksum */
+static u32 sim_crc32_table[256];
+
+static void __attribute__((constructor)) sim_crc32_init(void) {
+	u32 crc;
+	int idx, bit;
+	for (idx = 0; idx < 256; idx++) {
+		crc = idx;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRCPOLY_LE : 0);
+		sim_crc32_table[idx] = crc;
+	}
+}
+
+u32 crc32_le(u32 crc, unsigned char const *p, size_t len) {
+	while (len--)
+		crc = sim_crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/* DMA, bus addresses are handed out once and never reused, each mapping is
+ * followed by an unmapped guard page and keeps offset within page */
+struct sim_dma_region {
+	dma_addr_t bus;
+	size_t len;
+	char *host;
+	int live;
+};
+
+#define	SIM_DMA_BASE	0x00100000ULL
+#define	SIM_DMA_LIMIT	0x100000000ULL
+
+static pthread_mutex_t sim_dma_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_dma_region *sim_dma_regions;
+static size_t sim_dma_count, sim_dma_size;
+static u64 sim_dma_next = SIM_DMA_BASE;
+
+/* CRITICAL (sim_dma_lock), last region starting at or below bus */
+static struct sim_dma_region *sim_dma_find(dma_addr_t bus) {
+	size_t lo = 0, hi = sim_dma_count, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sim_dma_regions[mid].bus <= bus)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &sim_dma_regions[lo - 1] : NULL;
+}
+
+dma_addr_t sim_dma_map(void *ptr, size_t len) {
+	struct sim_dma_region *region;
+	size_t offset = (unsigned long) ptr & ~PAGE_MASK;
+	dma_addr_t bus = 0;
+	pthread_mutex_lock(&sim_dma_lock);
+	if (sim_dma_next + PAGE_ALIGN(offset + len) + PAGE_SIZE > SIM_DMA_LIMIT)
+		goto out;
+	if (sim_dma_count == sim_dma_size) {
+		size_t size = sim_dma_size ? sim_dma_size * 2 : 256;
+		region = realloc(sim_dma_regions, size * sizeof(*region));
+		if (!region)
+			goto out;
+		sim_dma_regions = region;
+		sim_dma_size = size;
+	}
+	bus = sim_dma_next + offset;
+	region = &sim_dma_regions[sim_dma_count++];
+	region->bus = bus;
+	region->len = len;
+	region->host = ptr;
+	region->live = 1;
+	sim_dma_next += PAGE_ALIGN(offset + len) + PAGE_SIZE;
+out:
+	pthread_mutex_unlock(&sim_dma_lock);
+	return bus;
+}
+
+void sim_dma_unmap(dma_addr_t bus) {
+	struct sim_dma_region *region;
+	pthread_mutex_lock(&sim_dma_lock);
+	region = sim_dma_find(bus);
+	if (!region || region->bus != bus || !region->live)
+		printk(KERN_ERR "sim: unmap of unknown bus address %x", bus);
+	else
+		region->live = 0;
+	pthread_mutex_unlock(&sim_dma_lock);
+}
+
+/* Host address of len bytes at bus, NULL if not mapped as a whole */
+void *sim_dma_virt(dma_addr_t bus, size_t len) {
+	struct sim_dma_region *region;
+	void *host = NULL;
+	pthread_mutex_lock(&sim_dma_lock);
+	region = sim_dma_find(bus);
+	if (region && region->live && bus - region->bus + len <= region->len)
+		host = region->host + (bus - region->bus);
+	pthread_mutex_unlock(&sim_dma_lock);
+	return host;
+}
+
+void *dma_alloc_coherent(struct device *dev, size_t size, dma_addr_t *dma,
+		gfp_t gfp) {
+	void *mem = sim_alloc_pages(size);
+	if (mem && !(*dma = sim_dma_map(mem, size))) {
+		free(mem);
+		mem = NULL;
+	}
+	return mem;
+}
+
+void dma_free_coherent(struct device *dev, size_t size, void *mem,
+		dma_addr_t dma) {
+	sim_dma_unmap(dma);
+	free(mem);
+}
+
+struct dma_pool {
+	size_t size;
+	size_t align;
+};
+
+struct dma_pool *dma_pool_create(const char *name, struct device *dev,
+		size_t size, size_t align, size_t boundary) {
+	struct dma_pool *pool;
+	if ((pool = calloc(1, sizeof(*pool)))) {
+		pool->size = size;
+		pool->align = max_t(size_t, align, sizeof(void *));
+	}
+	return pool;
+}
+
+void dma_pool_destroy(struct dma_pool *pool) {
+	free(pool);
+}
+
+void *dma_pool_alloc(struct dma_pool *pool, gfp_t gfp, dma_addr_t *dma) {
+	void *mem;
+	if (posix_memalign(&mem, pool->align, pool->size))
+		return NULL;
+	if (!(*dma = sim_dma_map(mem, pool->size))) {
+		free(mem);
+		return NULL;
+	}
+	return mem;
+}
+
+void dma_pool_free(struct dma_pool *pool, void *mem, dma_addr_t dma) {
+	sim_dma_unmap(dma);
+	free(mem);
+}
+
+/* Sysfs */
+static pthread_mutex_t sim_sysfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct device *sim_sysfs_devices;
+
+struct class *class_create(struct module *owner, const char *name) {
+	struct class *cls;
+	if ((cls = calloc(1, sizeof(*cls))))
+		cls->name = name;
+	return cls;
+}
+
+void class_destroy(struct class *cls) {
+	free(cls);
+}
+
+struct device *device_create(struct class *cls, struct device *parent,
+		dev_t devt, void *drvdata, const char *fmt, ...) {
+	struct device *dev;
+	va_list args;
+	if (!(dev = calloc(1, sizeof(*dev))))
+		return ERR_PTR(-ENOMEM);
+	va_start(args, fmt);
+	vsnprintf(dev->name, sizeof(dev->name), fmt, args);
+	va_end(args);
+	dev->devt = devt;
+	dev->parent = parent;
+	dev->driver_data = drvdata;
+	dev->numa_node = NUMA_NO_NODE;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	dev->next = sim_sysfs_devices;
+	sim_sysfs_devices = dev;
+	pthread_mutex_unlock(&sim_sysfs_lock);
+	return dev;
+}
+
+void device_destroy(struct class *cls, dev_t devt) {
+	struct device **pos, *dev = NULL;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	for (pos = &sim_sysfs_devices; *pos; pos = &(*pos)->next) {
+		if ((*pos)->devt == devt) {
+			dev = *pos;
+			*pos = dev->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_sysfs_lock);
+	free(dev);
+}
+
+int device_create_file(struct device *dev, struct device_attribute *attr) {
+	int idx, rv = -ENOSPC;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	for (idx = 0; idx < SIM_DEVICE_ATTRS; idx++) {
+		if (!dev->attrs[idx]) {
+			dev->attrs[idx] = attr;
+			rv = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sim_sysfs_lock);
+	return rv;
+}
+
+void device_remove_file(struct device *dev, struct device_attribute *attr) {
+	int idx;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	for (idx = 0; idx < SIM_DEVICE_ATTRS; idx++)
+		if (dev->attrs[idx] == attr)
+			dev->attrs[idx] = NULL;
+	pthread_mutex_unlock(&sim_sysfs_lock);
+}
+
+/* Attributes are looked up and used under sim_sysfs_lock, which makes
+ * removal wait for readers just like kernfs does */
+static struct device_attribute *sim_sysfs_find(const char *name,
+		const char *attr, struct device **devp) {
+	struct device *dev;
+	int idx;
+	for (dev = sim_sysfs_devices; dev; dev = dev->next) {
+		if (strcmp(dev->name, name))
+			continue;
+		for (idx = 0; idx < SIM_DEVICE_ATTRS; idx++) {
+			if (dev->attrs[idx] && !strcmp(
+						dev->attrs[idx]->attr.name, attr)) {
+				*devp = dev;
+				return dev->attrs[idx];
+			}
+		}
+	}
+	return NULL;
+}
+
+ssize_t sim_sysfs_read(const char *name, const char *attr, char *buf,
+		size_t len) {
+	struct device_attribute *da;
+	struct device *dev;
+	char page[PAGE_SIZE];
+	ssize_t rv = -ENOENT;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	if ((da = sim_sysfs_find(name, attr, &dev)))
+		rv = da->show ? da->show(dev, da, page) : -EACCES;
+	pthread_mutex_unlock(&sim_sysfs_lock);
+	if (rv >= 0 && len) {
+		rv = min_t(size_t, rv, len - 1);
+		memcpy(buf, page, rv);
+		buf[rv] = 0;
+	}
+	return rv;
+}
+
+int sim_sysfs_write(const char *name, const char *attr, const char *val) {
+	struct device_attribute *da;
+	struct device *dev;
+	ssize_t rv = -ENOENT;
+	pthread_mutex_lock(&sim_sysfs_lock);
+	if ((da = sim_sysfs_find(name, attr, &dev)))
+		rv = da->store ? da->store(dev, da, val, strlen(val)) :
+			-EACCES;
+	pthread_mutex_unlock(&sim_sysfs_lock);
+	return rv < 0 ? rv : 0;
+}
+
+long long sim_sysfs_value(const char *name, const char *attr) {
+	char buf[64];
+	if (sim_sysfs_read(name, attr, buf, sizeof(buf)) < 0)
+		return -1;
+	return strtoll(buf, NULL, 0);
+}
+
+/* Character devices, one major with minors up to the pooled one */
+#define	SIM_CHRDEV_MAJOR	240
+#define	SIM_CHRDEV_MINORS	(SIM_ANY_MINOR + 1)
+
+static pthread_mutex_t sim_chrdev_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cdev *sim_chrdevs[SIM_CHRDEV_MINORS];
+
+int alloc_chrdev_region(dev_t *dev, unsigned first, unsigned count,
+		const char *name) {
+	if (first + count > SIM_CHRDEV_MINORS)
+		return -EINVAL;
+	*dev = MKDEV(SIM_CHRDEV_MAJOR, first);
+	return 0;
+}
+
+void unregister_chrdev_region(dev_t dev, unsigned count) {
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops) {
+	memset(cdev, 0, sizeof(*cdev));
+	cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned count) {
+	unsigned minor;
+	if (MINOR(dev) + count > SIM_CHRDEV_MINORS)
+		return -EINVAL;
+	cdev->dev = dev;
+	cdev->count = count;
+	pthread_mutex_lock(&sim_chrdev_lock);
+	for (minor = MINOR(dev); minor < MINOR(dev) + count; minor++)
+		sim_chrdevs[minor] = cdev;
+	pthread_mutex_unlock(&sim_chrdev_lock);
+	return 0;
+}
+
+void cdev_del(struct cdev *cdev) {
+	unsigned minor;
+	pthread_mutex_lock(&sim_chrdev_lock);
+	for (minor = MINOR(cdev->dev); minor < MINOR(cdev->dev) + cdev->count;
+			minor++)
+		sim_chrdevs[minor] = NULL;
+	pthread_mutex_unlock(&sim_chrdev_lock);
+}
+
+loff_t no_llseek(struct file *filp, loff_t offset, int whence) {
+	return -ESPIPE;
+}
+
+/* Files, inode is private to each one */
+struct sim_file {
+	struct file file;
+	struct inode inode;
+};
+
+int sim_open(unsigned int minor, int flags, struct file **filpp) {
+	struct sim_file *sf;
+	struct cdev *cdev;
+	int rv;
+	if (minor >= SIM_CHRDEV_MINORS)
+		return -ENODEV;
+	if (!(sf = calloc(1, sizeof(*sf))))
+		return -ENOMEM;
+	/* Open of a char device races with its removal in the kernel too,
+	 * cdev stays allocated until the module is gone */
+	pthread_mutex_lock(&sim_chrdev_lock);
+	cdev = sim_chrdevs[minor];
+	pthread_mutex_unlock(&sim_chrdev_lock);
+	if (!cdev) {
+		free(sf);
+		return -ENODEV;
+	}
+	sf->inode.i_rdev = MKDEV(SIM_CHRDEV_MAJOR, minor);
+	sf->inode.i_cdev = cdev;
+	sf->file.f_flags = flags;
+	sf->file.f_op = cdev->ops;
+	sf->file.f_inode = &sf->inode;
+	if (sf->file.f_op->open && (rv = sf->file.f_op->open(&sf->inode,
+					&sf->file))) {
+		free(sf);
+		return rv;
+	}
+	*filpp = &sf->file;
+	return 0;
+}
+
+int sim_close(struct file *filp) {
+	struct sim_file *sf = container_of(filp, struct sim_file, file);
+	int rv = 0;
+	if (filp->f_op->release)
+		rv = filp->f_op->release(&sf->inode, filp);
+	free(sf);
+	return rv;
+}
+
+struct eventfd_ctx {
+	int fd;
+};
+
+struct eventfd_ctx *eventfd_ctx_fdget(int fd) {
+	struct eventfd_ctx *ctx;
+	if (!(ctx = malloc(sizeof(*ctx))))
+		return ERR_PTR(-ENOMEM);
+	if ((ctx->fd = dup(fd)) < 0) {
+		free(ctx);
+		return ERR_PTR(-EBADF);
+	}
+	return ctx;
+}
+
+void eventfd_ctx_put(struct eventfd_ctx *ctx) {
+	close(ctx->fd);
+	free(ctx);
+}
+
+int eventfd_signal(struct eventfd_ctx *ctx, int n) {
+	uint64_t val = n;
+	return write(ctx->fd, &val, sizeof(val)) == sizeof(val) ? n : 0;
+}
+
+ssize_t sim_write(struct file *filp, const void *buf, size_t count) {
+	if (!filp->f_op->write)
+		return -EINVAL;
+	return filp->f_op->write(filp, buf, count, &filp->f_pos);
+}
+
+ssize_t sim_writev(struct file *filp, const struct iovec *iov,
+		unsigned long nr_segs) {
+	struct kiocb iocb = { .ki_filp = filp, .ki_pos = filp->f_pos };
+	if (!filp->f_op->aio_write)
+		return -EINVAL;
+	return filp->f_op->aio_write(&iocb, iov, nr_segs, iocb.ki_pos);
+}
+
+int aio_complete(struct kiocb *iocb, long res, long res2) {
+	iocb->ki_res = res;
+	complete(&iocb->ki_done);
+	return 1;
+}
+
+/* Results other than -EIOCBQUEUED complete the iocb at once, just like the
+ * aio core does */
+struct kiocb *sim_aio_writev(struct file *filp, const struct iovec *iov,
+		unsigned long nr_segs) {
+	struct kiocb *iocb;
+	ssize_t rv = -EINVAL;
+	if (!(iocb = calloc(1, sizeof(*iocb))))
+		sim_bug(__FILE__, __LINE__);
+	iocb->ki_filp = filp;
+	iocb->ki_pos = filp->f_pos;
+	iocb->ki_async = 1;
+	init_completion(&iocb->ki_done);
+	if (filp->f_op->aio_write)
+		rv = filp->f_op->aio_write(iocb, iov, nr_segs, iocb->ki_pos);
+	if (rv != -EIOCBQUEUED)
+		aio_complete(iocb, rv, 0);
+	return iocb;
+}
+
+long sim_aio_wait(struct kiocb *iocb) {
+	long res;
+	wait_for_completion(&iocb->ki_done);
+	res = iocb->ki_res;
+	free(iocb);
+	return res;
+}
+
+long sim_ioctl(struct file *filp, unsigned int cmd, void *arg) {
+	if (!filp->f_op->unlocked_ioctl)
+		return -ENOTTY;
+	return filp->f_op->unlocked_ioctl(filp, cmd, (unsigned long) arg);
+}
+
+unsigned int sim_poll(struct file *filp) {
+	if (!filp->f_op->poll)
+		return 0;
+	return filp->f_op->poll(filp, NULL);
+}
@@ -0,0 +1,67 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+/* Harness side of the simulator: devices are added before the driver is
+ * loaded, files are opened by minor and driven through driver's
+ * file_operations just like syscalls would */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Minor of the pooled device */
+#define	SIM_ANY_MINOR		255
+
+struct file;
+struct kiocb;
+
+/* Device takes latency_ns for each command plus its length over
+ * bytes_per_sec (0 is infinitely fast) */
+struct sim_dev_params {
+	uint64_t latency_ns;
+	uint64_t bytes_per_sec;
+};
+
+struct sim_dev_stats {
+	uint64_t mmio_reads;
+	uint64_t mmio_writes;
+	uint64_t cmds;
+	uint64_t bytes;
+	uint64_t interrupts;
+	uint64_t faults;
+};
+
+int sim_device_add(const struct sim_dev_params *);
+/* Surprise removal while the driver is loaded */
+int sim_device_unplug(int);
+void sim_device_stats(int, struct sim_dev_stats *);
+void sim_device_free_all(void);
+
+/* Driver, defined by module_init(), module_exit() and module_param_named() */
+int sim_module_init(void);
+void sim_module_exit(void);
+void sim_param_buffers(unsigned long);
+
+/* Messages of higher level than this are dropped */
+extern int sim_loglevel;
+
+/* Syscalls, negative errno on failure */
+int sim_open(unsigned int, int, struct file **);
+int sim_close(struct file *);
+ssize_t sim_write(struct file *, const void *, size_t);
+ssize_t sim_writev(struct file *, const struct iovec *, unsigned long);
+/* Submits asynchronous write, sim_aio_wait() returns its result and frees
+ * the iocb */
+struct kiocb *sim_aio_writev(struct file *, const struct iovec *,
+		unsigned long);
+long sim_aio_wait(struct kiocb *);
+long sim_ioctl(struct file *, unsigned int, void *);
+unsigned int sim_poll(struct file *);
+
+/* Sysfs attributes of devices by name (crc0, crc1, ...) */
+ssize_t sim_sysfs_read(const char *, const char *, char *, size_t);
+int sim_sysfs_write(const char *, const char *, const char *);
+long long sim_sysfs_value(const char *, const char *);
+
+#endif  // SIM_H_
@@ -0,0 +1,73 @@
+#include <linux/module.h>
+#include <linux/crc32.h>
+#include "softcrc.h"
+
+MODULE_LICENSE("GPL");
+
+void crc_soft_table_init(u32 *table, u32 poly) {
+	u32 sum;
+	int i, bit;
+	for (i = 0; i < CRCDEV_SOFT_TABLE_SIZE; i++) {
+		sum = i;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+		table[i] = sum;
+	}
+}
+
+/* Table is not used for the standard polynomial, lib/crc32 is faster */
+u32 crc_soft_update(const u32 *table, u32 poly, u32 sum, const u8 *data,
+		size_t len) {
+	if (CRCPOLY_LE == poly)
+		return crc32_le(sum, data, len);
+	while (len--)
+		sum = table[(sum ^ *data++) & 0xff] ^ (sum >> 8);
+	return sum;
+}
+
+/* Operators on sums are 32x32 matrices over GF(2), one column per word */
+#define	CRCDEV_SOFT_GF2_DIM	32
+
+static u32 crc_soft_gf2_times(const u32 *mat, u32 vec) {
+	u32 sum = 0;
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+static void crc_soft_gf2_square(u32 *square, const u32 *mat) {
+	int n;
+	for (n = 0; n < CRCDEV_SOFT_GF2_DIM; n++)
+		square[n] = crc_soft_gf2_times(mat, mat[n]);
+}
+
+/* Shifts first sum by len2 zero bytes (by repeated squaring of one zero bit
+ * operator) and adds the second one, same as zlib's crc32_combine() */
+u32 crc_soft_combine(u32 sum1, u32 sum2, size_t len2, u32 poly) {
+	u32 even[CRCDEV_SOFT_GF2_DIM], odd[CRCDEV_SOFT_GF2_DIM], row = 1;
+	int n;
+	if (0 == len2)
+		return sum1 ^ sum2;
+	/* Operator for one zero bit */
+	odd[0] = poly;
+	for (n = 1; n < CRCDEV_SOFT_GF2_DIM; n++, row <<= 1)
+		odd[n] = row;
+	/* Two and four zero bits */
+	crc_soft_gf2_square(even, odd);
+	crc_soft_gf2_square(odd, even);
+	/* First square gives one zero byte, each next one doubles it */
+	do {
+		crc_soft_gf2_square(even, odd);
+		if (len2 & 1)
+			sum1 = crc_soft_gf2_times(even, sum1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+		crc_soft_gf2_square(odd, even);
+		if (len2 & 1)
+			sum1 = crc_soft_gf2_times(odd, sum1);
+		len2 >>= 1;
+	} while (len2);
+	return sum1 ^ sum2;
+}
@@ -0,0 +1,18 @@
+#ifndef SOFTCRC_H_
+#define SOFTCRC_H_
+
+#include <linux/types.h>
+
+/* Software implementation of device's checksum: reflected CRC32 with
+ * arbitrary polynomial, neither input nor output is inverted */
+#define	CRCDEV_SOFT_TABLE_SIZE	256
+
+void crc_soft_table_init(u32 *, u32);
+
+u32 crc_soft_update(const u32 *, u32, u32, const u8 *, size_t);
+
+/* Sum of concatenation given sum of the first part and sum of the second one
+ * computed from zero state */
+u32 crc_soft_combine(u32, u32, size_t, u32);
+
+#endif  // SOFTCRC_H_
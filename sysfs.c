@@ -7,6 +7,179 @@
 MODULE_LICENSE("GPL");
 
 static struct class *crc_sysfs_class = NULL;
+static struct device *crc_sysfs_any = NULL;
+
+/* Device statistics */
+#define CRC_SYSFS_STAT(name) \
+static ssize_t crc_sysfs_show_##name(struct device *dev, \
+		struct device_attribute *attr, char *buf) { \
+	struct crc_device *cdev = dev_get_drvdata(dev); \
+	return sprintf(buf, "%lld\n", (long long) \
+			atomic64_read(&cdev->stats.name)); \
+}
+
+CRC_SYSFS_STAT(mmio)
+CRC_SYSFS_STAT(cmds_submitted)
+CRC_SYSFS_STAT(bytes_submitted)
+CRC_SYSFS_STAT(cmds_done)
+CRC_SYSFS_STAT(irq_fetch_data)
+CRC_SYSFS_STAT(irq_cmd_nonfull)
+CRC_SYSFS_STAT(no_free_context)
+CRC_SYSFS_STAT(cmd_full)
+CRC_SYSFS_STAT(doorbells)
+CRC_SYSFS_STAT(bytes_done)
+CRC_SYSFS_STAT(ctx_loads)
+CRC_SYSFS_STAT(ctx_evictions)
+
+CRC_SYSFS_STAT(cpu_bytes)
+CRC_SYSFS_STAT(credit_limit_hits)
+CRC_SYSFS_STAT(poll_enter)
+CRC_SYSFS_STAT(poll_passes)
+
+/* Device tunables */
+#define CRC_SYSFS_TUNABLE(name) \
+static ssize_t crc_sysfs_show_##name(struct device *dev, \
+		struct device_attribute *attr, char *buf) { \
+	struct crc_device *cdev = dev_get_drvdata(dev); \
+	return sprintf(buf, "%u\n", ACCESS_ONCE(cdev->tun.name)); \
+} \
+static ssize_t crc_sysfs_store_##name(struct device *dev, \
+		struct device_attribute *attr, const char *buf, \
+		size_t count) { \
+	struct crc_device *cdev = dev_get_drvdata(dev); \
+	unsigned long val; \
+	if (strict_strtoul(buf, 0, &val) || val > UINT_MAX) \
+		return -EINVAL; \
+	ACCESS_ONCE(cdev->tun.name) = val; \
+	return count; \
+}
+
+CRC_SYSFS_TUNABLE(cpu_max)
+CRC_SYSFS_TUNABLE(cpu_busy_max)
+CRC_SYSFS_TUNABLE(stripe_min)
+CRC_SYSFS_TUNABLE(session_credits)
+CRC_SYSFS_TUNABLE(latency_stats)
+CRC_SYSFS_TUNABLE(poll_threshold)
+CRC_SYSFS_TUNABLE(poll_interval)
+CRC_SYSFS_TUNABLE(poll_budget)
+
+/* Tasks by state */
+#define CRC_SYSFS_OCCUPANCY(name) \
+static ssize_t crc_sysfs_show_##name(struct device *dev, \
+		struct device_attribute *attr, char *buf) { \
+	struct crc_device *cdev = dev_get_drvdata(dev); \
+	size_t tasks_free, tasks_waiting, tasks_scheduled; \
+	crc_device_occupancy(cdev, &tasks_free, &tasks_waiting, \
+			&tasks_scheduled); \
+	return sprintf(buf, "%lu\n", (unsigned long) name); \
+}
+
+CRC_SYSFS_OCCUPANCY(tasks_free)
+CRC_SYSFS_OCCUPANCY(tasks_waiting)
+CRC_SYSFS_OCCUPANCY(tasks_scheduled)
+
+/* Latency histogram, counts of buckets 2^n us wide in one line */
+static ssize_t crc_sysfs_show_latency_hist(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	struct crc_device *cdev = dev_get_drvdata(dev);
+	u64 buckets[CRCDEV_LAT_BUCKETS];
+	ssize_t len = 0;
+	int idx;
+	crc_device_latency(cdev, buckets);
+	for (idx = 0; idx < CRCDEV_LAT_BUCKETS; idx++)
+		len += sprintf(buf + len, "%llu%c", (unsigned long long)
+				buckets[idx], idx + 1 < CRCDEV_LAT_BUCKETS ?
+				' ' : '\n');
+	return len;
+}
+
+/* Pool of tasks, shrinking blocks until enough tasks are free */
+static ssize_t crc_sysfs_show_pool_size(struct device *dev,
+		struct device_attribute *attr, char *buf) {
+	struct crc_device *cdev = dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", (unsigned long)
+			ACCESS_ONCE(cdev->tasks_count));
+}
+
+static ssize_t crc_sysfs_store_pool_size(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count) {
+	struct crc_device *cdev = dev_get_drvdata(dev);
+	unsigned long val;
+	int rv;
+	if (strict_strtoul(buf, 0, &val))
+		return -EINVAL;
+	if ((rv = crc_device_pool_resize(cdev, val)))
+		return rv;
+	return count;
+}
+
+static struct device_attribute crc_sysfs_dev_attrs[] = {
+	__ATTR(mmio, S_IRUGO, crc_sysfs_show_mmio, NULL),
+	__ATTR(cmds_submitted, S_IRUGO, crc_sysfs_show_cmds_submitted, NULL),
+	__ATTR(bytes_submitted, S_IRUGO, crc_sysfs_show_bytes_submitted, NULL),
+	__ATTR(cmds_done, S_IRUGO, crc_sysfs_show_cmds_done, NULL),
+	__ATTR(irq_fetch_data, S_IRUGO, crc_sysfs_show_irq_fetch_data, NULL),
+	__ATTR(irq_cmd_nonfull, S_IRUGO, crc_sysfs_show_irq_cmd_nonfull,
+			NULL),
+	__ATTR(no_free_context, S_IRUGO, crc_sysfs_show_no_free_context,
+			NULL),
+	__ATTR(cmd_full, S_IRUGO, crc_sysfs_show_cmd_full, NULL),
+	__ATTR(doorbells, S_IRUGO, crc_sysfs_show_doorbells, NULL),
+	__ATTR(bytes_done, S_IRUGO, crc_sysfs_show_bytes_done, NULL),
+	__ATTR(ctx_loads, S_IRUGO, crc_sysfs_show_ctx_loads, NULL),
+	__ATTR(ctx_evictions, S_IRUGO, crc_sysfs_show_ctx_evictions, NULL),
+	__ATTR(cpu_bytes, S_IRUGO, crc_sysfs_show_cpu_bytes, NULL),
+	__ATTR(credit_limit_hits, S_IRUGO, crc_sysfs_show_credit_limit_hits,
+			NULL),
+	__ATTR(poll_enter, S_IRUGO, crc_sysfs_show_poll_enter, NULL),
+	__ATTR(poll_passes, S_IRUGO, crc_sysfs_show_poll_passes, NULL),
+	__ATTR(cpu_max, S_IRUGO | S_IWUSR, crc_sysfs_show_cpu_max,
+			crc_sysfs_store_cpu_max),
+	__ATTR(cpu_busy_max, S_IRUGO | S_IWUSR, crc_sysfs_show_cpu_busy_max,
+			crc_sysfs_store_cpu_busy_max),
+	__ATTR(stripe_min, S_IRUGO | S_IWUSR, crc_sysfs_show_stripe_min,
+			crc_sysfs_store_stripe_min),
+	__ATTR(session_credits, S_IRUGO | S_IWUSR,
+			crc_sysfs_show_session_credits,
+			crc_sysfs_store_session_credits),
+	__ATTR(pool_size, S_IRUGO | S_IWUSR, crc_sysfs_show_pool_size,
+			crc_sysfs_store_pool_size),
+	__ATTR(tasks_free, S_IRUGO, crc_sysfs_show_tasks_free, NULL),
+	__ATTR(tasks_waiting, S_IRUGO, crc_sysfs_show_tasks_waiting, NULL),
+	__ATTR(tasks_scheduled, S_IRUGO, crc_sysfs_show_tasks_scheduled,
+			NULL),
+	__ATTR(latency_stats, S_IRUGO | S_IWUSR,
+			crc_sysfs_show_latency_stats,
+			crc_sysfs_store_latency_stats),
+	__ATTR(latency_hist, S_IRUGO, crc_sysfs_show_latency_hist, NULL),
+	__ATTR(poll_threshold, S_IRUGO | S_IWUSR,
+			crc_sysfs_show_poll_threshold,
+			crc_sysfs_store_poll_threshold),
+	__ATTR(poll_interval, S_IRUGO | S_IWUSR,
+			crc_sysfs_show_poll_interval,
+			crc_sysfs_store_poll_interval),
+	__ATTR(poll_budget, S_IRUGO | S_IWUSR, crc_sysfs_show_poll_budget,
+			crc_sysfs_store_poll_budget),
+	__ATTR_NULL,
+};
+
+/* Removes first count attributes, all if count is negative */
+static void crc_sysfs_del_attrs(struct device *dev, int count) {
+	int idx;
+	for (idx = 0; crc_sysfs_dev_attrs[idx].attr.name && idx != count;
+			idx++)
+		device_remove_file(dev, &crc_sysfs_dev_attrs[idx]);
+}
+
+static int __must_check crc_sysfs_add_attrs(struct device *dev) {
+	int idx, rv = 0;
+	for (idx = 0; crc_sysfs_dev_attrs[idx].attr.name; idx++)
+		if ((rv = device_create_file(dev, &crc_sysfs_dev_attrs[idx])))
+			break;
+	if (rv)
+		crc_sysfs_del_attrs(dev, idx);
+	return rv;
+}
 
 int __must_check crc_sysfs_init(void) {
 	int rv = 0;
@@ -17,11 +190,30 @@ int __must_check crc_sysfs_init(void) {
 	} else if (IS_ERR(crc_sysfs_class)) {
 		rv = PTR_ERR(crc_sysfs_class);
 		crc_sysfs_class = NULL;
+	} else {
+		/* Pooled device has no attributes, these are added to each
+		 * crc_device separately */
+		crc_sysfs_any = device_create(crc_sysfs_class, NULL,
+				crc_chrdev_getdev_any(), NULL, CRCDEV_ANY_NAME);
+		if (!crc_sysfs_any) {
+			rv = -ENOMEM;
+		} else if (IS_ERR(crc_sysfs_any)) {
+			rv = PTR_ERR(crc_sysfs_any);
+			crc_sysfs_any = NULL;
+		}
+		if (rv) {
+			class_destroy(crc_sysfs_class);
+			crc_sysfs_class = NULL;
+		}
 	}
 	return rv;
 }
 
 void crc_sysfs_exit(void) {
+	if (crc_sysfs_any) {
+		device_destroy(crc_sysfs_class, crc_chrdev_getdev_any());
+		crc_sysfs_any = NULL;
+	}
 	if (crc_sysfs_class) {
 		class_destroy(crc_sysfs_class);
 		crc_sysfs_class = NULL;
@@ -39,12 +231,15 @@ int __must_check crc_sysfs_add(struct pci_dev *pdev, struct crc_device *cdev) {
 	} else if (IS_ERR(cdev->sysfs_dev)) {
 		rv = PTR_ERR(cdev->sysfs_dev);
 		cdev->sysfs_dev = NULL;
+	} else {
+		rv = crc_sysfs_add_attrs(cdev->sysfs_dev);
 	}
 	return rv;
 }
 
 void crc_sysfs_del(struct pci_dev *pdev, struct crc_device *cdev) {
 	if (cdev->sysfs_dev) {
+		crc_sysfs_del_attrs(cdev->sysfs_dev, -1);
 		device_destroy(crc_sysfs_class, crc_chrdev_getdev(cdev));
 	}
 }
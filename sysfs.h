@@ -4,6 +4,7 @@
 #include "concepts.h"
 
 #define CRCDEV_CLASS_NAME "crcdev"
+#define CRCDEV_ANY_NAME "crc-any"
 
 int __must_check crc_sysfs_init(void);
 
@@ -0,0 +1,71 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#define	PIECES	16
+
+char buf[0x400000];
+
+/* Native AIO without libaio: whole buffer is submitted at once in pieces
+ * which complete in order once the device has checksummed them */
+int main() {
+	struct iocb iocbs[PIECES], *list[PIECES];
+	struct io_event events[PIECES];
+	aio_context_t ctx = 0;
+	size_t piece = sizeof buf / PIECES;
+	int i, got = 0, res;
+	uint32_t sum;
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	if (syscall(SYS_io_setup, PIECES, &ctx)) {
+		perror("io_setup");
+		return 1;
+	}
+	memset(iocbs, 0, sizeof iocbs);
+	for (i = 0; i < PIECES; i++) {
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PWRITE;
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_buf = (uintptr_t) (buf + i * piece);
+		iocbs[i].aio_nbytes = piece;
+		iocbs[i].aio_data = i;
+		list[i] = &iocbs[i];
+	}
+	if (syscall(SYS_io_submit, ctx, PIECES, list) != PIECES) {
+		perror("io_submit");
+		return 1;
+	}
+	while (got < PIECES) {
+		res = syscall(SYS_io_getevents, ctx, 1, PIECES - got,
+				events + got, NULL);
+		if (res < 0) {
+			perror("io_getevents");
+			return 1;
+		}
+		got += res;
+	}
+	for (i = 0; i < PIECES; i++)
+		assert(events[i].res == piece);
+	syscall(SYS_io_destroy, ctx);
+	/* Everything is done, this does not wait */
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	sum ^= 0xffffffff;
+	printf("%08x\n", sum);
+	assert(sum == 0xc8402732);
+	return 0;
+}
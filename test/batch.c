@@ -0,0 +1,63 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define NDESCS 1000
+
+static uint32_t reference(uint32_t poly, uint32_t sum, const char *data,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+	}
+	return sum;
+}
+
+int main() {
+	static struct crcdev_ioctl_compute descs[NDESCS];
+	uint32_t polys[] = { 0xedb88320, 0x82f63b78 };
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	/* Mostly records, some of them long enough for the device */
+	int i;
+	for (i = 0; i < NDESCS; i++) {
+		descs[i].poly = polys[rand() % 2];
+		descs[i].sum = rand();
+		descs[i].len = (i % 10) ? rand() % 512 : rand() % 0x40000;
+		descs[i].addr = (uintptr_t) buf + rand() % (sizeof buf -
+				descs[i].len);
+	}
+	uint32_t init[NDESCS], done;
+	for (i = 0; i < NDESCS; i++)
+		init[i] = descs[i].sum;
+	if (crcdev_ioctl_compute_batch(fd, descs, NDESCS, &done)) {
+		perror("compute_batch");
+		return 1;
+	}
+	assert(done == NDESCS);
+	for (i = 0; i < NDESCS; i++)
+		assert(descs[i].sum == reference(descs[i].poly, init[i],
+					(const char *) (uintptr_t)
+					descs[i].addr, descs[i].len));
+	/* Bad address stops the batch, prefix is reported */
+	descs[NDESCS / 2].addr = 0;
+	descs[NDESCS / 2].len = 0x100;
+	if (crcdev_ioctl_compute_batch(fd, descs, NDESCS, &done)) {
+		perror("compute_batch");
+		return 1;
+	}
+	assert(done == NDESCS / 2);
+	printf("%u\n", done);
+	return 0;
+}
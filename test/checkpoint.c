@@ -0,0 +1,57 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define	PREFIX	0x200000
+
+char buf[0x400000];
+
+static uint32_t reference(uint32_t poly, uint32_t sum, const char *data,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+	}
+	return sum;
+}
+
+/* Common prefix is checksummed once, variants continue from its checkpoint
+ * in any order */
+int main() {
+	size_t sizes[] = { 1, 200, 0x4000, 0x10001, 0x100000 };
+	uint32_t prefix, sum;
+	int i;
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	if (crcdev_ioctl_set_params(fd, 0x82f63b78, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	assert(crcdev_ioctl_checkpoint_restore(fd, 0) < 0);
+	if (write(fd, buf, PREFIX) != PREFIX ||
+			crcdev_ioctl_checkpoint_save(fd, 0)) {
+		perror("prefix");
+		return 1;
+	}
+	prefix = reference(0x82f63b78, 0xffffffff, buf, PREFIX);
+	for (i = sizeof sizes / sizeof *sizes - 1; i >= 0; i--) {
+		if (crcdev_ioctl_checkpoint_restore(fd, 0) ||
+				write(fd, buf + PREFIX + i, sizes[i]) !=
+				sizes[i] || crcdev_ioctl_get_result(fd, &sum)) {
+			perror("variant");
+			return 1;
+		}
+		assert(sum == reference(0x82f63b78, prefix, buf + PREFIX + i,
+					sizes[i]));
+	}
+	printf("%08x\n", prefix ^ 0xffffffff);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+static uint32_t reference(uint32_t poly, uint32_t sum, const char *data,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+	}
+	return sum;
+}
+
+int main() {
+	size_t sizes[] = { 0, 1, 64, 256, 1000, 0x4000, 0x10001, 0x100000 };
+	uint32_t polys[] = { 0xedb88320, 0x82f63b78 };
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	/* Session's own data is queued around one-shot requests */
+	if (write(fd, buf, sizeof buf / 2) != sizeof buf / 2) {
+		perror("write");
+		return 1;
+	}
+	int i, p;
+	uint32_t sum;
+	for (i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		for (p = 0; p < 2; p++) {
+			sum = 0xffffffff;
+			if (crcdev_ioctl_compute(fd, polys[p], &sum, buf + 3,
+						sizes[i])) {
+				perror("compute");
+				return 1;
+			}
+			assert(sum == reference(polys[p], 0xffffffff, buf + 3,
+						sizes[i]));
+		}
+	}
+	if (write(fd, buf + sizeof buf / 2, sizeof buf / 2) !=
+			sizeof buf / 2) {
+		perror("write");
+		return 1;
+	}
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	sum ^= 0xffffffff;
+	printf("%08x\n", sum);
+	assert(sum == 0xc8402732);
+	return 0;
+}
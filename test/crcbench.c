@@ -0,0 +1,469 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+/* Throughput and latency benchmark, prints one JSON object or CSV row per
+ * run so results can be compared between driver versions */
+
+#define MAX_DEVICES 16
+#define MAX_SESSIONS 256
+
+char buf[0x400000];
+
+static const char *devices[MAX_DEVICES];
+static int ndevices;
+static size_t chunk_min = 0x10000, chunk_max = 0x10000;
+static enum { DIST_FIXED, DIST_UNIFORM, DIST_LOG } dist = DIST_FIXED;
+static int nthreads = 1, nsessions = 1;
+static unsigned long long total = 256ULL << 20;
+static unsigned int result_every = 16, reopen_every;
+/* Threads use libcrcdev streams or one-shot COMPUTE instead of writes */
+static int use_stream, use_compute;
+static const char *label = "";
+
+struct samples {
+	float *val;
+	size_t len, cap;
+};
+
+struct worker {
+	pthread_t thr;
+	int id;
+	unsigned short state[3];
+	unsigned long long bytes, writes, results, opens;
+	struct samples write_lat, result_lat;
+	int failed;
+};
+
+static void record(struct samples *s, double usec) {
+	if (s->len == s->cap) {
+		size_t cap = s->cap ? 2 * s->cap : 4096;
+		float *val = realloc(s->val, cap * sizeof(*val));
+		/* Dropped samples would skew percentiles */
+		if (!val) {
+			perror("realloc");
+			exit(1);
+		}
+		s->val = val;
+		s->cap = cap;
+	}
+	s->val[s->len++] = usec;
+}
+
+/* JSON string contents, caller frees */
+static char *json_escape(const char *in) {
+	char *out = malloc(6 * strlen(in) + 1), *p = out;
+	if (!out) {
+		perror("malloc");
+		exit(1);
+	}
+	for (; *in; in++) {
+		if (*in == '"' || *in == '\\')
+			p += sprintf(p, "\\%c", *in);
+		else if ((unsigned char) *in < 0x20)
+			p += sprintf(p, "\\u%04x", *in);
+		else
+			*p++ = *in;
+	}
+	*p = 0;
+	return out;
+}
+
+static void merge(struct samples *dst, struct samples *src) {
+	size_t i;
+	for (i = 0; i < src->len; i++)
+		record(dst, src->val[i]);
+	free(src->val);
+	memset(src, 0, sizeof(*src));
+}
+
+static int cmp_float(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Samples must be sorted, per mille of 0 is minimum */
+static double percentile(struct samples *s, unsigned int per_mille) {
+	if (!s->len)
+		return 0;
+	return s->val[(s->len - 1) * per_mille / 1000];
+}
+
+static const char *dist_names[] = { "fixed", "uniform", "log" };
+
+static int bits(size_t val) {
+	int n = 0;
+	while (val >>= 1)
+		n++;
+	return n;
+}
+
+static size_t chunk(struct worker *w) {
+	size_t len;
+	int shift;
+	switch (dist) {
+	case DIST_UNIFORM:
+		return chunk_min + nrand48(w->state) % (chunk_max - chunk_min
+				+ 1);
+	case DIST_LOG:
+		/* Power of two range first, then uniformly within it */
+		shift = bits(chunk_min) + nrand48(w->state) %
+			(bits(chunk_max) - bits(chunk_min) + 1);
+		len = ((size_t) 1 << shift) + nrand48(w->state) %
+			((size_t) 1 << shift);
+		return len < chunk_min ? chunk_min : len > chunk_max ?
+			chunk_max : len;
+	default:
+		return chunk_min;
+	}
+}
+
+static int session_open(struct worker *w, int idx) {
+	const char *path = devices[(w->id * nsessions + idx) % ndevices];
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		close(fd);
+		return -1;
+	}
+	w->opens++;
+	return fd;
+}
+
+static int session_result(struct worker *w, int fd) {
+	uint32_t sum;
+	double start = now();
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return -1;
+	}
+	record(&w->result_lat, (now() - start) * 1e6);
+	w->results++;
+	return 0;
+}
+
+/* Update latency is recorded as write latency and final as result one */
+static void *stream_main(struct worker *w) {
+	struct crcdev_stream_params params = { 0 };
+	struct crcdev_stream *stream;
+	unsigned long long quota = total / nthreads;
+	size_t len, offset = 0;
+	uint32_t sum;
+	double start;
+	/* Without devices given library picks one or falls back to CPU */
+	params.device = ndevices ? devices[w->id % ndevices] : NULL;
+	params.sessions = nsessions;
+	if (!(stream = crcdev_stream_init(0xedb88320, 0xffffffff, &params))) {
+		perror("stream_init");
+		w->failed = 1;
+		return NULL;
+	}
+	w->opens += nsessions;
+	while (w->bytes < quota) {
+		len = chunk(w);
+		if (len > quota - w->bytes)
+			len = quota - w->bytes;
+		if (offset + len > sizeof buf)
+			offset = 0;
+		start = now();
+		if (crcdev_stream_update(stream, buf + offset, len)) {
+			perror("stream_update");
+			crcdev_stream_final(stream, &sum);
+			w->failed = 1;
+			return NULL;
+		}
+		record(&w->write_lat, (now() - start) * 1e6);
+		w->bytes += len;
+		w->writes++;
+		offset += len;
+	}
+	start = now();
+	if (crcdev_stream_final(stream, &sum)) {
+		perror("stream_final");
+		w->failed = 1;
+		return NULL;
+	}
+	record(&w->result_lat, (now() - start) * 1e6);
+	w->results++;
+	return NULL;
+}
+
+void *tmain(void *arg) {
+	struct worker *w = arg;
+	int fd[MAX_SESSIONS];
+	unsigned int writes[MAX_SESSIONS], results[MAX_SESSIONS];
+	unsigned long long quota = total / nthreads;
+	size_t len, offset = 0;
+	double start;
+	ssize_t res;
+	uint32_t sum;
+	int i = 0;
+	if (use_stream)
+		return stream_main(w);
+	for (i = 0; i < nsessions; i++) {
+		writes[i] = results[i] = 0;
+		if ((fd[i] = session_open(w, i)) < 0)
+			goto fail;
+	}
+	for (i = 0; w->bytes < quota; i = (i + 1) % nsessions) {
+		len = chunk(w);
+		if (len > quota - w->bytes)
+			len = quota - w->bytes;
+		if (offset + len > sizeof buf)
+			offset = 0;
+		start = now();
+		if (use_compute) {
+			sum = 0xffffffff;
+			if (crcdev_ioctl_compute(fd[i], 0xedb88320, &sum,
+						buf + offset, len)) {
+				perror("compute");
+				goto fail_all;
+			}
+			res = len;
+		} else if ((res = write(fd[i], buf + offset, len)) <= 0) {
+			perror("write");
+			goto fail_all;
+		}
+		record(&w->write_lat, (now() - start) * 1e6);
+		w->bytes += res;
+		w->writes++;
+		offset += res;
+		if (result_every && ++writes[i] % result_every == 0) {
+			if (session_result(w, fd[i]))
+				goto fail_all;
+			if (reopen_every && ++results[i] % reopen_every == 0) {
+				close(fd[i]);
+				if ((fd[i] = session_open(w, i)) < 0)
+					goto fail_all;
+			}
+		}
+	}
+	for (i = 0; i < nsessions; i++) {
+		if (session_result(w, fd[i]))
+			goto fail_all;
+		close(fd[i]);
+	}
+	return NULL;
+fail_all:
+	i = nsessions;
+fail:
+	while (i-- > 0)
+		if (fd[i] >= 0)
+			close(fd[i]);
+	w->failed = 1;
+	return NULL;
+}
+
+static const char *api_name(void) {
+	return use_stream ? "stream" : use_compute ? "compute" : "write";
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-d device]... [-c min[:max]] "
+			"[-D fixed|uniform|log] [-t threads] [-s sessions]\n"
+			"\t[-b total MB] [-g writes per result] "
+			"[-o results per reopen] [-f json|csv|csvrow] "
+			"[-l label] [-S | -C]\n", prog);
+	exit(2);
+}
+
+static double seconds(struct timeval tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv) {
+	enum { FMT_JSON, FMT_CSV, FMT_CSVROW } fmt = FMT_JSON;
+	struct worker *w;
+	struct samples write_lat = { 0 }, result_lat = { 0 };
+	unsigned long long bytes = 0, writes = 0, results = 0, opens = 0;
+	struct rusage ru0, ru1;
+	double start, elapsed, cpu, gb;
+	char *sep;
+	int opt, i, failed = 0;
+	while ((opt = getopt(argc, argv, "d:c:D:t:s:b:g:o:f:l:SC")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (ndevices == MAX_DEVICES)
+				usage(argv[0]);
+			devices[ndevices++] = optarg;
+			break;
+		case 'c':
+			chunk_min = chunk_max = strtoul(optarg, &sep, 0);
+			if (*sep == ':')
+				chunk_max = strtoul(sep + 1, NULL, 0);
+			if (dist == DIST_FIXED && chunk_max != chunk_min)
+				dist = DIST_UNIFORM;
+			break;
+		case 'D':
+			if (!strcmp(optarg, "fixed"))
+				dist = DIST_FIXED;
+			else if (!strcmp(optarg, "uniform"))
+				dist = DIST_UNIFORM;
+			else if (!strcmp(optarg, "log"))
+				dist = DIST_LOG;
+			else
+				usage(argv[0]);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			nsessions = atoi(optarg);
+			break;
+		case 'b':
+			total = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'g':
+			result_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			reopen_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				fmt = FMT_JSON;
+			else if (!strcmp(optarg, "csv"))
+				fmt = FMT_CSV;
+			else if (!strcmp(optarg, "csvrow"))
+				fmt = FMT_CSVROW;
+			else
+				usage(argv[0]);
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		case 'S':
+			use_stream = 1;
+			break;
+		case 'C':
+			use_compute = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || nthreads < 1 || nsessions < 1 ||
+			nsessions > MAX_SESSIONS || !chunk_min ||
+			chunk_max < chunk_min || chunk_max > sizeof buf ||
+			total < nthreads ||
+			(use_stream && use_compute))
+		usage(argv[0]);
+	if (!ndevices && !use_stream)
+		devices[ndevices++] = "/dev/crc0";
+	if (!(w = calloc(nthreads, sizeof(*w)))) {
+		perror("calloc");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	getrusage(RUSAGE_SELF, &ru0);
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		w[i].id = i;
+		w[i].state[0] = i;
+		w[i].state[1] = 0x5678;
+		w[i].state[2] = 0x9abc;
+		if (pthread_create(&w[i].thr, NULL, tmain, &w[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(w[i].thr, NULL)) {
+			perror("pthread_join");
+			return 1;
+		}
+		failed |= w[i].failed;
+		bytes += w[i].bytes;
+		writes += w[i].writes;
+		results += w[i].results;
+		opens += w[i].opens;
+		merge(&write_lat, &w[i].write_lat);
+		merge(&result_lat, &w[i].result_lat);
+	}
+	elapsed = now() - start;
+	getrusage(RUSAGE_SELF, &ru1);
+	if (failed)
+		return 1;
+	/* System time includes work done in syscalls on our behalf, interrupt
+	 * handling and kernel threads are not accounted */
+	cpu = seconds(ru1.ru_utime) - seconds(ru0.ru_utime) +
+		seconds(ru1.ru_stime) - seconds(ru0.ru_stime);
+	gb = bytes / (double) (1 << 30);
+	qsort(write_lat.val, write_lat.len, sizeof(float), cmp_float);
+	qsort(result_lat.val, result_lat.len, sizeof(float), cmp_float);
+	if (fmt == FMT_JSON) {
+		char *jlabel = json_escape(label);
+		char *jdevice = json_escape(ndevices ? devices[0] : "auto");
+		printf("{\"label\": \"%s\", \"device\": \"%s\", "
+				"\"devices\": %d, \"chunk_min\": %zu, "
+				"\"chunk_max\": %zu, \"dist\": \"%s\", "
+				"\"threads\": %d, \"sessions\": %d, "
+				"\"result_every\": %u, \"reopen_every\": %u, "
+				"\"api\": \"%s\",\n",
+				jlabel, jdevice, ndevices, chunk_min,
+				chunk_max, dist_names[dist], nthreads,
+				nsessions, result_every, reopen_every,
+				api_name());
+		printf(" \"bytes\": %llu, \"writes\": %llu, "
+				"\"results\": %llu, \"opens\": %llu, "
+				"\"seconds\": %.6f, \"mb_per_s\": %.2f, "
+				"\"ops_per_s\": %.1f, "
+				"\"cpu_s_per_gb\": %.4f,\n",
+				bytes, writes, results, opens, elapsed,
+				bytes / elapsed / (1 << 20), writes / elapsed,
+				cpu / gb);
+		printf(" \"write_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+				"\"p999\": %.1f, \"max\": %.1f},\n",
+				percentile(&write_lat, 500),
+				percentile(&write_lat, 990),
+				percentile(&write_lat, 999),
+				percentile(&write_lat, 1000));
+		printf(" \"result_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+				"\"p999\": %.1f, \"max\": %.1f}}\n",
+				percentile(&result_lat, 500),
+				percentile(&result_lat, 990),
+				percentile(&result_lat, 999),
+				percentile(&result_lat, 1000));
+		free(jlabel);
+		free(jdevice);
+	} else {
+		if (fmt == FMT_CSV)
+			printf("label,device,devices,chunk_min,chunk_max,dist,"
+					"threads,sessions,result_every,"
+					"reopen_every,api,bytes,writes,results,"
+					"opens,seconds,mb_per_s,ops_per_s,"
+					"cpu_s_per_gb,write_p50,write_p99,"
+					"write_p999,write_max,result_p50,"
+					"result_p99,result_p999,result_max\n");
+		printf("%s,%s,%d,%zu,%zu,%s,%d,%d,%u,%u,%s,%llu,%llu,%llu,"
+				"%llu,%.6f,%.2f,%.1f,%.4f,%.1f,%.1f,%.1f,%.1f,"
+				"%.1f,%.1f,%.1f,%.1f\n", label,
+				ndevices ? devices[0] : "auto", ndevices,
+				chunk_min, chunk_max, dist_names[dist],
+				nthreads, nsessions, result_every, reopen_every,
+				api_name(), bytes, writes,
+				results, opens, elapsed,
+				bytes / elapsed / (1 << 20), writes / elapsed,
+				cpu / gb, percentile(&write_lat, 500),
+				percentile(&write_lat, 990),
+				percentile(&write_lat, 999),
+				percentile(&write_lat, 1000),
+				percentile(&result_lat, 500),
+				percentile(&result_lat, 990),
+				percentile(&result_lat, 999),
+				percentile(&result_lat, 1000));
+	}
+	free(write_lat.val);
+	free(result_lat.val);
+	free(w);
+	return 0;
+}
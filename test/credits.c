@@ -0,0 +1,139 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+/* Bulk writer has a whole pool worth of data in flight at any time, small
+ * writer must not wait for all of it */
+#define NRUNS 8
+#define NSMALL 64
+#define SMALLSIZE 0x4000
+#define SYSFS "/sys/class/crcdev/crc0/"
+
+static volatile int bulk_done = 0, sampling = 0;
+static long long held_max = 0;
+
+static long long sysfs_value(const char *attr) {
+	char path[128];
+	long long val = -1;
+	FILE *f;
+	snprintf(path, sizeof path, SYSFS "%s", attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%lld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static void *bulk(void *arg) {
+	int fd = *(int *) arg;
+	int i, failures = 0;
+	for (i = 0; i < NRUNS; i++) {
+		if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+			perror("set_params");
+			return NULL;
+		}
+		if (write(fd, buf, sizeof buf) != sizeof buf) {
+			perror("write");
+			return NULL;
+		}
+		uint32_t sum;
+		if (crcdev_ioctl_get_result(fd, &sum)) {
+			perror("get_result");
+			return NULL;
+		}
+		failures += ((sum ^ 0xffffffff) != 0xc8402732);
+	}
+	assert(failures == 0);
+	bulk_done = 1;
+	return NULL;
+}
+
+/* Tasks out of the free list, sampled while the striped write runs */
+static void *sampler(void *arg) {
+	long long held;
+	while (sampling) {
+		held = sysfs_value("pool_size") - sysfs_value("tasks_free");
+		if (held > held_max)
+			held_max = held;
+	}
+	return NULL;
+}
+
+int main() {
+	int bulk_fd, fd, i;
+	pthread_t thread;
+	gen(buf, sizeof buf);
+	bulk_fd = open("/dev/crc0", O_RDWR);
+	fd = open("/dev/crc0", O_RDWR);
+	if (bulk_fd < 0 || fd < 0) {
+		perror("open");
+		return 1;
+	}
+	/* Reserved field must be zero */
+	struct crcdev_ioctl_set_credits bad = { 1, 1 };
+	assert(ioctl(fd, CRCDEV_IOCTL_SET_CREDITS, &bad) < 0 &&
+			errno == EINVAL);
+	/* Bulk writer gets two buffers, small one is left with the default */
+	if (crcdev_ioctl_set_credits(bulk_fd, 2)) {
+		perror("set_credits");
+		return 1;
+	}
+	long long hits = sysfs_value("credit_limit_hits");
+	pthread_create(&thread, NULL, bulk, &bulk_fd);
+	double worst = 0;
+	uint32_t first = 0;
+	for (i = 0; i < NSMALL && !bulk_done; i++) {
+		double start = now();
+		if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+			perror("set_params");
+			return 1;
+		}
+		if (write(fd, buf, SMALLSIZE) != SMALLSIZE) {
+			perror("write");
+			return 1;
+		}
+		uint32_t sum;
+		if (crcdev_ioctl_get_result(fd, &sum)) {
+			perror("get_result");
+			return 1;
+		}
+		if (i == 0)
+			first = sum;
+		assert(sum == first);
+		if (now() - start > worst)
+			worst = now() - start;
+	}
+	pthread_join(thread, NULL);
+	printf("%d small writes, worst latency %.3f ms\n", i, worst * 1e3);
+	if (hits >= 0)
+		printf("credit limit hits: %lld\n",
+				sysfs_value("credit_limit_hits") - hits);
+	assert(crcdev_ioctl_set_credits(bulk_fd, 0) == 0);
+	/* Stripes of a large write are charged to the session, all of them
+	 * together hold no more tasks than it is allowed to */
+	long long limit = sysfs_value("session_credits");
+	if (limit > 0) {
+		sampling = 1;
+		pthread_create(&thread, NULL, sampler, NULL);
+		assert(crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)
+				== 0);
+		assert(write(fd, buf, sizeof buf) == sizeof buf);
+		sampling = 0;
+		pthread_join(thread, NULL);
+		printf("striped write held at most %lld of %lld tasks\n",
+				held_max, limit);
+		assert(held_max <= limit);
+	}
+	close(bulk_fd);
+	close(fd);
+	return 0;
+}
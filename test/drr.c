@@ -0,0 +1,90 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+/* Three times as many sessions as device has contexts, with interleaved
+ * writes most of the queued tasks belong to sessions without a context;
+ * baseline writes the same amount of data in turns of NCTX sessions, each
+ * with a context of its own, so that DRR has nothing to do */
+#define NMUX 12
+#define NCTX 4
+#define CHUNKSIZE 0x4000
+
+/* Sessions write the whole buffer each in interleaved chunks, returns
+ * seconds taken */
+static double run(int nsess) {
+	int fd[NMUX];
+	int pos[NMUX] = { 0 };
+	int i, failures = 0;
+	for (i = 0; i < nsess; i++) {
+		fd[i] = open("/dev/crc0", O_RDWR);
+		if (fd[i] < 0) {
+			perror("open");
+			return -1;
+		}
+		if (crcdev_ioctl_set_params(fd[i], 0xedb88320, 0xffffffff)) {
+			perror("set_params");
+			return -1;
+		}
+	}
+	double start = now();
+	while (1) {
+		int nfree = 0;
+		for (i = 0; i < nsess; i++) {
+			if (pos[i] == sizeof buf) {
+				nfree++;
+				continue;
+			}
+			size_t len = rand() % CHUNKSIZE + 1;
+			if (pos[i] + len > sizeof buf)
+				len = sizeof buf - pos[i];
+			if (write(fd[i], buf + pos[i], len) != len) {
+				perror("write");
+				return -1;
+			}
+			pos[i] += len;
+		}
+		if (nfree == nsess)
+			break;
+	}
+	for (i = 0; i < nsess; i++) {
+		uint32_t sum;
+		if (crcdev_ioctl_get_result(fd[i], &sum)) {
+			perror("get_result");
+			return -1;
+		}
+		sum ^= 0xffffffff;
+		printf("%08x\n", sum);
+		failures += (sum != 0xc8402732);
+	}
+	double elapsed = now() - start;
+	for (i = 0; i < nsess; i++)
+		close(fd[i]);
+	assert(failures == 0);
+	return elapsed;
+}
+
+int main() {
+	int i;
+	gen(buf, sizeof buf);
+	double elapsed = run(NMUX);
+	if (elapsed < 0)
+		return 1;
+	double drr = NMUX * sizeof buf / elapsed / (1 << 20);
+	printf("%d sessions: %.2f MB/s\n", NMUX, drr);
+	double serial = 0;
+	for (i = 0; i < NMUX / NCTX; i++) {
+		if ((elapsed = run(NCTX)) < 0)
+			return 1;
+		serial += elapsed;
+	}
+	double base = NMUX * sizeof buf / serial / (1 << 20);
+	printf("%d x %d sessions: %.2f MB/s, speedup %.2fx\n", NMUX / NCTX,
+			NCTX, base, drr / base);
+	return 0;
+}
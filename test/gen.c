@@ -1,5 +1,6 @@
 #include "test.h"
 #include <stdlib.h>
+#include <time.h>
 
 void gen(char *buf, size_t len) {
 	unsigned short state[3];
@@ -11,3 +12,9 @@ void gen(char *buf, size_t len) {
 		buf[i] = jrand48(state);
 	}
 }
+
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,93 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+/* Small writes of several sessions keep completion rate high */
+#define NMUX 4
+#define CHUNKSIZE 0x4000
+#define SYSFS "/sys/class/crcdev/crc0/"
+
+static long long attr_read(const char *name) {
+	long long val = -1;
+	FILE *f = fopen(name, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%lld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static int attr_write(const char *name, long long val) {
+	FILE *f = fopen(name, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "%lld\n", val);
+	return fclose(f);
+}
+
+/* Interleaved writes of NMUX sessions, returns MB/s */
+static double run(void) {
+	int fd[NMUX];
+	int i, failures = 0;
+	size_t pos;
+	for (i = 0; i < NMUX; i++) {
+		fd[i] = open("/dev/crc0", O_RDWR);
+		if (fd[i] < 0) {
+			perror("open");
+			return -1;
+		}
+		if (crcdev_ioctl_set_params(fd[i], 0xedb88320, 0xffffffff)) {
+			perror("set_params");
+			return -1;
+		}
+	}
+	double start = now();
+	for (pos = 0; pos < sizeof buf; pos += CHUNKSIZE)
+		for (i = 0; i < NMUX; i++)
+			if (write(fd[i], buf + pos, CHUNKSIZE) != CHUNKSIZE) {
+				perror("write");
+				return -1;
+			}
+	for (i = 0; i < NMUX; i++) {
+		uint32_t sum;
+		if (crcdev_ioctl_get_result(fd[i], &sum)) {
+			perror("get_result");
+			return -1;
+		}
+		failures += ((sum ^ 0xffffffff) != 0xc8402732);
+		close(fd[i]);
+	}
+	assert(failures == 0);
+	return NMUX * sizeof buf / (now() - start) / (1 << 20);
+}
+
+int main() {
+	gen(buf, sizeof buf);
+	long long threshold = attr_read(SYSFS "poll_threshold");
+	long long entered = attr_read(SYSFS "poll_enter");
+	if (threshold < 0 || entered < 0) {
+		perror(SYSFS);
+		return 1;
+	}
+	double hybrid = run();
+	if (hybrid < 0)
+		return 1;
+	printf("hybrid: %.2f MB/s, entered polling %lld times\n", hybrid,
+			attr_read(SYSFS "poll_enter") - entered);
+	/* Baseline needs root */
+	if (attr_write(SYSFS "poll_threshold", 0)) {
+		perror(SYSFS "poll_threshold");
+		return 0;
+	}
+	double irq = run();
+	attr_write(SYSFS "poll_threshold", threshold);
+	if (irq < 0)
+		return 1;
+	printf("interrupts: %.2f MB/s, speedup %.2fx\n", irq, hybrid / irq);
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <poll.h>
+#include <errno.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define NMUX 8
+
+int main() {
+	struct pollfd pfd[NMUX];
+	size_t pos[NMUX] = { 0 };
+	int i, active = NMUX;
+	for (i = 0; i < NMUX; i++) {
+		pfd[i].fd = open("/dev/crc0", O_RDWR | O_NONBLOCK);
+		if (pfd[i].fd < 0) {
+			perror("open");
+			return 1;
+		}
+		if (crcdev_ioctl_set_params(pfd[i].fd, 0xedb88320,
+					0xffffffff)) {
+			perror("set_params");
+			return 1;
+		}
+		pfd[i].events = POLLOUT;
+	}
+	gen(buf, sizeof buf);
+	/* Single thread drives all sessions */
+	while (active > 0) {
+		if (poll(pfd, NMUX, -1) < 0) {
+			perror("poll");
+			return 1;
+		}
+		for (i = 0; i < NMUX; i++) {
+			if (pfd[i].revents & POLLOUT) {
+				ssize_t len = write(pfd[i].fd, buf + pos[i],
+						sizeof buf - pos[i]);
+				if (len < 0 && errno != EAGAIN) {
+					perror("write");
+					return 1;
+				}
+				if (len > 0)
+					pos[i] += len;
+				if (pos[i] == sizeof buf)
+					pfd[i].events = POLLIN;
+			} else if (pfd[i].revents & POLLIN) {
+				uint32_t sum;
+				if (crcdev_ioctl_get_result(pfd[i].fd, &sum)) {
+					if (errno == EAGAIN)
+						continue;
+					perror("get_result");
+					return 1;
+				}
+				sum ^= 0xffffffff;
+				printf("%08x\n", sum);
+				assert(sum == 0xc8402732);
+				pfd[i].events = 0;
+				active--;
+			}
+		}
+	}
+	return 0;
+}
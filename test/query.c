@@ -0,0 +1,79 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+char buf[0x400000];
+
+static uint32_t reference(uint32_t poly, uint32_t sum, const char *data,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+	}
+	return sum;
+}
+
+/* Event loop style: data is written without blocking, descriptor is left
+ * alone until its eventfd fires and progress is checked with QUERY */
+int main() {
+	struct crcdev_ioctl_query query;
+	struct pollfd pfd;
+	uint64_t events;
+	size_t written = 0;
+	ssize_t res;
+	int fd = open("/dev/crc0", O_RDWR | O_NONBLOCK);
+	int efd = eventfd(0, EFD_NONBLOCK);
+	if (fd < 0 || efd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff) ||
+			crcdev_ioctl_set_eventfd(fd, efd)) {
+		perror("ioctl");
+		return 1;
+	}
+	pfd.fd = efd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (written < sizeof buf) {
+			res = write(fd, buf + written, sizeof buf - written);
+			if (res < 0 && errno != EAGAIN) {
+				perror("write");
+				return 1;
+			}
+			if (res > 0)
+				written += res;
+		}
+		if (crcdev_ioctl_query(fd, &query)) {
+			perror("query");
+			return 1;
+		}
+		/* Sum always matches the prefix it claims to cover */
+		assert(query.sum_bytes + query.pending <= written);
+		assert(query.sum == reference(0xedb88320, 0xffffffff, buf,
+					query.sum_bytes));
+		if (written == sizeof buf &&
+				(query.flags & CRCDEV_QUERY_F_DONE))
+			break;
+		if (poll(&pfd, 1, -1) < 0) {
+			perror("poll");
+			return 1;
+		}
+		if (read(efd, &events, sizeof events) < 0 && errno != EAGAIN) {
+			perror("read");
+			return 1;
+		}
+	}
+	assert(query.sum_bytes == sizeof buf);
+	printf("%08x\n", query.sum ^ 0xffffffff);
+	assert((query.sum ^ 0xffffffff) == 0xc8402732);
+	return 0;
+}
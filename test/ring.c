@@ -0,0 +1,87 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define ENTRIES 16
+
+int main() {
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	struct crcdev_ioctl_ring_setup setup = { ENTRIES };
+	if (crcdev_ioctl_ring_setup(fd, &setup)) {
+		perror("ring_setup");
+		return 1;
+	}
+	char *rings = mmap(NULL, setup.rings_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, CRCDEV_RING_OFF_RINGS);
+	char *data = mmap(NULL, setup.data_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, CRCDEV_RING_OFF_DATA);
+	if (rings == MAP_FAILED || data == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	volatile struct crcdev_ring_head *head = (void *) rings;
+	struct crcdev_ring_sqe *sqes = (void *) (rings + setup.sq_off);
+	struct crcdev_ring_cqe *cqes = (void *) (rings + setup.cq_off);
+	gen(buf, sizeof buf);
+	/* Slots are reused in order, so there are ENTRIES of them in flight */
+	size_t pos = 0;
+	uint32_t sq_tail = 0, cq_head = 0, submitted, sum = 0;
+	int have_sum = 0;
+	while (cq_head * setup.slot_size < sizeof buf) {
+		uint32_t to_submit = 0;
+		while (pos < sizeof buf && sq_tail - cq_head < ENTRIES) {
+			uint32_t slot = sq_tail % ENTRIES;
+			memcpy(data + slot * setup.slot_size, buf + pos,
+					setup.slot_size);
+			sqes[slot].user_data = pos;
+			sqes[slot].slot = slot;
+			sqes[slot].len = setup.slot_size;
+			pos += setup.slot_size;
+			sq_tail++;
+			to_submit++;
+		}
+		__sync_synchronize();
+		head->sq_tail = sq_tail;
+		if (crcdev_ioctl_ring_enter(fd, to_submit, 1, &submitted)) {
+			perror("ring_enter");
+			return 1;
+		}
+		assert(submitted == to_submit);
+		while (cq_head != head->cq_tail) {
+			__sync_synchronize();
+			struct crcdev_ring_cqe *cqe = cqes + cq_head % ENTRIES;
+			assert(cqe->res == setup.slot_size);
+			assert(cqe->user_data == cq_head * setup.slot_size);
+			have_sum = cqe->flags & CRCDEV_CQE_F_SUM;
+			sum = cqe->sum;
+			cq_head++;
+		}
+		head->cq_head = cq_head;
+	}
+	/* Last completion drains the session */
+	assert(have_sum);
+	uint32_t result;
+	if (crcdev_ioctl_get_result(fd, &result)) {
+		perror("get_result");
+		return 1;
+	}
+	assert(sum == result);
+	sum ^= 0xffffffff;
+	printf("%08x\n", sum);
+	assert(sum == 0xc8402732);
+	return 0;
+}
@@ -0,0 +1,57 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+char buf[0x100000];
+
+/* Non-standard polynomial, software checksum cannot use lib/crc32 */
+#define POLY 0x82f63b78
+#define CHUNKSIZE 0x1000
+
+static uint32_t reference(uint32_t sum, const char *data, size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? POLY : 0);
+	}
+	return sum;
+}
+
+int main() {
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (crcdev_ioctl_set_params(fd, POLY, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	/* Mix of tiny writes (checksummed on CPU) and larger ones (device) */
+	size_t pos = 0;
+	while (pos < sizeof buf) {
+		size_t len = (rand() & 1) ? rand() % 64 + 1 :
+			rand() % CHUNKSIZE + 1;
+		if (pos + len > sizeof buf)
+			len = sizeof buf - pos;
+		if (write(fd, buf + pos, len) != len) {
+			perror("write");
+			return 1;
+		}
+		pos += len;
+	}
+	uint32_t sum;
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	uint32_t expected = reference(0xffffffff, buf, sizeof buf);
+	printf("%08x %08x\n", sum, expected);
+	assert(sum == expected);
+	return 0;
+}
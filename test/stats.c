@@ -0,0 +1,81 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define SYSFS "/sys/class/crcdev/crc0/"
+#define LAT_BUCKETS 24
+
+static long long attr(const char *name) {
+	char path[256];
+	long long val = -1;
+	snprintf(path, sizeof path, SYSFS "%s", name);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%lld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+/* Total of histogram, prints non-empty buckets if verbose */
+static long long hist(int verbose) {
+	long long val, total = 0;
+	int i;
+	FILE *f = fopen(SYSFS "latency_hist", "r");
+	if (!f)
+		return -1;
+	for (i = 0; i < LAT_BUCKETS && fscanf(f, "%lld", &val) == 1; i++) {
+		if (verbose && val)
+			printf("  %8u us: %lld\n", 1u << i, val);
+		total += val;
+	}
+	fclose(f);
+	return i == LAT_BUCKETS ? total : -1;
+}
+
+int main() {
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	long long done = attr("cmds_done"), bytes = attr("bytes_done");
+	long long lat = hist(0);
+	assert(done >= 0 && bytes >= 0 && lat >= 0);
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	if (write(fd, buf, sizeof buf) != sizeof buf) {
+		perror("write");
+		return 1;
+	}
+	uint32_t sum;
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	assert((sum ^ 0xffffffff) == 0xc8402732);
+	close(fd);
+	/* Other users of the device can only add to the counters */
+	done = attr("cmds_done") - done;
+	bytes = attr("bytes_done") - bytes;
+	lat = hist(0) - lat;
+	printf("commands %lld bytes %lld latency samples %lld\n", done, bytes,
+			lat);
+	assert(bytes >= (long long) sizeof buf);
+	assert(done > 0);
+	if (attr("latency_stats") > 0)
+		assert(lat >= done);
+	printf("free %lld waiting %lld scheduled %lld\n",
+			attr("tasks_free"), attr("tasks_waiting"),
+			attr("tasks_scheduled"));
+	hist(1);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+static uint32_t reference(uint32_t poly, uint32_t sum, const char *data,
+		size_t len) {
+	int bit;
+	while (len--) {
+		sum ^= (unsigned char) *data++;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+	}
+	return sum;
+}
+
+/* Streams whole buffer in random pieces */
+static uint32_t stream(uint32_t poly, const struct crcdev_stream_params *p) {
+	struct crcdev_stream *s = crcdev_stream_init(poly, 0xffffffff, p);
+	size_t pos = 0, len;
+	uint32_t sum;
+	if (!s) {
+		perror("stream_init");
+		exit(1);
+	}
+	while (pos < sizeof buf) {
+		len = (rand() & 1) ? rand() % 100 + 1 : rand() % 0x30000 + 1;
+		if (pos + len > sizeof buf)
+			len = sizeof buf - pos;
+		if (crcdev_stream_update(s, buf + pos, len)) {
+			perror("stream_update");
+			exit(1);
+		}
+		pos += len;
+	}
+	if (crcdev_stream_final(s, &sum)) {
+		perror("stream_final");
+		exit(1);
+	}
+	return sum;
+}
+
+int main() {
+	struct crcdev_stream_params params = { 0 };
+	struct crcdev_soft soft;
+	uint32_t polys[] = { 0xedb88320, 0x82f63b78 };
+	uint32_t ref, sum;
+	int i;
+	gen(buf, sizeof buf);
+	for (i = 0; i < 2; i++) {
+		ref = reference(polys[i], 0xffffffff, buf, sizeof buf);
+		/* CPU implementation and combine */
+		crcdev_soft_init(&soft, polys[i]);
+		assert(crcdev_soft_update(&soft, 0xffffffff, buf, sizeof buf)
+				== ref);
+		sum = crcdev_soft_update(&soft, 0, buf + 12345,
+				sizeof buf - 12345);
+		assert(crcdev_combine(crcdev_soft_update(&soft, 0xffffffff,
+						buf, 12345), sum,
+					sizeof buf - 12345, polys[i]) == ref);
+		params.flags = CRCDEV_STREAM_SOFT;
+		assert(stream(polys[i], &params) == ref);
+		/* Device, one session with automatic chunks */
+		assert(stream(polys[i], NULL) == ref);
+		/* Parallel segments, including one shorter than a chunk */
+		params.flags = 0;
+		params.sessions = 4;
+		params.segment = 0x30001;
+		assert(stream(polys[i], &params) == ref);
+		params.chunk = 0x1000;
+		params.segment = 0;
+		assert(stream(polys[i], &params) == ref);
+		params.sessions = 0;
+		params.chunk = 0;
+		printf("%08x\n", ref ^ 0xffffffff);
+	}
+	return 0;
+}
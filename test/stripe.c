@@ -0,0 +1,74 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define NRUNS 8
+#define STRIPE_MIN "/sys/class/crcdev/crc0/stripe_min"
+
+static int set_stripe_min(unsigned int val) {
+	FILE *f = fopen(STRIPE_MIN, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "%u\n", val);
+	return fclose(f);
+}
+
+/* One stream of NRUNS big writes, returns MB/s */
+static double run(void) {
+	int i, failures = 0;
+	double start = now();
+	for (i = 0; i < NRUNS; i++) {
+		int fd = open("/dev/crc0", O_RDWR);
+		if (fd < 0) {
+			perror("open");
+			return -1;
+		}
+		if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+			perror("set_params");
+			return -1;
+		}
+		if (write(fd, buf, sizeof buf) != sizeof buf) {
+			perror("write");
+			return -1;
+		}
+		uint32_t sum;
+		if (crcdev_ioctl_get_result(fd, &sum)) {
+			perror("get_result");
+			return -1;
+		}
+		failures += ((sum ^ 0xffffffff) != 0xc8402732);
+		close(fd);
+	}
+	assert(failures == 0);
+	return NRUNS * sizeof buf / (now() - start) / (1 << 20);
+}
+
+int main() {
+	gen(buf, sizeof buf);
+	unsigned int stripe_min;
+	FILE *f = fopen(STRIPE_MIN, "r");
+	if (!f || fscanf(f, "%u", &stripe_min) != 1) {
+		perror(STRIPE_MIN);
+		return 1;
+	}
+	fclose(f);
+	double striped = run();
+	if (striped < 0)
+		return 1;
+	printf("striped: %.2f MB/s\n", striped);
+	/* Baseline needs root */
+	if (set_stripe_min(0)) {
+		perror(STRIPE_MIN);
+		return 0;
+	}
+	double serial = run();
+	set_stripe_min(stripe_min);
+	if (serial < 0)
+		return 1;
+	printf("serial: %.2f MB/s, speedup %.2fx\n", serial, striped / serial);
+	return 0;
+}
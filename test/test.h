@@ -1,6 +1,5 @@
-#include <stdint.h>
-#include <stddef.h>
+#include "libcrcdev.h"
 
-int crcdev_ioctl_set_params(int fd, uint32_t poly, uint32_t sum);
-int crcdev_ioctl_get_result(int fd, uint32_t *sum);
 void gen(char *buf, size_t len);
+/* Monotonic clock in seconds */
+double now(void);
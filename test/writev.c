@@ -0,0 +1,54 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define NIOV 64
+#define FRAGSIZE 0x200
+
+int main() {
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	/* Many small fragments per syscall */
+	size_t pos = 0;
+	while (pos < sizeof buf) {
+		struct iovec iov[NIOV];
+		size_t total = 0;
+		int i;
+		for (i = 0; i < NIOV && pos + total < sizeof buf; i++) {
+			size_t len = rand() % FRAGSIZE + 1;
+			if (pos + total + len > sizeof buf)
+				len = sizeof buf - pos - total;
+			iov[i].iov_base = buf + pos + total;
+			iov[i].iov_len = len;
+			total += len;
+		}
+		if (writev(fd, iov, i) != total) {
+			perror("writev");
+			return 1;
+		}
+		pos += total;
+	}
+	uint32_t sum;
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	sum ^= 0xffffffff;
+	printf("%08x\n", sum);
+	assert(sum == 0xc8402732);
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include "test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+char buf[0x400000];
+
+#define CHUNKSIZE 0x10000
+
+int main() {
+	int fd = open("/dev/crc0", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (crcdev_ioctl_set_params(fd, 0xedb88320, 0xffffffff)) {
+		perror("set_params");
+		return 1;
+	}
+	gen(buf, sizeof buf);
+	uint32_t id;
+	if (crcdev_ioctl_buffer_register(fd, buf, sizeof buf, &id)) {
+		perror("buffer_register");
+		return 1;
+	}
+	/* Chunks of random length starting at unaligned offsets */
+	size_t pos = 0;
+	while (pos < sizeof buf) {
+		size_t len = rand() % CHUNKSIZE + 1;
+		if (pos + len > sizeof buf)
+			len = sizeof buf - pos;
+		if (crcdev_ioctl_buffer_submit(fd, id, pos, len) != len) {
+			perror("buffer_submit");
+			return 1;
+		}
+		pos += len;
+	}
+	uint32_t sum;
+	if (crcdev_ioctl_get_result(fd, &sum)) {
+		perror("get_result");
+		return 1;
+	}
+	if (crcdev_ioctl_buffer_unregister(fd, id)) {
+		perror("buffer_unregister");
+		return 1;
+	}
+	sum ^= 0xffffffff;
+	printf("%08x\n", sum);
+	assert(sum == 0xc8402732);
+	return 0;
+}
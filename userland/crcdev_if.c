@@ -1,5 +1,4 @@
-#include "crcdev_ioctl.h"
-#include "test.h"
+#include "libcrcdev.h"
 #include <sys/ioctl.h>
 
 int crcdev_ioctl_set_params(int fd, uint32_t poly, uint32_t sum) {
@@ -15,3 +14,85 @@ int crcdev_ioctl_get_result(int fd, uint32_t *sum) {
 	*sum = arg.sum;
 	return res;
 }
+
+int crcdev_ioctl_buffer_register(int fd, const void *addr, size_t len,
+		uint32_t *id) {
+	struct crcdev_ioctl_buffer_register arg = {
+		(uintptr_t) addr, len, 0, 0 };
+	int res = ioctl(fd, CRCDEV_IOCTL_BUFFER_REGISTER, &arg);
+	if (res < 0)
+		return res;
+	*id = arg.id;
+	return res;
+}
+
+int crcdev_ioctl_buffer_unregister(int fd, uint32_t id) {
+	struct crcdev_ioctl_buffer_unregister arg = { id };
+	return ioctl(fd, CRCDEV_IOCTL_BUFFER_UNREGISTER, &arg);
+}
+
+int crcdev_ioctl_buffer_submit(int fd, uint32_t id, size_t offset,
+		uint32_t len) {
+	struct crcdev_ioctl_buffer_submit arg = { offset, len, id };
+	return ioctl(fd, CRCDEV_IOCTL_BUFFER_SUBMIT, &arg);
+}
+
+int crcdev_ioctl_ring_setup(int fd, struct crcdev_ioctl_ring_setup *setup) {
+	return ioctl(fd, CRCDEV_IOCTL_RING_SETUP, setup);
+}
+
+int crcdev_ioctl_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+		uint32_t *submitted) {
+	struct crcdev_ioctl_ring_enter arg = { to_submit, min_complete, 0, 0 };
+	int res = ioctl(fd, CRCDEV_IOCTL_RING_ENTER, &arg);
+	if (res < 0)
+		return res;
+	*submitted = arg.submitted;
+	return res;
+}
+
+int crcdev_ioctl_set_credits(int fd, uint32_t credits) {
+	struct crcdev_ioctl_set_credits arg = { credits, 0 };
+	return ioctl(fd, CRCDEV_IOCTL_SET_CREDITS, &arg);
+}
+
+int crcdev_ioctl_compute(int fd, uint32_t poly, uint32_t *sum,
+		const void *addr, size_t len) {
+	struct crcdev_ioctl_compute arg = {
+		poly, *sum, (uintptr_t) addr, len };
+	int res = ioctl(fd, CRCDEV_IOCTL_COMPUTE, &arg);
+	if (res < 0)
+		return res;
+	*sum = arg.sum;
+	return res;
+}
+
+int crcdev_ioctl_compute_batch(int fd, struct crcdev_ioctl_compute *descs,
+		uint32_t count, uint32_t *done) {
+	struct crcdev_ioctl_compute_batch arg = {
+		(uintptr_t) descs, count, 0 };
+	int res = ioctl(fd, CRCDEV_IOCTL_COMPUTE_BATCH, &arg);
+	if (res < 0)
+		return res;
+	*done = arg.done;
+	return res;
+}
+
+int crcdev_ioctl_query(int fd, struct crcdev_ioctl_query *query) {
+	return ioctl(fd, CRCDEV_IOCTL_QUERY, query);
+}
+
+int crcdev_ioctl_set_eventfd(int fd, int efd) {
+	struct crcdev_ioctl_set_eventfd arg = { efd, 0 };
+	return ioctl(fd, CRCDEV_IOCTL_SET_EVENTFD, &arg);
+}
+
+int crcdev_ioctl_checkpoint_save(int fd, uint32_t slot) {
+	struct crcdev_ioctl_checkpoint arg = { slot, 0 };
+	return ioctl(fd, CRCDEV_IOCTL_CHECKPOINT_SAVE, &arg);
+}
+
+int crcdev_ioctl_checkpoint_restore(int fd, uint32_t slot) {
+	struct crcdev_ioctl_checkpoint arg = { slot, 0 };
+	return ioctl(fd, CRCDEV_IOCTL_CHECKPOINT_RESTORE, &arg);
+}
@@ -20,4 +20,157 @@ struct crcdev_ioctl_get_result {
 };
 #define CRCDEV_IOCTL_GET_RESULT _IOR('C', 0x01, struct crcdev_ioctl_get_result)
 
+/* Pins user memory (which has to be writable, pinned pages count against
+ * RLIMIT_MEMLOCK) and maps it for device, data must not be modified until
+ * all submitted tasks complete, buffer is identified by returned id */
+struct crcdev_ioctl_buffer_register {
+	uint64_t addr;
+	uint64_t len;
+	uint32_t id;
+	uint32_t pad;
+};
+#define CRCDEV_IOCTL_BUFFER_REGISTER \
+	_IOWR('C', 0x02, struct crcdev_ioctl_buffer_register)
+
+struct crcdev_ioctl_buffer_unregister {
+	uint32_t id;
+};
+#define CRCDEV_IOCTL_BUFFER_UNREGISTER \
+	_IOW('C', 0x03, struct crcdev_ioctl_buffer_unregister)
+
+/* Queues len bytes at offset in registered buffer, just like write() this
+ * returns number of bytes queued */
+struct crcdev_ioctl_buffer_submit {
+	uint64_t offset;
+	uint32_t len;
+	uint32_t id;
+};
+#define CRCDEV_IOCTL_BUFFER_SUBMIT \
+	_IOW('C', 0x04, struct crcdev_ioctl_buffer_submit)
+
+/* Shared memory rings, mmap() offsets of rings and data slots areas */
+#define CRCDEV_RING_OFF_RINGS	0x00000000ULL
+#define CRCDEV_RING_OFF_DATA	0x10000000ULL
+
+/* Positions are free running, index of an entry is position & (entries - 1),
+ * sq_tail and cq_head are written by userspace, the rest by driver */
+struct crcdev_ring_head {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+};
+
+/* Checksum len bytes of given data slot */
+struct crcdev_ring_sqe {
+	uint64_t user_data;
+	uint32_t slot;
+	uint32_t len;
+};
+
+/* Sum is valid iff CRCDEV_CQE_F_SUM is set, that is when session has no more
+ * pending data */
+#define CRCDEV_CQE_F_SUM	0x00000001
+struct crcdev_ring_cqe {
+	uint64_t user_data;
+	uint32_t slot;
+	uint32_t flags;
+	uint32_t sum;
+	int32_t res;
+};
+
+/* Entries must be a power of two, there is one data slot per entry */
+struct crcdev_ioctl_ring_setup {
+	uint32_t entries;
+	uint32_t slot_size;
+	uint32_t sq_off;
+	uint32_t cq_off;
+	uint32_t rings_size;
+	uint32_t data_size;
+};
+#define CRCDEV_IOCTL_RING_SETUP \
+	_IOWR('C', 0x05, struct crcdev_ioctl_ring_setup)
+
+/* Submits up to to_submit entries, then waits for at least min_complete
+ * completions to be ready for reaping */
+struct crcdev_ioctl_ring_enter {
+	uint32_t to_submit;
+	uint32_t min_complete;
+	uint32_t submitted;
+	uint32_t pad;
+};
+#define CRCDEV_IOCTL_RING_ENTER \
+	_IOWR('C', 0x06, struct crcdev_ioctl_ring_enter)
+
+/* Limit of buffers held by this descriptor at once, 0 restores the device's
+ * default (session_credits in sysfs) */
+struct crcdev_ioctl_set_credits {
+	uint32_t credits;
+	uint32_t pad;
+};
+#define CRCDEV_IOCTL_SET_CREDITS \
+	_IOW('C', 0x07, struct crcdev_ioctl_set_credits)
+
+/* Checksums len bytes at addr starting from sum in one call and replaces sum
+ * with the result; session's own params and queued data are not affected,
+ * short buffers are checksummed on CPU without waiting for the session */
+struct crcdev_ioctl_compute {
+	uint32_t poly;
+	uint32_t sum;
+	uint64_t addr;
+	uint64_t len;
+};
+#define CRCDEV_IOCTL_COMPUTE \
+	_IOWR('C', 0x08, struct crcdev_ioctl_compute)
+
+/* Checksums count independent requests (array of crcdev_ioctl_compute at
+ * descs) in one call, their sums are replaced in place; done is the number
+ * of leading requests with results (a signal may stop the batch early),
+ * error is reported only if it is 0 */
+struct crcdev_ioctl_compute_batch {
+	uint64_t descs;
+	uint32_t count;
+	uint32_t done;
+};
+#define CRCDEV_IOCTL_COMPUTE_BATCH \
+	_IOWR('C', 0x09, struct crcdev_ioctl_compute_batch)
+
+/* Returns at once: bytes queued and not yet checksummed (pending), running
+ * sum and number of bytes since SET_PARAMS it covers (sum_bytes), the sum is
+ * brought up to date whenever the session has nothing in flight on the
+ * device; CRCDEV_QUERY_F_DONE means nothing is pending and sum is final */
+struct crcdev_ioctl_query {
+	uint64_t pending;
+	uint64_t sum_bytes;
+	uint32_t sum;
+	uint32_t flags;
+};
+#define	CRCDEV_QUERY_F_DONE	1
+#define CRCDEV_IOCTL_QUERY \
+	_IOR('C', 0x0a, struct crcdev_ioctl_query)
+
+/* Eventfd which is signalled whenever this descriptor's data drains (and on
+ * device removal), negative fd unregisters it; sessions with eventfd are not
+ * striped so that one signal covers all their data */
+struct crcdev_ioctl_set_eventfd {
+	int32_t fd;
+	uint32_t pad;
+};
+#define CRCDEV_IOCTL_SET_EVENTFD \
+	_IOW('C', 0x0b, struct crcdev_ioctl_set_eventfd)
+
+/* Saves session's state (poly, sum once all data written so far is
+ * checksummed, and bytes since SET_PARAMS) in one of CRCDEV_CHECKPOINTS
+ * slots or restores it, so that data following a common prefix can be
+ * checksummed again and again without the prefix */
+#define	CRCDEV_CHECKPOINTS	16
+struct crcdev_ioctl_checkpoint {
+	uint32_t slot;
+	uint32_t pad;
+};
+#define CRCDEV_IOCTL_CHECKPOINT_SAVE \
+	_IOW('C', 0x0c, struct crcdev_ioctl_checkpoint)
+#define CRCDEV_IOCTL_CHECKPOINT_RESTORE \
+	_IOW('C', 0x0d, struct crcdev_ioctl_checkpoint)
+
 #endif
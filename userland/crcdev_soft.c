@@ -0,0 +1,86 @@
+#include "libcrcdev.h"
+
+void crcdev_soft_init(struct crcdev_soft *soft, uint32_t poly) {
+	uint32_t sum;
+	int i, bit, k;
+	soft->poly = poly;
+	for (i = 0; i < 256; i++) {
+		sum = i;
+		for (bit = 0; bit < 8; bit++)
+			sum = (sum >> 1) ^ ((sum & 1) ? poly : 0);
+		soft->table[0][i] = sum;
+	}
+	/* Table k advances byte by k more zero bytes */
+	for (k = 1; k < 8; k++)
+		for (i = 0; i < 256; i++) {
+			sum = soft->table[k - 1][i];
+			soft->table[k][i] = (sum >> 8) ^
+				soft->table[0][sum & 0xff];
+		}
+}
+
+static uint32_t crcdev_soft_le32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+uint32_t crcdev_soft_update(const struct crcdev_soft *soft, uint32_t sum,
+		const void *data, size_t len) {
+	const unsigned char *p = data;
+	const uint32_t (*t)[256] = soft->table;
+	uint32_t hi;
+	for (; len >= 8; len -= 8, p += 8) {
+		sum ^= crcdev_soft_le32(p);
+		hi = crcdev_soft_le32(p + 4);
+		sum = t[7][sum & 0xff] ^ t[6][(sum >> 8) & 0xff] ^
+			t[5][(sum >> 16) & 0xff] ^ t[4][sum >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+			t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	while (len--)
+		sum = t[0][(sum ^ *p++) & 0xff] ^ (sum >> 8);
+	return sum;
+}
+
+/* Operators on sums are 32x32 matrices over GF(2), one column per word */
+#define	CRCDEV_GF2_DIM	32
+
+static uint32_t crcdev_gf2_times(const uint32_t *mat, uint32_t vec) {
+	uint32_t sum = 0;
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+static void crcdev_gf2_square(uint32_t *square, const uint32_t *mat) {
+	int n;
+	for (n = 0; n < CRCDEV_GF2_DIM; n++)
+		square[n] = crcdev_gf2_times(mat, mat[n]);
+}
+
+/* Same as crc_soft_combine() in the driver */
+uint32_t crcdev_combine(uint32_t sum1, uint32_t sum2, size_t len2,
+		uint32_t poly) {
+	uint32_t even[CRCDEV_GF2_DIM], odd[CRCDEV_GF2_DIM], row = 1;
+	int n;
+	if (0 == len2)
+		return sum1 ^ sum2;
+	odd[0] = poly;
+	for (n = 1; n < CRCDEV_GF2_DIM; n++, row <<= 1)
+		odd[n] = row;
+	crcdev_gf2_square(even, odd);
+	crcdev_gf2_square(odd, even);
+	do {
+		crcdev_gf2_square(even, odd);
+		if (len2 & 1)
+			sum1 = crcdev_gf2_times(even, sum1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+		crcdev_gf2_square(odd, even);
+		if (len2 & 1)
+			sum1 = crcdev_gf2_times(odd, sum1);
+		len2 >>= 1;
+	} while (len2);
+	return sum1 ^ sum2;
+}
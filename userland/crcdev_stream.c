@@ -0,0 +1,405 @@
+#include "libcrcdev.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define	CRCDEV_BUF_FREE		0
+#define	CRCDEV_BUF_FILLED	1
+
+struct crcdev_buf {
+	char *data;
+	size_t len;
+	/* Bytes caller can put into buffer */
+	size_t limit;
+	size_t segment;
+	/* Last chunk of segment, sum is read after writing it */
+	int end;
+	int state;
+};
+
+/* Caller fills bufs[tail] while helper writes bufs[head] */
+struct crcdev_lane {
+	struct crcdev_stream *stream;
+	pthread_t thread;
+	int fd;
+	struct crcdev_buf bufs[2];
+	int head;
+	int tail;
+};
+
+struct crcdev_segment {
+	uint32_t sum;
+	size_t len;
+};
+
+struct crcdev_stream {
+	uint32_t poly;
+	uint32_t sum;
+	/* CPU mode if not NULL */
+	struct crcdev_soft *soft;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct crcdev_lane *lanes;		// lock(r)
+	unsigned int nlanes;
+	size_t buf_size;
+	/* Caller only */
+	struct crcdev_buf *cur;
+	size_t segment_size;
+	size_t seg_fill;
+	/* Fixed chunk size or zero */
+	size_t chunk_fixed;
+	size_t chunk;				// lock(rw)
+	/* Measured throughput in bytes per second */
+	double rate;				// lock(rw)
+	size_t seg_idx;				// lock(rw)
+	struct crcdev_segment *segs;		// lock(rw)
+	size_t segs_cap;			// lock(rw)
+	int error;				// lock(rw)
+	int stop;				// lock(rw)
+};
+
+static double crcdev_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int crcdev_write_all(int fd, const char *data, size_t len) {
+	ssize_t rv;
+	while (len > 0) {
+		if ((rv = write(fd, data, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += rv;
+		len -= rv;
+	}
+	return 0;
+}
+
+/* CRITICAL (lock) */
+static void crcdev_stream_measure(struct crcdev_stream *stream,
+		size_t bytes, double seconds) {
+	double rate;
+	size_t chunk = CRCDEV_STREAM_CHUNK_MIN;
+	if (stream->chunk_fixed || bytes < CRCDEV_STREAM_CHUNK_MIN ||
+			seconds <= 0)
+		return;
+	rate = bytes / seconds;
+	stream->rate = stream->rate ? (3 * stream->rate + rate) / 4 : rate;
+	while (chunk < stream->buf_size && chunk < stream->rate *
+			CRCDEV_STREAM_TARGET_NS / 1e9)
+		chunk <<= 1;
+	stream->chunk = chunk;
+}
+
+static void *crcdev_lane_run(void *arg) {
+	struct crcdev_lane *lane = arg;
+	struct crcdev_stream *stream = lane->stream;
+	struct crcdev_buf *buf;
+	uint32_t sum = 0;
+	double start, elapsed = 0;
+	int failed, rv, err;
+	pthread_mutex_lock(&stream->lock);
+	/* BEGIN CRITICAL (lock) */
+	for (;;) {
+		buf = &lane->bufs[lane->head];
+		if (buf->state != CRCDEV_BUF_FILLED) {
+			if (stream->stop)
+				break;
+			pthread_cond_wait(&stream->cond, &stream->lock);
+			continue;
+		}
+		failed = stream->error;
+		/* END CRITICAL (lock) */
+		pthread_mutex_unlock(&stream->lock);
+		rv = 0;
+		if (!failed) {
+			start = crcdev_now();
+			rv = crcdev_write_all(lane->fd, buf->data, buf->len);
+			elapsed = crcdev_now() - start;
+			/* Next segment on this session starts from zero */
+			if (!rv && buf->end && !(rv = crcdev_ioctl_get_result(
+							lane->fd, &sum)))
+				rv = crcdev_ioctl_set_params(lane->fd,
+						stream->poly, 0);
+		}
+		err = rv ? errno : 0;
+		pthread_mutex_lock(&stream->lock);
+		/* BEGIN CRITICAL (lock) */
+		if (rv && !stream->error)
+			stream->error = err ? err : EIO;
+		if (!failed && !rv) {
+			crcdev_stream_measure(stream, buf->len, elapsed);
+			if (buf->end)
+				stream->segs[buf->segment].sum = sum;
+		}
+		buf->state = CRCDEV_BUF_FREE;
+		lane->head ^= 1;
+		pthread_cond_broadcast(&stream->cond);
+	}
+	/* END CRITICAL (lock) */
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+/* Opens device for every lane, returns 1 if none of default devices exists
+ * and -1 with errno set on failure */
+static int crcdev_stream_open(struct crcdev_stream *stream,
+		const char *device) {
+	static const char *defaults[] = { "/dev/crc-any", "/dev/crc0", NULL };
+	const char *paths[2] = { device, NULL };
+	const char **path = device ? paths : defaults;
+	struct crcdev_lane *lane;
+	unsigned int idx;
+	int fd = -1;
+	for (; *path; path++) {
+		if ((fd = open(*path, O_RDWR)) >= 0)
+			break;
+		if (device || (errno != ENOENT && errno != ENODEV &&
+					errno != ENXIO))
+			return -1;
+	}
+	if (fd < 0)
+		return 1;
+	for (idx = 0; idx < stream->nlanes; idx++) {
+		lane = &stream->lanes[idx];
+		lane->fd = idx ? open(*path, O_RDWR) : fd;
+		if (lane->fd < 0 || crcdev_ioctl_set_params(lane->fd,
+					stream->poly, 0))
+			return -1;
+	}
+	return 0;
+}
+
+static void crcdev_stream_free(struct crcdev_stream *stream) {
+	struct crcdev_lane *lane;
+	unsigned int idx;
+	int buf;
+	if (stream->lanes) {
+		for (idx = 0; idx < stream->nlanes; idx++) {
+			lane = &stream->lanes[idx];
+			if (lane->fd >= 0)
+				close(lane->fd);
+			for (buf = 0; buf < 2; buf++)
+				free(lane->bufs[buf].data);
+		}
+		free(stream->lanes);
+	}
+	free(stream->segs);
+	free(stream->soft);
+	pthread_cond_destroy(&stream->cond);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream);
+}
+
+/* Stops helpers after they write all filled buffers */
+static void crcdev_stream_stop(struct crcdev_stream *stream,
+		unsigned int started) {
+	pthread_mutex_lock(&stream->lock);
+	stream->stop = 1;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->lock);
+	while (started-- > 0)
+		pthread_join(stream->lanes[started].thread, NULL);
+}
+
+struct crcdev_stream *crcdev_stream_init(uint32_t poly, uint32_t sum,
+		const struct crcdev_stream_params *params) {
+	static const struct crcdev_stream_params defaults;
+	struct crcdev_stream *stream;
+	struct crcdev_lane *lane;
+	unsigned int idx, started = 0;
+	int buf, err, rv = 0;
+	if (!params)
+		params = &defaults;
+	if (params->chunk > CRCDEV_STREAM_CHUNK_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(stream = calloc(1, sizeof(*stream))))
+		return NULL;
+	stream->poly = poly;
+	stream->sum = sum;
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->cond, NULL);
+	stream->nlanes = params->sessions ? params->sessions : 1;
+	stream->chunk_fixed = params->chunk;
+	stream->chunk = params->chunk ? params->chunk :
+		CRCDEV_STREAM_CHUNK_MIN;
+	stream->buf_size = params->chunk ? params->chunk :
+		CRCDEV_STREAM_CHUNK_MAX;
+	/* One session never needs intermediate sums */
+	stream->segment_size = stream->nlanes == 1 ? SIZE_MAX :
+		params->segment ? params->segment : CRCDEV_STREAM_SEGMENT;
+	if (!(stream->lanes = calloc(stream->nlanes, sizeof(*stream->lanes))))
+		goto fail;
+	for (idx = 0; idx < stream->nlanes; idx++)
+		stream->lanes[idx].fd = -1;
+	if (!(params->flags & CRCDEV_STREAM_SOFT) &&
+			(rv = crcdev_stream_open(stream, params->device)) < 0)
+		goto fail;
+	if ((params->flags & CRCDEV_STREAM_SOFT) || rv > 0) {
+		if (!(stream->soft = malloc(sizeof(*stream->soft))))
+			goto fail;
+		crcdev_soft_init(stream->soft, poly);
+		return stream;
+	}
+	for (idx = 0; idx < stream->nlanes; idx++) {
+		lane = &stream->lanes[idx];
+		lane->stream = stream;
+		for (buf = 0; buf < 2; buf++) {
+			err = posix_memalign((void **) &lane->bufs[buf].data,
+					4096, stream->buf_size);
+			if (err) {
+				errno = err;
+				goto fail;
+			}
+		}
+	}
+	for (; started < stream->nlanes; started++)
+		if ((err = pthread_create(&stream->lanes[started].thread, NULL,
+						crcdev_lane_run,
+						&stream->lanes[started]))) {
+			errno = err;
+			goto fail;
+		}
+	return stream;
+fail:
+	err = errno;
+	crcdev_stream_stop(stream, started);
+	crcdev_stream_free(stream);
+	errno = err;
+	return NULL;
+}
+
+/* Returns buffer to fill for current segment or NULL on failure */
+static struct crcdev_buf *crcdev_stream_acquire(struct crcdev_stream *stream)
+{
+	struct crcdev_lane *lane;
+	struct crcdev_buf *buf;
+	size_t left = stream->segment_size - stream->seg_fill;
+	pthread_mutex_lock(&stream->lock);
+	/* BEGIN CRITICAL (lock) */
+	lane = &stream->lanes[stream->seg_idx % stream->nlanes];
+	buf = &lane->bufs[lane->tail];
+	while (buf->state != CRCDEV_BUF_FREE && !stream->error)
+		pthread_cond_wait(&stream->cond, &stream->lock);
+	if (stream->error) {
+		errno = stream->error;
+		buf = NULL;
+	} else {
+		lane->tail ^= 1;
+		buf->len = 0;
+		buf->limit = stream->chunk < left ? stream->chunk : left;
+		buf->segment = stream->seg_idx;
+		buf->end = 0;
+	}
+	/* END CRITICAL (lock) */
+	pthread_mutex_unlock(&stream->lock);
+	return buf;
+}
+
+/* Hands current buffer to helper, closes segment if end is set */
+static int crcdev_stream_submit(struct crcdev_stream *stream, int end) {
+	struct crcdev_buf *buf = stream->cur;
+	struct crcdev_segment *segs;
+	size_t cap;
+	int rv = 0;
+	pthread_mutex_lock(&stream->lock);
+	/* BEGIN CRITICAL (lock) */
+	if (end && stream->seg_idx == stream->segs_cap) {
+		cap = stream->segs_cap ? 2 * stream->segs_cap : 16;
+		if ((segs = realloc(stream->segs, cap * sizeof(*segs)))) {
+			stream->segs = segs;
+			stream->segs_cap = cap;
+		} else {
+			stream->error = ENOMEM;
+			rv = -1;
+		}
+	}
+	if (end && !rv) {
+		stream->segs[stream->seg_idx].len = stream->seg_fill;
+		stream->seg_idx++;
+		stream->seg_fill = 0;
+	}
+	buf->end = end && !rv;
+	buf->state = CRCDEV_BUF_FILLED;
+	pthread_cond_broadcast(&stream->cond);
+	/* END CRITICAL (lock) */
+	pthread_mutex_unlock(&stream->lock);
+	stream->cur = NULL;
+	if (rv)
+		errno = ENOMEM;
+	return rv;
+}
+
+int crcdev_stream_update(struct crcdev_stream *stream, const void *data,
+		size_t len) {
+	const char *pos = data;
+	struct crcdev_buf *buf;
+	size_t n;
+	if (stream->soft) {
+		stream->sum = crcdev_soft_update(stream->soft, stream->sum,
+				data, len);
+		return 0;
+	}
+	while (len > 0) {
+		if (!stream->cur && !(stream->cur =
+					crcdev_stream_acquire(stream)))
+			return -1;
+		buf = stream->cur;
+		n = buf->limit - buf->len;
+		if (n > len)
+			n = len;
+		memcpy(buf->data + buf->len, pos, n);
+		buf->len += n;
+		stream->seg_fill += n;
+		pos += n;
+		len -= n;
+		if (buf->len == buf->limit && crcdev_stream_submit(stream,
+					stream->seg_fill ==
+					stream->segment_size))
+			return -1;
+	}
+	return 0;
+}
+
+int crcdev_stream_final(struct crcdev_stream *stream, uint32_t *sum) {
+	size_t idx;
+	int rv = 0;
+	if (stream->soft) {
+		*sum = stream->sum;
+		crcdev_stream_free(stream);
+		return 0;
+	}
+	/* Unfinished segment is closed, possibly with an empty chunk */
+	if (stream->seg_fill > 0 && !stream->cur &&
+			!(stream->cur = crcdev_stream_acquire(stream)))
+		rv = -1;
+	if (stream->cur && crcdev_stream_submit(stream, 1))
+		rv = -1;
+	crcdev_stream_stop(stream, stream->nlanes);
+	if (!rv && stream->error) {
+		errno = stream->error;
+		rv = -1;
+	}
+	if (!rv) {
+		*sum = stream->sum;
+		for (idx = 0; idx < stream->seg_idx; idx++)
+			*sum = crcdev_combine(*sum, stream->segs[idx].sum,
+					stream->segs[idx].len, stream->poly);
+	}
+	crcdev_stream_free(stream);
+	return rv;
+}
+
+int crcdev_stream_is_soft(const struct crcdev_stream *stream) {
+	return stream->soft != NULL;
+}
@@ -0,0 +1,111 @@
+#!/usr/bin/env python
+"""Latency report from crcdev tracepoints.
+
+Reads ftrace (trace_pipe, trace-cmd report) or perf script output, e.g.
+
+    echo 1 > /sys/kernel/debug/tracing/events/crcdev/enable
+    cat /sys/kernel/debug/tracing/trace_pipe > trace.txt
+    ./crclat.py trace.txt
+
+and prints per-stage latency of tasks (reserve -> queue -> schedule ->
+complete), time spent in session waits by reason and the longest stalls.
+"""
+
+import re
+import sys
+
+EVENT = re.compile(r'\s(\d+\.\d+):\s+(?:crcdev:)?(crcdev_\w+):\s+(.*)$')
+FIELD = re.compile(r'(\w+)=(\S+)')
+
+STAGES = [
+    ('fill', 'crcdev_task_reserve', 'crcdev_task_queue'),
+    ('queued', 'crcdev_task_queue', 'crcdev_task_schedule'),
+    ('device', 'crcdev_task_schedule', 'crcdev_task_complete'),
+    ('total', 'crcdev_task_reserve', 'crcdev_task_complete'),
+]
+
+
+def percentile(values, pct):
+    idx = min(len(values) - 1, int(len(values) * pct / 100.0))
+    return values[idx]
+
+
+def report(name, values):
+    if not values:
+        return
+    values.sort()
+    print('%-14s %8d %10.1f %10.1f %10.1f %10.1f' % (
+        name, len(values), sum(values) / len(values),
+        percentile(values, 50), percentile(values, 99), values[-1]))
+
+
+def main(argv):
+    top = 10
+    paths = []
+    for arg in argv[1:]:
+        if arg.startswith('--top='):
+            top = int(arg[len('--top='):])
+        else:
+            paths.append(arg)
+    files = [open(path) for path in paths] or [sys.stdin]
+
+    # Tasks are reused once completed, pointer identifies the current one
+    tasks = {}
+    waits = {}
+    stages = dict((name, []) for name, _, _ in STAGES)
+    wait_times = {}
+    stalls = []
+    for f in files:
+        for line in f:
+            match = EVENT.search(line)
+            if not match:
+                continue
+            stamp = float(match.group(1)) * 1e6
+            event = match.group(2)
+            fields = dict(FIELD.findall(match.group(3)))
+            key = (fields.get('minor'), fields.get('task'))
+            if event == 'crcdev_task_reserve':
+                tasks[key] = {event: stamp}
+            elif event.startswith('crcdev_task_') and key in tasks:
+                tasks[key][event] = stamp
+                if event != 'crcdev_task_complete':
+                    continue
+                seen = tasks.pop(key)
+                for name, start, end in STAGES:
+                    if start in seen and end in seen:
+                        stages[name].append(seen[end] - seen[start])
+            elif event == 'crcdev_wait_start':
+                wkey = (fields.get('minor'), fields.get('sess'),
+                        fields.get('reason'))
+                waits.setdefault(wkey, []).append(stamp)
+            elif event == 'crcdev_wait_end':
+                wkey = (fields.get('minor'), fields.get('sess'),
+                        fields.get('reason'))
+                if not waits.get(wkey):
+                    continue
+                start = waits[wkey].pop()
+                wait_times.setdefault(wkey[2], []).append(stamp - start)
+                stalls.append((stamp - start, start, wkey))
+            elif event == 'crcdev_device_remove':
+                print('device %s removed at %.6f' % (fields.get('minor'),
+                                                     stamp / 1e6))
+
+    print('%-14s %8s %10s %10s %10s %10s' % ('stage (us)', 'count', 'avg',
+                                             'p50', 'p99', 'max'))
+    for name, _, _ in STAGES:
+        report(name, stages[name])
+    for reason in sorted(wait_times):
+        report('wait ' + reason, wait_times[reason])
+    if stalls and top > 0:
+        print('\nlongest waits:')
+        stalls.sort(reverse=True)
+        for length, start, (minor, sess, reason) in stalls[:top]:
+            print('  %10.1f us at %.6f minor %s sess %s %s' % (
+                length, start / 1e6, minor, sess, reason))
+    if tasks:
+        print('\n%d tasks without completion' % len(tasks))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,90 @@
+#ifndef LIBCRCDEV_H_
+#define LIBCRCDEV_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crcdev_ioctl.h"
+
+/* Unless stated otherwise functions return 0 on success and -1 with errno
+ * set on failure, sums are raw reflected CRC32 registers just like in ioctls:
+ * neither input nor output is inverted */
+
+/* Ioctl wrappers */
+int crcdev_ioctl_set_params(int fd, uint32_t poly, uint32_t sum);
+int crcdev_ioctl_get_result(int fd, uint32_t *sum);
+int crcdev_ioctl_buffer_register(int fd, const void *addr, size_t len,
+		uint32_t *id);
+int crcdev_ioctl_buffer_unregister(int fd, uint32_t id);
+int crcdev_ioctl_buffer_submit(int fd, uint32_t id, size_t offset,
+		uint32_t len);
+int crcdev_ioctl_ring_setup(int fd, struct crcdev_ioctl_ring_setup *setup);
+int crcdev_ioctl_ring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+		uint32_t *submitted);
+int crcdev_ioctl_set_credits(int fd, uint32_t credits);
+/* Sum is both the initial value and the result */
+int crcdev_ioctl_compute(int fd, uint32_t poly, uint32_t *sum,
+		const void *addr, size_t len);
+/* Sums of descs are replaced in place, done is the number of leading ones */
+int crcdev_ioctl_compute_batch(int fd, struct crcdev_ioctl_compute *descs,
+		uint32_t count, uint32_t *done);
+int crcdev_ioctl_query(int fd, struct crcdev_ioctl_query *query);
+/* Negative efd unregisters */
+int crcdev_ioctl_set_eventfd(int fd, int efd);
+int crcdev_ioctl_checkpoint_save(int fd, uint32_t slot);
+int crcdev_ioctl_checkpoint_restore(int fd, uint32_t slot);
+
+/* CPU implementation, slicing by 8 bytes */
+struct crcdev_soft {
+	uint32_t poly;
+	uint32_t table[8][256];
+};
+
+void crcdev_soft_init(struct crcdev_soft *soft, uint32_t poly);
+uint32_t crcdev_soft_update(const struct crcdev_soft *soft, uint32_t sum,
+		const void *data, size_t len);
+
+/* Sum of concatenation given sum of the first part and sum of the second one
+ * (of len2 bytes) computed from zero state */
+uint32_t crcdev_combine(uint32_t sum1, uint32_t sum2, size_t len2,
+		uint32_t poly);
+
+/* Streaming checksum, data passed to update is copied to chunk buffers which
+ * helper threads (one per session) write to the device while the caller
+ * fills next ones. With more than one session consecutive segments of the
+ * stream go to consecutive sessions and partial sums are combined at the end.
+ * If no device is present checksum is computed on the CPU. */
+struct crcdev_stream;
+
+/* Forces CPU implementation */
+#define	CRCDEV_STREAM_SOFT	1
+
+/* Zeroed parameters are valid and mean defaults */
+struct crcdev_stream_params {
+	/* NULL tries /dev/crc-any and then /dev/crc0 */
+	const char *device;
+	/* Sessions (and helper threads), default is one */
+	unsigned int sessions;
+	/* Bytes per write, by default chunks are sized so that write takes
+	 * about CRCDEV_STREAM_TARGET_NS at measured throughput */
+	size_t chunk;
+	/* Bytes per segment with more than one session */
+	size_t segment;
+	unsigned int flags;
+};
+
+#define	CRCDEV_STREAM_CHUNK_MIN		0x4000
+#define	CRCDEV_STREAM_CHUNK_MAX		0x400000
+#define	CRCDEV_STREAM_SEGMENT		0x1000000
+#define	CRCDEV_STREAM_TARGET_NS		1000000
+
+/* Returns NULL with errno set on failure */
+struct crcdev_stream *crcdev_stream_init(uint32_t poly, uint32_t sum,
+		const struct crcdev_stream_params *params);
+int crcdev_stream_update(struct crcdev_stream *stream, const void *data,
+		size_t len);
+/* Waits for all data, frees stream even on failure */
+int crcdev_stream_final(struct crcdev_stream *stream, uint32_t *sum);
+/* Nonzero if stream computes on the CPU */
+int crcdev_stream_is_soft(const struct crcdev_stream *stream);
+
+#endif  // LIBCRCDEV_H_